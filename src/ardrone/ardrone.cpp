@@ -9,6 +9,10 @@ ARDrone::ARDrone(const char *ardrone_addr)
     // IP Address
     strncpy(ip, ARDRONE_DEFAULT_ADDR, 16);
 
+    // Port numbers
+    setPorts(NULL);
+    setLocalPorts(NULL);
+
     // Sequence number
     seq = 1;
 
@@ -18,13 +22,50 @@ ARDrone::ARDrone(const char *ardrone_addr)
     // Timer
     timerWdg     = ardGetTickCount();
 
+    // Set point of AT*PCMD
+    pcmdMode    = 0;
+    pcmdValue[0] = pcmdValue[1] = pcmdValue[2] = pcmdValue[3] = 0.0f;
+    timePcmd    = 0.0;
+    rateCommand = ARDRONE_COMMAND_RATE;
+    timeoutCommand = ARDRONE_COMMAND_TIMEOUT;
+
+    // State of openAsync()
+    for (int i = 0; i < ARDRONE_OPEN_STAGES; i++) {
+        openTasks[i].ardrone = this;
+        openTasks[i].stage   = i;
+    }
+    openPending  = 0;
+    openResult   = 0;
+    openProgress = 0;
+    eventOpen    = INVALID_HANDLE_VALUE;
+    wsa          = 0;
+    openCallback = NULL;
+    openArg      = NULL;
+
+    // Thread for AT command (The set point can be changed before open())
+    flagCommand   = 0;
+    threadCommand = INVALID_HANDLE_VALUE;
+    mutexCommand  = CreateMutex(NULL, FALSE, NULL);
+    eventCommand  = INVALID_HANDLE_VALUE;
+    sizeCommand   = 0;
+
     // Navdata
     ZeroMemory(&navdata, sizeof(NAVDATA));
 
-    // Thread for Navdata
-    flagNavdata   = 0;
-    threadNavdata = INVALID_HANDLE_VALUE;
-    mutexNavdata  = INVALID_HANDLE_VALUE;
+    // Navdata on the reactor
+    flagNavdata  = 0;
+    mutexNavdata = INVALID_HANDLE_VALUE;
+    eventNavdata = INVALID_HANDLE_VALUE;
+
+    // Flight recorder
+    recorder = NULL;
+
+    // Configuration cache
+    mutexConfig = CreateMutex(NULL, FALSE, NULL);
+
+    // Navdata callbacks
+    ZeroMemory(callbacks, sizeof(callbacks));
+    mutexCallback = CreateMutex(NULL, FALSE, NULL);
 
     // Video
     pFormatCtx  = NULL;
@@ -33,12 +74,35 @@ ARDrone::ARDrone(const char *ardrone_addr)
     pFrameBGR   = NULL;
     bufferBGR   = NULL;
     pConvertCtx = NULL;
+    pStream     = NULL;
+    pPayload    = NULL;
+    sizePayload = 0;
 
     // Thread for video
     flagVideo   = 0;
     threadVideo = INVALID_HANDLE_VALUE;
     mutexVideo  = INVALID_HANDLE_VALUE;
 
+    // Video on the reactor
+    bufReceive = NULL;
+    bufDecode  = NULL;
+    sizeDecode = 0;
+    busyVideo  = 0;
+    droppedVideo = 0;
+
+    // Video decoded by a fleet
+    fleet       = NULL;
+    fleetIndex  = -1;
+    mutexPacket = CreateMutex(NULL, FALSE, NULL);
+    waitKey     = 0;
+
+    // Undistortion (Disabled)
+    undistort    = 0;
+    lutUndistort = NULL;
+    rectified    = 0;
+    for (int i = 0; i < 9; i++) camIntrinsic[i]  = 0.0;
+    for (int i = 0; i < 5; i++) camDistortion[i] = 0.0;
+
     // When IP address is specified, open it
     if (ardrone_addr) open(ardrone_addr);
 }
@@ -51,6 +115,65 @@ ARDrone::~ARDrone()
 {
     // Finalize the AR.Drone
     close();
+
+    // Delete the event of openAsync()
+    if (eventOpen != INVALID_HANDLE_VALUE) {
+        CloseHandle(eventOpen);
+        eventOpen = INVALID_HANDLE_VALUE;
+    }
+
+    // Delete the mutex for the set point
+    if (mutexCommand != INVALID_HANDLE_VALUE) {
+        CloseHandle(mutexCommand);
+        mutexCommand = INVALID_HANDLE_VALUE;
+    }
+
+    // Delete the mutex for callbacks
+    if (mutexCallback != INVALID_HANDLE_VALUE) {
+        CloseHandle(mutexCallback);
+        mutexCallback = INVALID_HANDLE_VALUE;
+    }
+
+    // Delete the mutex for the configuration cache
+    if (mutexConfig != INVALID_HANDLE_VALUE) {
+        CloseHandle(mutexConfig);
+        mutexConfig = INVALID_HANDLE_VALUE;
+    }
+
+    // Leave the fleet
+    if (fleet) fleet->remove(this);
+
+    // Delete the mutex for the packets
+    if (mutexPacket != INVALID_HANDLE_VALUE) {
+        CloseHandle(mutexPacket);
+        mutexPacket = INVALID_HANDLE_VALUE;
+    }
+
+    // Release the tables of the undistortion
+    releaseUndistortion();
+}
+
+// --------------------------------------------------------------------------
+// ardLockManager(Mutex, Operation)
+// Lock manager for FFmpeg, since several drones open codecs at the same time.
+// Return value SUCCESS: 0  FAILED: 1
+// --------------------------------------------------------------------------
+static int ardLockManager(void **mutex, enum AVLockOp op)
+{
+    switch (op) {
+        case AV_LOCK_CREATE:
+            *mutex = CreateMutex(NULL, FALSE, NULL);
+            return (*mutex == NULL);
+        case AV_LOCK_OBTAIN:
+            return (WaitForSingleObject((HANDLE)*mutex, INFINITE) != WAIT_OBJECT_0);
+        case AV_LOCK_RELEASE:
+            return !ReleaseMutex((HANDLE)*mutex);
+        case AV_LOCK_DESTROY:
+            CloseHandle((HANDLE)*mutex);
+            *mutex = NULL;
+            return 0;
+    }
+    return 1;
 }
 
 // --------------------------------------------------------------------------
@@ -60,42 +183,239 @@ ARDrone::~ARDrone()
 // --------------------------------------------------------------------------
 int ARDrone::open(const char *ardrone_addr)
 {
-    // Initialize WSA
-    WSAData wsaData;
-    WSAStartup(MAKEWORD(1,1), &wsaData);
+    // Run the stages and wait for them
+    if (!openAsync(ardrone_addr)) return 0;
+    return waitOpen(INFINITE) == 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::setPorts(Port numbers)
+// Change the remote port numbers, e.g. for ARDroneSimulator. NULL restores
+// the default ones. Local ports are set by setLocalPorts(). Call this before open().
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::setPorts(const ARDRONE_PORTS *ports)
+{
+    if (ports) this->ports = *ports;
+    else {
+        this->ports.version = ARDRONE_VERSION_PORT;
+        this->ports.navdata = ARDRONE_NAVDATA_PORT;
+        this->ports.video   = ARDRONE_VIDEO_PORT;
+        this->ports.command = ARDRONE_COMMAND_PORT;
+        this->ports.config  = ARDRONE_CONFIG_PORT;
+    }
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::setLocalPorts(Port numbers)
+// Change the local UDP port numbers, e.g. to run two or more instances in
+// one process. 0 means any free port. NULL restores the default ones, where
+// Navdata and video use the fixed ports and AT commands use a free one.
+// Version and config are TCP, so they are ignored. Call this before open().
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::setLocalPorts(const ARDRONE_PORTS *ports)
+{
+    if (ports) local = *ports;
+    else {
+        local.version = 0;
+        local.navdata = ARDRONE_NAVDATA_PORT;
+        local.video   = ARDRONE_VIDEO_PORT;
+        local.command = 0;
+        local.config  = 0;
+    }
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::openSocket(UDP socket, Remote port number, Local port number)
+// Open the UDP socket. AR.Drone replies to the source port, so when the local
+// port is used by another instance, any free port is used instead.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::openSocket(UDPSocket *sock, int port, int localPort)
+{
+    // Open the socket
+    if (sock->open(ip, port, localPort)) return 1;
+    if (localPort == 0) return 0;
+
+    // Retry with a free port
+    printf("WARNING: Local port %d is in use, trying a free one.\n", localPort);
+    if (!sock->open(ip, port, 0)) return 0;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::openAsync(IP address of AR.Drone, Progress callback, Argument of the callback)
+// Start the initialization and return immediately. The stages run on the
+// shared worker pool, so several drones can be opened at the same time.
+// Use waitOpen() or the callback to know the result.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::openAsync(const char *ardrone_addr, ARDRONE_OPEN_CALLBACK func, void *arg)
+{
+    // Already running (The event is set after the last stage has finished)
+    if (eventOpen != INVALID_HANDLE_VALUE && WaitForSingleObject(eventOpen, 0) != WAIT_OBJECT_0) {
+        printf("ERROR: ARDrone::openAsync() is running. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Initialize WSA (Once until close(), openAsync() may be retried)
+    if (!wsa) {
+        WSAData wsaData;
+        wsa = (WSAStartup(MAKEWORD(1,1), &wsaData) == 0);
+    }
 
-    // Initialize FFmpeg
-    av_register_all();
-    avformat_network_init();
-    av_log_set_level(AV_LOG_QUIET);
+    // Initialize FFmpeg (Once for all the drones)
+    static volatile LONG ffmpeg = 0;
+    if (InterlockedExchange(&ffmpeg, 1) == 0) {
+        av_lockmgr_register(ardLockManager);
+        av_register_all();
+        avformat_network_init();
+        av_log_set_level(AV_LOG_QUIET);
+    }
 
     // Save IP address
     strncpy(ip, ardrone_addr, 16);
 
-    // Get version informations
-    if (!getVersionInfo()) return 0;
-    printf("AR.Drone Ver. %d.%d.%d\n", version.major, version.minor, version.revision);
+    // Create an event
+    if (eventOpen == INVALID_HANDLE_VALUE) eventOpen = CreateEvent(NULL, TRUE, FALSE, NULL);
+    ResetEvent(eventOpen);
 
-    // Initialize Video
-    if (!initVideo()) return 0;
+    // Reset the state
+    openCallback = func;
+    openArg      = arg;
+    openResult   = 1;
+    openProgress = 0;
 
-    // Initialize AT Command
-    if (!initCommand()) return 0;
+    // Version information, AT command and Navdata do not depend on each other
+    openPending = 3;
+    startOpenStage(ARDRONE_OPEN_VERSION);
+    startOpenStage(ARDRONE_OPEN_COMMAND);
+    startOpenStage(ARDRONE_OPEN_NAVDATA);
 
-    // Initialize Configuretion
-    if (!initConfig()) return 0;
+    return 1;
+}
 
-    // Initialize Navdata
-    if (!initNavdata()) return 0;
+// --------------------------------------------------------------------------
+// ARDrone::waitOpen(Timeout [ms])
+// Wait for openAsync().
+// Return value SUCCESS: 1  FAILED: 0  RUNNING: -1 (Timeout)
+// --------------------------------------------------------------------------
+int ARDrone::waitOpen(DWORD timeout)
+{
+    // Not started
+    if (eventOpen == INVALID_HANDLE_VALUE) return 0;
 
-    // Wait for state update
-    Sleep(500);
+    // Wait for the stages
+    if (WaitForSingleObject(eventOpen, timeout) != WAIT_OBJECT_0) return -1;
+
+    return openResult ? 1 : 0;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::getOpenProgress()
+// Obtaining the stages of openAsync() finished successfully.
+// Return value Bits of the stages (1 << ARDRONE_OPEN_XXX)
+// --------------------------------------------------------------------------
+int ARDrone::getOpenProgress(void)
+{
+    return (int)openProgress;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::startOpenStage(Stage)
+// Run a stage of openAsync() on the shared worker pool.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::startOpenStage(int stage)
+{
+    if (!WorkerPool::shared()->submit(runOpenStage, &openTasks[stage])) {
+        // No worker, run it here
+        runOpenStage(&openTasks[stage]);
+    }
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::runOpenStage(Task)
+// Task function of the worker pool.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::runOpenStage(void *args)
+{
+    OPEN_TASK *task = reinterpret_cast<OPEN_TASK*>(args);
+    ARDrone *ardrone = task->ardrone;
+    int result = 0;
+
+    switch (task->stage) {
+        case ARDRONE_OPEN_VERSION:
+            // Get version informations
+            result = ardrone->getVersionInfo();
+            if (result) printf("AR.Drone Ver. %d.%d.%d\n", ardrone->version.major, ardrone->version.minor, ardrone->version.revision);
+            break;
+        case ARDRONE_OPEN_COMMAND:
+            // Initialize AT Command
+            result = ardrone->initCommand();
+            break;
+        case ARDRONE_OPEN_NAVDATA:
+            // Initialize Navdata
+            result = ardrone->initNavdata();
+            break;
+        case ARDRONE_OPEN_VIDEO:
+            // Initialize Video
+            result = ardrone->initVideo();
+            break;
+        case ARDRONE_OPEN_CONFIG:
+            // Initialize Configuretion
+            result = ardrone->initConfig();
+            break;
+    }
+
+    ardrone->finishOpenStage(task->stage, result);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::finishOpenStage(Stage, Result)
+// Record the result of a stage. The last one of the first group starts
+// video and configuration, which need the version information.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::finishOpenStage(int stage, int result)
+{
+    // Record the result
+    if (result) {
+        LONG prev, bits;
+        do {
+            prev = openProgress;
+            bits = prev | (1 << stage);
+        } while (InterlockedCompareExchange(&openProgress, bits, prev) != prev);
+    }
+    else InterlockedExchange(&openResult, 0);
+
+    // Report the progress
+    if (openCallback) openCallback(this, stage, result, openArg);
+
+    // Other stages are running
+    if (InterlockedDecrement(&openPending) > 0) return;
+
+    // Video and configuration need the version information
+    if (openResult && stage < ARDRONE_OPEN_VIDEO) {
+        openPending = 2;
+        startOpenStage(ARDRONE_OPEN_VIDEO);
+        startOpenStage(ARDRONE_OPEN_CONFIG);
+        return;
+    }
 
     // Reset emergency
-    resetWatchDog();
-    resetEmergency();
+    if (openResult) {
+        resetWatchDog();
+        resetEmergency();
+    }
+    // Tear down the stages already started
+    else finalizeOpen();
 
-    return 1;
+    // Finished
+    SetEvent(eventOpen);
 }
 
 // --------------------------------------------------------------------------
@@ -108,13 +428,9 @@ int ARDrone::update(void)
     // Check threads
     if (!flagVideo) return 0;
     if (!flagNavdata) return 0;
+    if (!flagCommand) return 0;
 
-    // Reset Watch-Dog every 100ms
-    if (ardGetTickCount() - timerWdg > 100) {
-        sockCommand.sendf("AT*COMWDG=%d\r", seq++);
-        timerWdg = ardGetTickCount();
-    }
-
+    // Watch-Dog is reset by the command thread
     return 1;
 }
 
@@ -125,9 +441,27 @@ int ARDrone::update(void)
 // --------------------------------------------------------------------------
 void ARDrone::close(void)
 {
+    // Wait for openAsync() (openPending reaches zero before the last stage has finished)
+    if (eventOpen != INVALID_HANDLE_VALUE) waitOpen(INFINITE);
+
     // Stop AR.Drone
     if (!onGround()) landing();
 
+    // Finalize all
+    finalizeOpen();
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::finalizeOpen()
+// Finalize everything open() initialized. This is also called when a stage
+// of openAsync() failed, so the others do not stay until close().
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::finalizeOpen(void)
+{
+    // Stop recording (before the Navdata mutex is released)
+    stopRecorder();
+
     // Finalize Navdata
     finalizeNavdata();
 
@@ -141,5 +475,8 @@ void ARDrone::close(void)
     finalizeVideo();
 
     // Finalize WSA
-    WSACleanup();
+    if (wsa) {
+        WSACleanup();
+        wsa = 0;
+    }
 }
\ No newline at end of file
@@ -21,6 +21,19 @@
 #include <string.h>
 #include <math.h>
 
+// STL
+#include <deque>
+#include <map>
+#include <string>
+
+// Number of sockets select() can wait for
+// winsock.h fixes it to 64 when it comes first, so the projects define FD_SETSIZE=256.
+#ifndef FD_SETSIZE
+#define FD_SETSIZE (256)
+#elif FD_SETSIZE < 256
+#error FD_SETSIZE must be 256 or more. Define FD_SETSIZE=256 in the project settings, or include ardrone.h before windows.h/winsock.h.
+#endif
+
 // Win32API
 #include <windows.h>
 
@@ -31,10 +44,6 @@
 #include <winsock.h>
 #pragma comment(lib, "wsock32.lib")
 
-// WinINet
-#include <wininet.h>
-#pragma comment(lib, "wininet.lib")
-
 // WinMM
 #include <mmsystem.h>
 #pragma comment(lib, "winmm.lib")
@@ -62,6 +71,30 @@ extern "C" {
 #define ARDRONE_CONFIG_PORT         (5559)          // Port number for configuration
 #define ARDRONE_DEFAULT_ADDR        "192.168.1.1"   // Default IP address of AR.Drone
 #define ARDRONE_NAVDATA_HEADER      (0x55667788)    // Header of Navdata
+#define ARDRONE_MAX_CALLBACKS       (16)            // Maximum number of Navdata callbacks
+#define ARDRONE_CALLBACK_BUDGET     (0.1)           // Real-time budget of a Navdata callback [ms]
+#define ARDRONE_COMMAND_RATE        (30)            // Default rate of AT*PCMD [Hz]
+#define ARDRONE_COMMAND_TIMEOUT     (500)           // Default time until the set point falls back to hovering [ms]
+#define ARDRONE_WATCHDOG_INTERVAL   (100)           // Interval of AT*COMWDG [ms]
+#define ARDRONE_CONFIG_TIMEOUT      (500)           // Default timeout of an AT*CONFIG acknowledgement [ms]
+#define ARDRONE_CONFIG_RETRIES      (3)             // Number of retries of AT*CONFIG
+#define ARDRONE_NAVDATA_TIMEOUT     (1000)          // Timeout of the first Navdata [ms]
+#define ARDRONE_CONFIG_READ_TIMEOUT (1000)          // Timeout of the configuration dump [ms]
+#define ARDRONE_CONFIG_READ_IDLE    (100)           // The dump is over when nothing comes for this [ms]
+#define ARDRONE_WORKER_THREADS      (16)            // Number of threads of the shared worker pool
+#define ARDRONE_DECODE_THREADS      (4)             // Number of threads of the decode pool
+#define ARDRONE_VERSION_TIMEOUT     (500)           // Timeout of each step of the FTP version probe [ms]
+#define ARDRONE_VERSION_LIFETIME    (600000)        // Default lifetime of the cached version information [ms]
+#define ARDRONE_REACTOR_SOCKETS     (255)           // Maximum number of sockets of a reactor (FD_SETSIZE - 1 for the loopback socket)
+#define ARDRONE_KEEPALIVE_INTERVAL  (200)           // Interval of the Navdata/video requests [ms]
+#define ARDRONE_UDP_BATCH           (16)            // Default number of datagrams of UDPBatch
+#define ARDRONE_UDP_SLOT_SIZE       (4096)          // Default size of a slot of UDPBatch [bytes]
+#define ARDRONE_TCP_BUFFER_SIZE     (65536)         // Default size of the ring buffer of TCPSocket [bytes]
+#define ARDRONE_SIMULATOR_PORT_OFFSET (10000)       // ARDroneSimulator listens on the port numbers + this by default
+#define ARDRONE_FLEET_THREADS       (16)            // Maximum number of decode threads of ARDroneFleet
+#define ARDRONE_FLEET_DRONES        (64)            // Maximum number of drones of ARDroneFleet
+#define ARDRONE_FLEET_PACKETS       (64)            // Maximum number of H.264 packets waiting for a decode thread
+#define ARDRONE_VIDEO_FRAMES        (64)            // Number of PaVE frame numbers kept for the H.264 packets
 
 // Math constants
 #ifndef M_PI
@@ -153,34 +186,80 @@ enum ARDRONE_LED_ANIMATION_ID {
     BLINK_STANDARD
 };
 
+// Batch of UDP datagrams
+// The slots are allocated once and reused by every receiveBatch()/sendBatch().
+class UDPBatch {
+public:
+    UDPBatch(int num = ARDRONE_UDP_BATCH, int size = ARDRONE_UDP_SLOT_SIZE);  // Constructor
+    ~UDPBatch();                            // Destructor
+    int   add(const void *data, int size);  // Add a datagram to send
+    void  clear(void);                      // Remove all the datagrams
+    int   count(void) const;                // Number of datagrams
+    int   capacity(void) const;             // Number of slots
+    char* data(int i) const;                // Datagram
+    int   size(int i) const;                // Size of the datagram [bytes]
+    double timestamp(int i) const;          // Receive time of the datagram [ms] (0: Disabled)
+private:
+    char *buf;                              // Slots
+    int  *sizes;                            // Sizes of the datagrams
+    double *ticks;                          // Receive times of the datagrams
+    int  num, slot, used;                   // Number of slots / Size of a slot / Used slots
+    friend class UDPSocket;
+};
+
 // UDP Class
 class UDPSocket {
 public:
     UDPSocket();                            // Constructor
     ~UDPSocket();                           // Destructor
-    int  open(const char *addr, int port);  // Initialize
+    int  open(const char *addr, int port, int local = -1);  // Initialize (Local port, -1: Same as the remote, 0: Any)
     int  send2(void *data, int size);       // Send data
     int  sendf(char *str, ...);             // Send with format
     int  receive(void *data, int size);     // Receive data
+    int  receiveBatch(UDPBatch *batch);     // Receive queued datagrams
+    int  sendBatch(const UDPBatch *batch);  // Send all the datagrams
     void close(void);                       // Finalize
+    SOCKET getSocket(void);                 // Socket handle
+    int  getLocalPort(void);                // Bound port number
+    void setTimestamp(int enable);          // Stamp the received data or not
+    double getTimestamp(void);              // Receive time of the last data [ms] (0: Disabled)
 private:
     SOCKET sock;                            // Sockets
     sockaddr_in server_addr, client_addr;   // Server/Client IP adrress
+    int    timestamp;                       // Stamp the received data or not
+    double tick;                            // Receive time of the last data
+    int  fromServer(const sockaddr_in *addr);
 };
 
 // TCP Class
+// Received data is kept in a power-of-two ring buffer. peek(), readExact() and
+// readUntil() return pointers into it, valid until the next read.
 class TCPSocket {
 public:
-    TCPSocket();                            // Constructor
+    TCPSocket(int size = ARDRONE_TCP_BUFFER_SIZE);  // Constructor (Size of the ring buffer [bytes])
     ~TCPSocket();                           // Destructor
-    int  open(const char *addr, int port);  // Initialize
+    int  open(const char *addr, int port, int timeout = 0);  // Initialize (Connection timeout [ms], 0: System default)
     int  send2(void *data, int size);       // Send data
     int  sendf(char *str, ...);             // Send with format
-    int  receive(void *data, int size);     // Receive data
+    int  receive(void *data, int size);     // Receive data (Buffered data first)
+    int  wait(int timeout);                 // Wait for data [ms]
+    int  available(void);                   // Number of buffered bytes
+    const char* peek(int size, int timeout);                            // Next bytes without consuming them (Timeout [ms], -1: Infinite)
+    const char* readExact(int size, int timeout);                       // Exactly the size of bytes
+    const char* readUntil(const char *delim, int *size, int timeout);   // Bytes up to and including the delimiter
     void close(void);                       // Finalize
+    void setTimestamp(int enable);          // Stamp the received data or not
+    double getTimestamp(void);              // Receive time of the last data [ms] (0: Disabled)
 private:
     SOCKET sock;                            // Sockets
     sockaddr_in server_addr, client_addr;   // Server/Client IP adrress
+    int    timestamp;                       // Stamp the received data or not
+    double tick;                            // Receive time of the last data
+    char   *ring;                           // Ring buffer (The upper half mirrors the wrapped head)
+    unsigned int capacity, head, tail;      // Size of the ring / Read and write counters
+    int  poll(int timeout);
+    int  fill(double deadline);
+    const char* span(int size);
 };
 
 // Navdata
@@ -207,6 +286,593 @@ struct NAVDATA {
 };
 #pragma pack(pop)
 
+// Flight recorder file format (All values are little endian)
+//   [File header] [Chunk 0] [Chunk 1] ... [Chunk N-1]
+//   Each chunk has chunk_size bytes and starts with a chunk header,
+//   followed by records of [Record header] [Raw Navdata] [Padding to 8 bytes].
+//   A chunk is valid only if its magic and index match, and only "count" records
+//   within "used" bytes are committed, so a file of a crashed process can be read.
+#define FLIGHT_RECORDER_MAGIC       "ARDNAV01"      // Magic of the file header
+#define FLIGHT_RECORDER_CHUNK_MAGIC (0x4B4E4843)    // Magic of the chunk header ("CHNK")
+#define FLIGHT_RECORDER_CHUNK_SIZE  (65536)         // Default size of a chunk [bytes]
+#pragma pack(push, 1)
+struct FLIGHT_RECORDER_HEADER {
+    char           magic[8];        // FLIGHT_RECORDER_MAGIC
+    unsigned int   version;         // Format version (1)
+    unsigned int   chunk_size;      // Size of a chunk including its header [bytes]
+    unsigned int   num_chunks;      // Number of chunks in this file
+    unsigned int   closed;          // (1) Closed normally, (0) Recording or crashed
+    FILETIME       start_time;      // Wall clock at the start (UTC)
+    double         start_tick;      // ardGetTickCount() at the start [ms]
+    unsigned char  reserved[24];
+};
+struct FLIGHT_RECORDER_CHUNK {
+    unsigned int   magic;           // FLIGHT_RECORDER_CHUNK_MAGIC
+    unsigned int   index;           // Chunk number
+    unsigned int   used;            // Committed bytes after this header
+    unsigned int   count;           // Committed records
+    double         first_tick;      // Timestamp of the first record [ms]
+    double         last_tick;       // Timestamp of the last record [ms]
+};
+struct FLIGHT_RECORDER_RECORD {
+    unsigned int   size;            // Size of the raw Navdata [bytes]
+    unsigned int   reserved;
+    double         tick;            // Timestamp [ms] (ardGetTickCount)
+};
+#pragma pack(pop)
+
+// Flight recorder
+// Appends raw Navdata to a preallocated memory-mapped file.
+// write() is a memcpy only; a background thread flushes dirty pages and
+// touches the next chunk beforehand, so the caller never waits for the disk.
+class FlightRecorder {
+public:
+    FlightRecorder();                                               // Constructor
+    ~FlightRecorder();                                              // Destructor
+    int  open(const char *filename, int size_mb = 64);              // Create a file
+    int  write(const void *data, int size, double tick);            // Append a record (Single writer)
+    void close(void);                                               // Finalize
+    int  isOpen(void);                                              // Check recording or not
+    unsigned int getCount(void);                                    // Number of records
+    unsigned int getDropped(void);                                  // Number of dropped records
+private:
+    HANDLE hFile, hMapping;                                         // File and mapping
+    unsigned char *view;                                            // Mapped view
+    unsigned int chunk_size, num_chunks;                            // Layout
+    volatile LONG chunk;                                            // Current chunk
+    unsigned int count, dropped;                                    // Counters
+    int    flagFlush;                                               // Thread for flushing
+    HANDLE threadFlush;
+    HANDLE eventFlush;
+    UINT   loopFlush(void);
+    static UINT WINAPI runFlush(void *args) {
+        return reinterpret_cast<FlightRecorder*>(args)->loopFlush();
+    }
+};
+
+// Flight recorder reader
+class FlightRecorderReader {
+public:
+    FlightRecorderReader();                                         // Constructor
+    ~FlightRecorderReader();                                        // Destructor
+    int  open(const char *filename);                                // Open a file
+    int  read(const void **data, double *tick);                     // Get the next record (Zero-copy)
+    void rewind(void);                                              // Go back to the first record
+    void close(void);                                               // Finalize
+    FLIGHT_RECORDER_HEADER* getHeader(void);                        // File header
+private:
+    HANDLE hFile, hMapping;                                         // File and mapping
+    unsigned char *view;                                            // Mapped view
+    unsigned int file_size;                                         // Size of the file
+    unsigned int chunk, record, offset;                             // Read position
+};
+
+// Video recorder
+// Writes a video file on a background thread. write() copies the frame into a
+// preallocated queue and returns, so the caller never waits for the encoder or
+// the disk. When the queue is full, the oldest frame is dropped or write() waits
+// for a free slot depending on the policy.
+#define VIDEO_RECORDER_QUEUE        (30)            // Default number of frames of the queue
+#define VIDEO_RECORDER_DROP_OLDEST  (0)             // Drop the oldest frame when the queue is full
+#define VIDEO_RECORDER_BLOCK        (1)             // Wait for a free slot when the queue is full
+class VideoRecorder {
+public:
+    VideoRecorder();                                                // Constructor
+    ~VideoRecorder();                                               // Destructor
+    int  open(const char *filename, int fourcc, double fps, CvSize size, int queueSize = VIDEO_RECORDER_QUEUE, int policy = VIDEO_RECORDER_DROP_OLDEST);  // Create a file
+    int  write(const IplImage *image);                              // Queue a frame (Single writer)
+    void close(void);                                               // Write the queued frames and finalize
+    int  isOpen(void);                                              // Check recording or not
+    unsigned int getQueued(void);                                   // Number of queued frames
+    unsigned int getWritten(void);                                  // Number of written frames
+    unsigned int getDropped(void);                                  // Number of dropped frames
+    int  getPending(void);                                          // Number of frames in the queue
+private:
+    CvVideoWriter *writer;                                          // Video writer
+    IplImage **slots;                                               // Queue of frames
+    IplImage *spare, *current;                                      // Frames of write() and the thread
+    int    numSlots, head, count;                                   // Queue
+    int    policy;                                                  // When the queue is full
+    volatile LONG queued, written, dropped;                         // Counters
+    HANDLE mutexQueue;                                              // Lock of the queue
+    HANDLE eventFrame, eventSpace;                                  // Signaled when a frame is queued/taken
+    int    flagWrite;                                               // Thread for writing
+    HANDLE threadWrite;
+    UINT   loopWrite(void);
+    static UINT WINAPI runWrite(void *args) {
+        return reinterpret_cast<VideoRecorder*>(args)->loopWrite();
+    }
+};
+
+// Frame of FramePipeline
+// Frames come from the pool of the pipeline and go back to it when the last
+// reference is released. The images are allocated only when the size changes.
+#define PIPELINE_STAGES     (8)         // Maximum number of stages
+#define PIPELINE_THREADS    (16)        // Maximum number of threads of all the stages
+#define PIPELINE_FRAMES     (16)        // Number of frames of the pool
+#define PIPELINE_QUEUE_SIZE (4)         // Default number of frames between stages
+struct PIPELINE_FRAME {
+    volatile LONG refs;                 // References
+    unsigned int  number;               // Frame number (Stages with several threads may reorder the frames)
+    double        tick;                 // Time it entered the pipeline [ms]
+    IplImage      *image;               // Color image
+    IplImage      *gray;                // Grayscale image (Made by a stage)
+    void          *data[PIPELINE_STAGES];   // Results of the stages (Cleared when the frame is reused)
+};
+
+// Statistics of a stage of FramePipeline
+struct PIPELINE_STATS {
+    unsigned int frames;        // Processed frames
+    unsigned int dropped;       // Dropped frames (Source: No free frame, Last stage: Replaced in the output)
+    double       fps;           // Processed frames per second
+    double       busy;          // Average processing time [ms]
+    double       latency;       // Average time from entering the pipeline to leaving this stage [ms]
+    int          depth;         // Frames waiting in the input queue
+    int          maxDepth;      // Maximum of them
+};
+
+// Functions of FramePipeline
+typedef int (*PIPELINE_SOURCE)(void *arg, PIPELINE_FRAME *frame);  // Fill the frame (Return value: Made 1, None 0, End -1)
+typedef int (*PIPELINE_STAGE)(void *arg, PIPELINE_FRAME *frame);   // Process the frame (Return value: Pass 1, Drop 0)
+
+// Queue of frames
+// Bounded multi-producer / multi-consumer queue without locks (Each entry has its own turn counter).
+// Semaphores count the frames and the free entries, so a thread sleeps only when
+// it has to wait, and a full queue holds back the stage before it.
+class FrameQueue {
+public:
+    FrameQueue(int size = PIPELINE_QUEUE_SIZE);                     // Constructor (Rounded up to a power of 2)
+    ~FrameQueue();                                                  // Destructor
+    int  push(PIPELINE_FRAME *frame, DWORD timeout = INFINITE);     // Add a frame (Return value: SUCCESS 1, Timeout or closed 0)
+    PIPELINE_FRAME* pop(DWORD timeout = INFINITE);                  // Remove the oldest frame (NULL: Timeout or closed)
+    int  size(void);                                                // Number of the frames
+    void close(void);                                               // Wake up all the waiting threads
+private:
+    struct ENTRY {
+        volatile LONG  sequence;                                    // Turn of the entry
+        PIPELINE_FRAME *frame;                                      // Frame
+    };
+    ENTRY         *entries;                                         // Ring buffer
+    int           capacity;                                         // Number of the entries
+    volatile LONG head, tail;                                       // Next positions to pop/push
+    volatile LONG count;                                            // Number of the frames
+    HANDLE        items, spaces;                                    // Semaphores of the frames / free entries
+    int           closed;                                           // Closed or not
+};
+
+// Frame pipeline
+// Connects a source and stages (e.g. decode, convert, detect, track and annotate)
+// with FrameQueues. Each stage runs on its own threads, so consecutive frames are
+// processed at the same time and the throughput is that of the slowest stage
+// instead of the sum of all. A slow stage holds back the ones before it, and the
+// output keeps the latest frames, so the caller of pop() never stalls the stages.
+class FramePipeline {
+public:
+    FramePipeline();                                                // Constructor
+    ~FramePipeline();                                               // Destructor
+    int  setSource(PIPELINE_SOURCE func, void *arg);                // Thread making the frames (Before start())
+    int  addStage(PIPELINE_STAGE func, void *arg, int threads = 1, const char *name = NULL, int queueSize = PIPELINE_QUEUE_SIZE);  // Add a stage (Return value: Index, -1: Failed)
+    int  start(void);                                               // Start the threads
+    void stop(void);                                                // Stop the threads (Release the frames before this)
+    int  push(const IplImage *image, DWORD timeout = INFINITE);     // Feed an image without a source (Single caller, Return value: SUCCESS 1, Dropped 0)
+    PIPELINE_FRAME* pop(DWORD timeout = INFINITE);                  // Frame which passed all the stages (Release it)
+    void release(PIPELINE_FRAME *frame);                            // Release a frame
+    static void addRef(PIPELINE_FRAME *frame);                      // Keep a frame (Release it later)
+    static IplImage* prepare(IplImage **image, CvSize size, int channels);  // Allocate an image of a frame if the size differs
+    int  getStages(void);                                           // Number of the stages
+    const char* getName(int stage);                                 // Name of a stage
+    int  getStats(int stage, PIPELINE_STATS *stats);                // Statistics of a stage (-1: Source)
+    void resetStats(void);                                          // Clear the statistics
+private:
+    struct STAGE {
+        PIPELINE_STAGE func;                                        // Function
+        void           *arg;                                        // Argument
+        char           name[32];                                    // Name
+        int            threads;                                     // Number of the threads
+        int            queueSize;                                   // Size of the input queue
+        volatile LONG  maxDepth;                                    // Maximum of the input queue
+    };
+    struct WORKER {
+        FramePipeline *pipeline;                                    // Owner
+        int           stage;                                        // Stage (-1: Source)
+        HANDLE        thread;                                       // Thread
+        unsigned int  frames, dropped;                              // Counters
+        double        busy, latency;                                // Total times [ms]
+    };
+    PIPELINE_FRAME  frames[PIPELINE_FRAMES];                        // Pool of the frames
+    FrameQueue      *pool;                                          // Free frames
+    FrameQueue      *queues[PIPELINE_STAGES + 1];                   // Inputs of the stages and the output
+    STAGE           stages[PIPELINE_STAGES];                        // Stages
+    int             numStages;                                      // Number of the stages
+    PIPELINE_SOURCE source;                                         // Source (NULL: push())
+    void            *sourceArg;                                     // Argument of the source
+    WORKER          workers[PIPELINE_THREADS + 1];                  // Threads of the stages (The last one is of the source)
+    int             numWorkers;                                     // Number of the threads
+    volatile LONG   number;                                         // Next frame number
+    int             flag;                                           // Thread loop
+    double          start_tick;                                     // Time the statistics started [ms]
+    PIPELINE_FRAME* acquire(DWORD timeout);
+    void   forward(WORKER *worker, int stage, PIPELINE_FRAME *frame);
+    UINT   loop(WORKER *worker);
+    static UINT WINAPI run(void *args) {
+        WORKER *worker = reinterpret_cast<WORKER*>(args);
+        return worker->pipeline->loop(worker);
+    }
+};
+
+// State estimate of the EKF
+// State vector is [x, y, z, vx, vy, vz, roll, pitch, yaw].
+// Position and velocity are in the world frame whose origin is the first Navdata
+// and whose X-axis is the yaw of 0.0 [rad] (See "Coodinate system" above).
+#define EKF_STATE_SIZE (9)
+struct STATE_ESTIMATE {
+    double tick;                                    // Timestamp of the last Navdata [ms]
+    double x, y, z;                                 // Position [m]
+    double vx, vy, vz;                              // Velocity [m/s]
+    double roll, pitch, yaw;                        // Attitude [rad]
+    double cov[EKF_STATE_SIZE][EKF_STATE_SIZE];     // Covariance
+};
+
+// Extended Kalman filter for Navdata
+// Fuses attitude, horizontal velocity (body frame) and sonar altitude.
+// Uses fixed-size matrices only, so it allocates nothing after construction.
+class NavdataEKF {
+public:
+    NavdataEKF();                                                   // Constructor
+    void reset(void);                                               // Initialize the state
+    void update(const NAVDATA *navdata, double tick);               // Predict and correct with Navdata
+    void getEstimate(STATE_ESTIMATE *estimate);                     // Current estimate
+private:
+    double X[EKF_STATE_SIZE];                                       // State
+    double P[EKF_STATE_SIZE][EKF_STATE_SIZE];                       // Covariance
+    double last_tick;                                               // Time of the last update [ms]
+    int    initialized;                                             // Received the first Navdata or not
+    void predict(double dt);                                        // Prediction step
+    void correct(const double *H, double innovation, double r);     // Scalar measurement update
+};
+
+// Optical flow tracker
+// Tracks feature points from frame to frame with pyramidal Lucas-Kanade.
+// The points are carried forward, and features are detected again only in the
+// empty cells of a grid when too few are left. The pyramid of a frame is reused
+// as the previous one of the next frame, and all the buffers are allocated when
+// the image size changes, so nothing is allocated for each frame.
+#define FLOW_MAX_POINTS     (100)       // Default maximum number of points
+#define FLOW_GRID_X         (8)         // Default number of columns of the grid
+#define FLOW_GRID_Y         (6)         // Default number of rows of the grid
+#define FLOW_WINDOW_SIZE    (10)        // Half size of the search window [px]
+#define FLOW_PYRAMID_LEVEL  (3)         // Maximum pyramid level
+class OpticalFlowTracker {
+public:
+    OpticalFlowTracker(int maxPoints = FLOW_MAX_POINTS, int gridX = FLOW_GRID_X, int gridY = FLOW_GRID_Y);   // Constructor
+    ~OpticalFlowTracker();                                          // Destructor
+    int  update(const IplImage *image);                             // Track on a new frame (BGR or gray, Return value: Number of the points)
+    int  getPoints(const CvPoint2D32f **prev, const CvPoint2D32f **curr);  // Points in the previous/current frame (Return value: Number of the points)
+    int  getTracked(void);                                          // Number of the points tracked from the previous frame
+    void draw(IplImage *image);                                     // Draw the flows
+    void reset(void);                                               // Forget the points
+private:
+    int    maxPoints, gridX, gridY;                                 // Settings
+    int    count, tracked;                                          // Number of the points / tracked ones
+    int    pyramidReady;                                            // prevPyramid holds the pyramid of prevGray or not
+    IplImage *gray, *prevGray;                                      // Grayscale frames
+    IplImage *pyramid, *prevPyramid;                                // Pyramids of them
+    IplImage *eig, *tmp, *mask;                                     // Buffers of the detector
+    CvPoint2D32f *prevPoints, *currPoints, *nextPoints;             // Points
+    char   *status;                                                 // Tracked or not
+    int    allocate(CvSize size);
+    void   release(void);
+    void   detect(void);
+};
+
+// Color blob
+struct COLOR_BLOB {
+    int          found;                     // Found or not
+    double       area;                      // Number of the pixels
+    CvPoint2D32f center;                    // Centroid [px]
+    double       angle;                     // Orientation of the major axis [rad]
+    CvRect       rect;                      // Bounding box
+};
+
+// Color blob tracker
+// Finds the largest blob of an HSV color range. The color test of each pixel is a
+// single lookup in a table of the quantized BGR cube, so BGR to HSV and the range
+// test are one pass into the mask. The runs of each row are labeled with the ones
+// of the previous row while the mask is written, and the moments are accumulated
+// per run, so no other pass is needed. The next search is limited to the area
+// predicted from the last two detections, and nothing is allocated for each frame.
+#define BLOB_LUT_BITS       (6)         // Bits of each channel of the color table
+#define BLOB_MIN_AREA       (50)        // Default minimum area [px]
+#define BLOB_MAX_LABELS     (4096)      // Maximum number of labels in a frame
+#define BLOB_ROI_MARGIN     (16)        // Margin of the search area [px]
+class ColorBlobTracker {
+public:
+    ColorBlobTracker(int minArea = BLOB_MIN_AREA);                  // Constructor
+    ~ColorBlobTracker();                                            // Destructor
+    void setRange(CvScalar lower, CvScalar upper);                  // HSV range (H: 0-180, lower > upper wraps around)
+    int  update(const IplImage *image);                             // Find on a new BGR frame (Return value: Found 1, Not 0)
+    int  getBlob(COLOR_BLOB *blob);                                 // Result of the last update() (Return value: Found 1, Not 0)
+    CvRect getSearchArea(void);                                     // Area searched by the last update()
+    IplImage* getMask(void);                                        // Mask of the color (Zero outside of the search area)
+    void draw(IplImage *image);                                     // Draw the blob and the search area
+    void reset(void);                                               // Search the whole image next time
+private:
+    struct BLOB_RUN {
+        int x0, x1;                                                 // Pixels in a row
+        int label;                                                  // Label (-1: Ignored)
+    };
+    struct BLOB_MOMENTS {
+        double m00, m10, m01, m20, m11, m02;                        // Spatial moments
+        int    left, top, right, bottom;                            // Bounding box
+    };
+    int           minArea;                                          // Settings
+    unsigned char *lut;                                             // In the range or not for each color
+    IplImage      *mask;                                            // Mask of the color
+    BLOB_RUN      *prevRuns, *currRuns;                             // Runs of the previous/current rows
+    int           numPrev, numCurr;                                 // Number of them
+    int           firstPrev;                                        // First run of the previous row touching the current run
+    int           *parent;                                          // Union-find of the labels
+    BLOB_MOMENTS  *moments;                                         // Moments of each label
+    int           numLabels;                                        // Number of the labels
+    COLOR_BLOB    blob;                                             // Last result
+    CvPoint2D32f  velocity;                                         // Motion of the centroid [px/frame]
+    CvRect        roi, nextRoi;                                     // Search areas of the last/next update()
+    int    allocate(CvSize size);
+    void   release(void);
+    void   addRun(int x0, int x1, int y);
+    int    findLabel(int label);
+    void   predict(CvSize size);
+};
+
+// AT command queue
+// Bounded multi-producer / single-consumer queue without locks (Each entry has its own turn counter).
+// Any thread can push, but only the command thread pops. The sequence numbers are assigned
+// when the commands are popped, so they are unique and in the order of the datagrams.
+#define ATCMD_QUEUE_SIZE    (128)       // Number of entries (Must be a power of 2)
+#define ATCMD_ENTRY_SIZE    (256)       // Maximum size of an entry [bytes]
+#define ATCMD_SEQ_MARKER    ('\x01')    // Placeholder replaced with the sequence number
+#define ATCMD_DATAGRAM_SIZE (1024)      // Maximum size of a datagram of AT commands [bytes]
+struct ATCMD_ENTRY {
+    volatile LONG sequence;             // Turn of the entry
+    int  size;                          // Size of the commands
+    char data[ATCMD_ENTRY_SIZE];        // Commands (An entry may hold several commands)
+};
+class ATCommandQueue {
+public:
+    ATCommandQueue();                                   // Constructor
+    int push(const char *data, int size);               // Add commands (Any thread)
+    int pop(char *data, int size);                      // Remove commands (Command thread only)
+private:
+    ATCMD_ENTRY   entries[ATCMD_QUEUE_SIZE];            // Ring buffer
+    volatile LONG tail;                                 // Next position to push
+    LONG          head;                                 // Next position to pop
+};
+
+// AT command IDs
+enum ATCMD_ID {
+    ATCMD_REF = 0,          // Take off / Landing / Emergency
+    ATCMD_PCMD,             // Move
+    ATCMD_FTRIM,            // Flat trim
+    ATCMD_CONFIG,           // Configuration
+    ATCMD_CONFIG_IDS,       // Configuration IDs
+    ATCMD_COMWDG,           // Reset Watch-Dog
+    ATCMD_LED,              // LED animation
+    ATCMD_ANIM,             // Flight animation
+    ATCMD_CTRL,             // Control mode
+    ATCMD_PMODE,            // Undocumented
+    ATCMD_MISC,             // Undocumented
+    ATCMD_NUM
+};
+
+// AT command encoder
+// Writes AT commands into a caller-provided buffer without printf() or the heap.
+// ATCMD_SEQ_MARKER is written in place of the sequence number.
+// ex) ATEncoder(buf, sizeof(buf)).command(ATCMD_REF).arg(290718208).end()
+class ATEncoder {
+public:
+    ATEncoder(char *buf, int size);                                 // Constructor
+    ATEncoder& command(int id);                                     // "AT*XXX=<seq>"
+    ATEncoder& arg(int value);                                      // ",123"
+    ATEncoder& arg(float value);                                    // ",<IEEE 754 bits as int>"
+    ATEncoder& arg(const char *str);                                // ",\"str\""
+    ATEncoder& raw(const char *str);                                // As it is
+    ATEncoder& end(void);                                           // "\r"
+    const char* data(void) const;                                   // Encoded commands
+    int  size(void) const;                                          // Size of the commands (0: Overflowed)
+    int  urgent(void) const;                                        // Contains urgent commands or not
+    static int formatInt(char *dst, int value);                     // Decimal without printf() (Max. 11 chars)
+    static int expand(char *dst, int size, const char *src, int n, int *seq);  // Insert the sequence numbers
+private:
+    char *buf;                                                      // Output buffer
+    int  capacity, length;                                          // Size of the buffer / commands
+    int  overflow, flag;                                            // Overflowed / Urgent
+    void put(const char *str, int n);                               // Append bytes
+    int  checkString(const char *str, int quote);                   // No ATCMD_SEQ_MARKER nor other control characters (Quotes too)
+};
+
+// Cache of the AR.Drone's configuration
+// Parses "key = value" lines from the config port as they arrive,
+// so a line may be split across any number of receive() calls.
+class ConfigCache {
+public:
+    ConfigCache();                                                  // Constructor
+    void clear(void);                                               // Remove all the keys
+    int  parse(const char *data, int size);                         // Feed received bytes (Returns number of changed keys)
+    int  parseLine(const char *data, int size);                     // Parse a complete line (Returns 1 when changed)
+    int  set(const char *key, const char *value);                   // Update a key (Returns 1 when changed)
+    int  get(const char *key, char *value, int size);               // Obtaining a value
+    int  size(void);                                                // Number of keys
+private:
+    std::map<std::string, std::string> table;                       // Key/value table
+    std::string line;                                               // Incomplete line
+};
+
+// Configuration to apply
+// Items up to a barrier are sent together and acknowledged at once.
+// Keys which others depend on (e.g. custom:session_id) should be barriers.
+struct CONFIG_ITEM {
+    const char *key;        // Key
+    const char *value;      // Value
+    int        barrier;     // Wait for the acknowledgement before the next items
+    int        timeout;     // Timeout of the acknowledgement [ms] (0: ARDRONE_CONFIG_TIMEOUT)
+};
+
+// Task of WorkerPool
+typedef void (*WORKER_TASK)(void *arg);
+
+// Worker pool
+// Runs tasks on a fixed set of threads. The shared one is created on first use
+// and used by ARDrone::openAsync() of all the drones, whose stages block for
+// seconds. The video of AR.Drone 1.0 is decoded on the decode pool instead,
+// so opening a drone never delays the frames of the others.
+// Tasks of the decode pool must not block.
+class WorkerPool {
+public:
+    WorkerPool(int num = ARDRONE_WORKER_THREADS);                   // Constructor
+    ~WorkerPool();                                                  // Destructor
+    int submit(WORKER_TASK func, void *arg);                        // Queue a task
+    static WorkerPool* shared(void);                                // Pool shared by all the drones
+    static WorkerPool* decoder(void);                               // Pool decoding the video of all the drones
+private:
+    struct TASK {
+        WORKER_TASK func;                                           // Function
+        void        *arg;                                           // Argument
+    };
+    std::deque<TASK> tasks;                                         // Waiting tasks
+    HANDLE mutex, semaphore;                                        // Lock of the queue / Number of the tasks
+    HANDLE threads[ARDRONE_WORKER_THREADS];                         // Threads
+    int    num;                                                     // Number of the threads
+    int    flag;                                                    // Thread loop
+    UINT   loop(void);
+    static UINT WINAPI run(void *args) {
+        return reinterpret_cast<WorkerPool*>(args)->loop();
+    }
+};
+
+// Handler of Reactor (readable is 1 when data arrived, 0 when the interval elapsed)
+typedef void (*REACTOR_HANDLER)(void *arg, int readable);
+
+// I/O reactor
+// One thread waits for all the registered sockets with select() and calls the
+// handlers on it. The shared one services the Navdata and video sockets of all
+// the drones, so a slow handler delays all of them. Handlers must not block,
+// nor call add() or remove(). They run without the lock of the entries, so
+// add() and remove() of the other sockets do not wait for them.
+class Reactor {
+public:
+    Reactor();                                                      // Constructor
+    ~Reactor();                                                     // Destructor
+    int  add(SOCKET sock, REACTOR_HANDLER func, void *arg, int interval = 0);   // Register a socket (Interval of the timer [ms], 0: No timer)
+    void remove(SOCKET sock);                                       // Unregister (The handler is not running when this returns)
+    double getWakeTime(void);                                       // Time select() returned [ms] (Call in the handlers)
+    static Reactor* shared(void);                                   // Reactor shared by all the drones
+private:
+    struct ENTRY {
+        SOCKET          sock;                                       // Socket
+        REACTOR_HANDLER func;                                       // Handler
+        void            *arg;                                       // Argument
+        int             interval;                                   // Interval of the timer [ms]
+        double          next;                                       // Next time of the timer [ms]
+    };
+    ENTRY  entries[ARDRONE_REACTOR_SOCKETS];                        // Registered sockets
+    int    num;                                                     // Number of the sockets
+    SOCKET wakeup;                                                  // Loopback socket to interrupt select()
+    sockaddr_in wakeup_addr;                                        // Address of the loopback socket
+    HANDLE thread, mutex;                                           // Thread / Lock of the entries
+    DWORD  threadId;                                                // ID of the thread
+    volatile SOCKET running;                                        // Socket of the running handler
+    struct FIRED {
+        SOCKET sock;                                                // Socket
+        int    readable, expired;                                   // Data arrived / Interval elapsed
+    } fired[ARDRONE_REACTOR_SOCKETS];                               // Handlers to call in this pass
+    int    flag;                                                    // Thread loop
+    int    wsa;                                                     // WSAStartup() of the reactor succeeded
+    double wake;                                                    // Time select() returned [ms]
+    int    openWakeup(void);                                        // Create the loopback socket
+    int    purge(void);                                             // Drop the sockets closed before remove()
+    void   notify(void);
+    UINT   loop(void);
+    static UINT WINAPI run(void *args) {
+        return reinterpret_cast<Reactor*>(args)->loop();
+    }
+};
+
+// Forward declaration
+class ARDrone;
+class ARDroneFleet;
+
+// Navdata callback
+// This is called on the reactor thread shared by all the drones, so it should return within ARDRONE_CALLBACK_BUDGET.
+// Do not call Sleep(), printf() or any other blocking functions in it.
+typedef void (*ARDRONE_NAVDATA_CALLBACK)(ARDrone *ardrone, const NAVDATA *navdata, void *arg);
+
+// Navdata predicate for threshold callbacks
+// Return value TRUE: 1  FALSE: 0
+typedef int (*ARDRONE_NAVDATA_PREDICATE)(const NAVDATA *navdata, void *arg);
+
+// Statistics of a Navdata callback
+struct CALLBACK_STATS {
+    unsigned int calls;     // Number of calls
+    unsigned int overruns;  // Number of calls exceeding ARDRONE_CALLBACK_BUDGET
+    double       total;     // Total execution time [ms]
+    double       max;       // Maximum execution time [ms]
+};
+
+// Types of Navdata callbacks
+enum ARDRONE_CALLBACK_TYPE {
+    ARDRONE_CALLBACK_UNUSED = 0,    // Empty slot
+    ARDRONE_CALLBACK_EVERY,         // Every packet
+    ARDRONE_CALLBACK_STATE,         // State transition
+    ARDRONE_CALLBACK_THRESHOLD      // Threshold
+};
+
+// Navdata callback entry
+struct NAVDATA_CALLBACK {
+    int                       type;     // ARDRONE_CALLBACK_XXX
+    unsigned int              mask;     // State mask to watch
+    int                       state;    // Last result of the predicate
+    ARDRONE_NAVDATA_PREDICATE pred;     // Predicate
+    ARDRONE_NAVDATA_CALLBACK  func;     // Callback function
+    void                      *arg;     // User argument
+    CALLBACK_STATS            stats;    // Timing counters
+};
+
+// Stages of ARDrone::openAsync()
+// VERSION, COMMAND and NAVDATA run in parallel, then VIDEO and CONFIG.
+enum ARDRONE_OPEN_STAGE {
+    ARDRONE_OPEN_VERSION = 0,   // Version information
+    ARDRONE_OPEN_COMMAND,       // AT command
+    ARDRONE_OPEN_NAVDATA,       // Navdata
+    ARDRONE_OPEN_VIDEO,         // Video
+    ARDRONE_OPEN_CONFIG,        // Configuration
+    ARDRONE_OPEN_STAGES
+};
+
+// Progress callback of ARDrone::openAsync()
+// This is called on a worker thread when each stage finishes.
+// result is 1 for success and 0 for failure.
+typedef void (*ARDRONE_OPEN_CALLBACK)(ARDrone *ardrone, int stage, int result, void *arg);
+
 // Version information
 struct VERSION_INFO {
     int major;
@@ -215,6 +881,41 @@ struct VERSION_INFO {
     int build;
 };
 
+// Lookup tables of the undistortion
+// Made from the camera parameters when the image size is known. A color image
+// is remapped with the fixed-point tables, and a YUV 4:2:0 frame is remapped
+// while it is converted to BGR, sampling the planes through the pixel table.
+#define UNDISTORT_FRAC_BITS (7)             // Bits of the bilinear weights
+struct UNDISTORT_PIXEL {
+    short         x, y;                     // Top-left source pixel (x < 0: Outside of the image)
+    unsigned char fx, fy;                   // Bilinear weights (0 - (1 << UNDISTORT_FRAC_BITS) - 1)
+};
+struct UNDISTORT_LUT {
+    int             width, height;          // Image size
+    CvMat           *map1, *map2;           // Fixed-point tables for cvRemap() (CV_16SC2, CV_16UC1)
+    UNDISTORT_PIXEL *pixels;                // Source of each pixel
+    int             tableY[256];            // YUV to BGR (ITU-R BT.601, 8 bits fixed-point)
+    int             tableRV[256], tableGU[256], tableGV[256], tableBU[256];
+};
+
+// Port numbers of an AR.Drone (A simulator may listen on others)
+struct ARDRONE_PORTS {
+    int version;        // FTP for version.txt
+    int navdata;        // Navdata
+    int video;          // Video
+    int command;        // AT command
+    int config;         // Configuration
+};
+
+// Timestamps of received data (All by ardGetTickCount() [ms])
+// The differences separate waiting in the queues from processing.
+struct RECEIVE_TIMESTAMP {
+    double arrival;     // The socket became readable (select() returned)
+    double receive;     // The data was read from the socket
+    double ready;       // Decoded and visible to getNavdata/getImage
+    int    frame;       // Frame number of the PaVE header (-1: Unknown, AR.Drone 1.0 and Navdata)
+};
+
 // AR.Drone class
 class ARDrone {
 public:
@@ -224,6 +925,13 @@ public:
 
     // Initialize
     int open(const char *ardrone_addr = ARDRONE_DEFAULT_ADDR);
+    void setPorts(const ARDRONE_PORTS *ports);  // Remote port numbers used by open() (NULL: Default)
+    void setLocalPorts(const ARDRONE_PORTS *ports); // Local UDP port numbers (NULL: Default, 0: Any free port)
+
+    // Initialize in background (The stages run on the shared worker pool)
+    int openAsync(const char *ardrone_addr = ARDRONE_DEFAULT_ADDR, ARDRONE_OPEN_CALLBACK func = NULL, void *arg = NULL);
+    int waitOpen(DWORD timeout = INFINITE);     // SUCCESS: 1  FAILED: 0  RUNNING: -1
+    int getOpenProgress(void);                  // Bits of the finished stages (1 << ARDRONE_OPEN_XXX)
 
     // Update (Call this function in each loop)
     int update(void);
@@ -233,9 +941,15 @@ public:
 
     // Get an image for OpenCV
     IplImage* getImage(void);
+    int getImageTimestamp(RECEIVE_TIMESTAMP *timestamp);    // Timestamps of the latest image
+
+    // Lens correction of the images (camera.xml made by main_calib.cpp)
+    int setUndistortion(const char *filename);                              // Load the camera parameters (NULL: Disable)
+    int setUndistortion(const CvMat *intrinsic, const CvMat *distortion);   // Set the camera parameters (NULL: Disable)
 
     // Get AR.Drone's firmware version
     int getVersion(void);
+    static void setVersionLifetime(double lifetime);    // Lifetime of the cache for each IP address [ms] (0: Disabled)
 
     // Get sensor values
     double getRoll(void);       // Roll angle  [rad]
@@ -247,6 +961,9 @@ public:
     // Get battery percentage [%]
     int getBatteryPercentage(void);
 
+    // Timestamps of the latest Navdata
+    int getNavdataTimestamp(RECEIVE_TIMESTAMP *timestamp);
+
     // Take off / Landing / Emergency
     void takeoff(void);
     void landing(void);
@@ -265,14 +982,55 @@ public:
 	void flatTrim(void);							// Flatten Trim
 	void hover(void);								// Hover
     void resetWatchDog(void);                       // Reset hovering
+    void setCommandRate(double rate);               // Rate of AT*PCMD [Hz] (Default: ARDRONE_COMMAND_RATE)
+    void setCommandTimeout(double timeout);         // Hover when move3D() is not called for this [ms] (Default: ARDRONE_COMMAND_TIMEOUT)
     //void startRecord(void);                       // Video recording for AR.Drone 2.0
     //void stopRecord(void);                        // You should set a USB key with > 100MB to your drone
 
+    // State estimate by the EKF (Updated on the reactor thread)
+    int  getEstimate(STATE_ESTIMATE *estimate);
+    void resetEstimate(void);
+
+    // Flight recorder (Records every Navdata packet)
+    int  startRecorder(const char *filename, int size_mb = 64);
+    void stopRecorder(void);
+
+    // Configuration read back from the AR.Drone (Cached)
+    int refreshConfig(void);                                    // Read all the keys again
+    int getConfigString(const char *key, char *value, int size);
+    int getConfigInt(const char *key, int *value);
+    int getConfigDouble(const char *key, double *value);
+    int getConfigBool(const char *key, int *value);
+
+    // Navdata callbacks (Called on the reactor thread)
+    int  addNavdataCallback(ARDRONE_NAVDATA_CALLBACK func, void *arg = NULL);                                      // Every packet
+    int  addStateCallback(unsigned int mask, ARDRONE_NAVDATA_CALLBACK func, void *arg = NULL);                     // Transitions of state bits
+    int  addThresholdCallback(ARDRONE_NAVDATA_PREDICATE pred, ARDRONE_NAVDATA_CALLBACK func, void *arg = NULL);    // Predicate becomes true
+    void removeCallback(int id);                                                                                   // Unregister
+    int  getCallbackStats(int id, CALLBACK_STATS *stats);                                                          // Timing counters
+
 protected:
     // IP address
     char ip[16];
 
-    // Sequence number
+    // State of openAsync()
+    struct OPEN_TASK {
+        ARDrone *ardrone;                       // Drone to open
+        int     stage;                          // ARDRONE_OPEN_XXX
+    } openTasks[ARDRONE_OPEN_STAGES];
+    volatile LONG openPending;                  // Running stages
+    volatile LONG openResult;                   // 0 when a stage failed
+    volatile LONG openProgress;                 // Bits of the finished stages
+    HANDLE eventOpen;                           // Signaled when finished
+    ARDRONE_OPEN_CALLBACK openCallback;         // Progress callback
+    void  *openArg;                             // Argument of the callback
+    int   wsa;                                  // WSAStartup() of openAsync() succeeded
+    void  startOpenStage(int stage);
+    void  finishOpenStage(int stage, int result);
+    void  finalizeOpen(void);
+    static void runOpenStage(void *args);
+
+    // Sequence number (Only the command thread touches it)
     int seq;
 
     // Camera image
@@ -281,7 +1039,39 @@ protected:
     // Timer
     double timerWdg;
 
+    // Set point of AT*PCMD (Sent by the command thread)
+    int    pcmdMode;
+    float  pcmdValue[4];
+    double timePcmd;
+    double rateCommand;
+    double timeoutCommand;
+    void   clearSetPoint(void);
+
+    // Thread for AT command
+    int    flagCommand;
+    HANDLE threadCommand;
+    HANDLE mutexCommand;
+    UINT   loopCommand(void);
+    static UINT WINAPI runCommand(void *args) {
+        return reinterpret_cast<ARDrone*>(args)->loopCommand();
+    }
+
+    // AT command queue (Drained by the command thread)
+    ATCommandQueue queueCommand;
+    HANDLE eventCommand;
+    int  sendCommand(const ATEncoder &encoder, int urgent = 0);
+    int  sendConfig(const char *key, const char *value, int urgent = 0);
+    int  pushCommand(const char *data, int size, int urgent = 0);
+
+    // Datagram of AT commands (Gathered by the command thread)
+    char bufCommand[ATCMD_DATAGRAM_SIZE];
+    int  sizeCommand;
+    void drainCommands(void);
+    int  appendCommands(const char *data, int size);
+    int  flushCommands(void);
+
     // Sockets
+    ARDRONE_PORTS ports, local;
     UDPSocket sockNavdata;
     UDPSocket sockVideo;
     UDPSocket sockCommand;
@@ -293,14 +1083,37 @@ protected:
     // Navdata
     NAVDATA navdata;
 
-    // Thread for Navdata
+    // Navdata on the reactor
+    UDPBatch batchNavdata;
+    RECEIVE_TIMESTAMP timeNavdata;
     int    flagNavdata;
-    HANDLE threadNavdata;
     HANDLE mutexNavdata;
-    UINT   loopNavdata(void);
-    static UINT WINAPI runNavdata(void *args) {
-        return reinterpret_cast<ARDrone*>(args)->loopNavdata();
-    }
+    HANDLE eventNavdata;
+    static void onNavdata(void *arg, int readable);
+
+    // Wait for Navdata
+    int waitState(unsigned int mask, unsigned int value, double timeout);
+
+    // Configuration acknowledged by Navdata
+    int applyConfig(const CONFIG_ITEM *items, int num);
+    int ackConfig(double timeout);
+
+    // Configuration cache
+    ConfigCache config;
+    HANDLE mutexConfig;
+    int matchConfig(const char *key, const char *value);
+
+    // EKF
+    NavdataEKF ekf;
+
+    // Flight recorder
+    FlightRecorder *recorder;
+
+    // Navdata callbacks
+    NAVDATA_CALLBACK callbacks[ARDRONE_MAX_CALLBACKS];
+    HANDLE mutexCallback;
+    int  addCallback(ARDRONE_CALLBACK_TYPE type, unsigned int mask, ARDRONE_NAVDATA_PREDICATE pred, ARDRONE_NAVDATA_CALLBACK func, void *arg);
+    void invokeCallbacks(const NAVDATA *current, unsigned int prev_state);
 
     // Video
     AVFormatContext *pFormatCtx;
@@ -309,7 +1122,21 @@ protected:
     uint8_t         *bufferBGR;
     SwsContext      *pConvertCtx;
 
-    // Thread for video
+    // PaVE headers of AR.Drone 2.0 (FFmpeg reads the payloads without them)
+    struct VIDEO_FRAME {
+        int64_t pos;                            // Position of the payload in the stream given to FFmpeg
+        int     frame;                          // Frame number of the PaVE header
+    };
+    AVIOContext *pStream;                       // Video port (With PaVE headers)
+    AVIOContext *pPayload;                      // Stream given to FFmpeg (Without PaVE headers)
+    int64_t     posPayload;                     // Bytes given to FFmpeg
+    int         sizePayload;                    // Rest of the current payload [bytes] (-1: No PaVE)
+    VIDEO_FRAME framesPaVE[ARDRONE_VIDEO_FRAMES]; // Latest frame numbers and their positions
+    int         indexPaVE;                      // Next entry of framesPaVE
+    static int  readPayload(void *opaque, uint8_t *buf, int size);
+    int         findFrame(int64_t pos);
+
+    // Thread for video (AR.Drone 2.0, FFmpeg reads the stream by itself)
     int    flagVideo;
     HANDLE threadVideo;
     HANDLE mutexVideo;
@@ -318,7 +1145,45 @@ protected:
         return reinterpret_cast<ARDrone*>(args)->loopVideo();
     }
 
+    // Video on the reactor (AR.Drone 1.0, decoded on the decode pool)
+    uint8_t       *bufReceive, *bufDecode;      // Datagram being received / decoded
+    int           sizeDecode;                   // Size of the datagram being decoded
+    RECEIVE_TIMESTAMP timeDecode;               // Timestamps of the datagram being decoded
+    RECEIVE_TIMESTAMP timeVideo;                // Timestamps of the latest image
+    volatile LONG busyVideo;                    // Decoding or not
+    volatile LONG droppedVideo;                 // Datagrams/packets dropped before decoding
+    static void onVideo(void *arg, int readable);
+    static void decodeVideo(void *arg);
+
+    // Video decoded by ARDroneFleet (The video thread of 2.0 only reads packets)
+    friend class ARDroneFleet;
+    struct VIDEO_PACKET {
+        AVPacket packet;                        // H.264 packet
+        double   tick;                          // Time it was read [ms]
+        int      frame;                         // Frame number of the PaVE header (-1: Unknown)
+    };
+    ARDroneFleet *fleet;                        // Fleet decoding the video (NULL: None)
+    int           fleetIndex;                   // Index in the fleet
+    std::deque<VIDEO_PACKET> packets;           // Packets waiting for a decode thread
+    HANDLE        mutexPacket;                  // Lock of the packets
+    int           waitKey;                      // Drop packets until a key frame
+    int  readVideo(void);
+    int  decodePacket(AVPacket *packet, double tick, int frame);
+    int  decodeQueued(RECEIVE_TIMESTAMP *timestamp, int *more);
+    void clearPackets(void);
+
+    // Undistortion (Done while converting or copying the frame)
+    int           undistort;                    // Enabled or not
+    double        camIntrinsic[9];              // Camera matrix
+    double        camDistortion[5];             // Distortion coefficients (k1, k2, p1, p2, k3)
+    UNDISTORT_LUT *lutUndistort;                // Tables for the image size (NULL: Not made yet)
+    int           rectified;                    // bufferBGR is already undistorted or not
+    int  prepareUndistortion(int width, int height);
+    void releaseUndistortion(void);
+    void convertUndistorted(void);
+
     // Initialize
+    int openSocket(UDPSocket *sock, int port, int localPort);
     int initNavdata(void);
     int initVideo(void);
     int initCommand(void);
@@ -337,6 +1202,155 @@ protected:
     void finalizeConfig(void);
 };
 
+// Decode statistics of ARDroneFleet
+struct FLEET_STATS {
+    unsigned int frames;        // Decoded frames
+    unsigned int dropped;       // Datagrams/packets dropped before decoding
+    double       fps;           // Decoded frames per second
+    double       latency;       // Average time from receiving to ready [ms]
+    double       maxLatency;    // Maximum time from receiving to ready [ms]
+    double       wait;          // Average time waiting for a decode thread [ms]
+    double       decode;        // Average decoding time [ms]
+};
+
+// Fleet of drones
+// Decodes the video of all the drones on one pool of threads sized to the
+// machine, instead of a decoder for each drone. Each thread has its own queue
+// and steals from the others when it runs out. A drone has at most one frame
+// being decoded, higher priorities go first and the drones with the same
+// priority take turns. Add the drones before opening them, and close them
+// before removing them or destroying the fleet.
+class ARDroneFleet {
+public:
+    ARDroneFleet(int threads = 0);                                  // Constructor (0: Number of the processors)
+    ~ARDroneFleet();                                                // Destructor
+    int  add(ARDrone *ardrone, int priority = 0);                   // Add a drone (Return value: Index, -1: Failed)
+    void remove(ARDrone *ardrone);                                  // Remove a drone
+    int  setPriority(ARDrone *ardrone, int priority);               // Larger goes first (Default: 0)
+    int  size(void);                                                // Number of the drones
+    ARDrone* get(int index);                                        // Drone of the index (NULL: Unused)
+    int  getThreads(void);                                          // Number of the decode threads
+    int  getStats(ARDrone *ardrone, FLEET_STATS *stats);            // Statistics of a drone
+    int  getTotalStats(FLEET_STATS *stats);                         // Statistics of all the drones
+    void resetStats(void);                                          // Clear the statistics
+private:
+    friend class ARDrone;
+    struct SLOT {
+        ARDrone       *ardrone;                                     // Drone (NULL: Unused)
+        int           priority;                                     // Priority
+        int           home;                                         // Thread whose queue it goes to
+        volatile LONG active;                                       // Queued or decoding
+        volatile LONG pending;                                      // Scheduled while active
+        double        queued;                                       // Time it was queued [ms]
+        unsigned int  frames;                                       // Decoded frames
+        LONG          dropped;                                      // Dropped ones when the statistics started
+        double        latency, maxLatency, wait, decode;            // Total/maximum times [ms]
+    };
+    struct WORKER {
+        ARDroneFleet    *fleet;                                     // Owner
+        int             index;                                      // Index of the thread
+        std::deque<int> queue;                                      // Queued slots
+        HANDLE          mutex, thread;                              // Lock of the queue / Thread
+    };
+    SLOT   slots[ARDRONE_FLEET_DRONES];                             // Drones
+    WORKER workers[ARDRONE_FLEET_THREADS];                          // Decode threads
+    int    numWorkers;                                              // Number of the threads
+    HANDLE mutex, semaphore;                                        // Lock of the slots / Number of the queued slots
+    int    flag;                                                    // Thread loop
+    double start;                                                   // Time the statistics started [ms]
+    int    find(ARDrone *ardrone);
+    void   schedule(int index);
+    void   enqueue(int index);
+    void   wait(int index);
+    int    take(int worker);
+    void   sumStats(int index, double now, FLEET_STATS *stats);
+    UINT   loop(int worker);
+    static UINT WINAPI run(void *args) {
+        WORKER *worker = reinterpret_cast<WORKER*>(args);
+        return worker->fleet->loop(worker->index);
+    }
+};
+
+// Video fixtures of ARDroneSimulator (Made by ARDroneSimulator::capture())
+//   AR.Drone 1.0: [Size of the datagram (4 bytes, little endian)] [UVLC datagram] ...
+//   AR.Drone 2.0: The raw stream of the video port (PaVE headers and H.264)
+// PaVE frames are stamped with the simulator's frame number and time [ms].
+#define ARDRONE_SIMULATOR_PHYSICS   (5)             // Step of the flight model [ms]
+#define ARDRONE_SIMULATOR_WATCHDOG  (250)           // The drone hovers when no AT command comes for this [ms]
+#define ARDRONE_SIMULATOR_FTP_WAIT  (1000)          // RETR fails when no data connection comes for this [ms]
+
+// Simulator of an AR.Drone
+// Serves version.txt by FTP, Navdata at 15/200Hz, video from a fixture file,
+// AT commands with a simple flight model, and the configuration, all on one
+// thread. Replies go to the source address of the requests, so an ARDrone on
+// the same machine can use it with ARDrone::setPorts().
+class ARDroneSimulator {
+public:
+    ARDroneSimulator();                                             // Constructor
+    ~ARDroneSimulator();                                            // Destructor
+    int  open(int version = ARDRONE_VERSION_2, const char *fixture = NULL, const ARDRONE_PORTS *ports = NULL); // Start (NULL ports: Default + ARDRONE_SIMULATOR_PORT_OFFSET)
+    void close(void);                                               // Stop
+    void getPorts(ARDRONE_PORTS *ports);                            // Port numbers to pass to ARDrone::setPorts()
+    void getNavdata(NAVDATA *navdata);                              // Current simulated Navdata
+    unsigned int getFrameCount(void);                               // Number of sent video frames
+    double getFrameTime(unsigned int frame);                        // Time the frame was sent [ms] (0: Unknown)
+    unsigned int getCommandCount(void);                             // Number of received AT commands
+    static int capture(const char *addr, int version, const char *filename, double duration);   // Record a fixture from a real drone [ms]
+private:
+    // Settings
+    int           version;                                          // ARDRONE_VERSION_1 or 2
+    ARDRONE_PORTS ports;                                            // Listening ports
+    std::string   versionText;                                      // Content of version.txt
+
+    // Sockets
+    SOCKET      sockFtp, sockFtpClient, sockFtpData;                // FTP (Listening / Control / Passive listening)
+    SOCKET      sockNavdata, sockCommand;                           // UDP
+    SOCKET      sockVideo, sockVideoClient;                         // Video (UDP for 1.0, TCP for 2.0)
+    SOCKET      sockConfig, sockConfigClient;                       // Configuration
+    sockaddr_in addrNavdata, addrVideo;                             // Clients of the UDP streams
+    int         hasNavdata, hasVideo;                               // The client is known or not
+    std::string lineFtp;                                            // Incomplete FTP command
+    double      retrFtp;                                            // Deadline of RETR waiting for the data connection [ms] (0: None)
+
+    // Video fixture
+    std::string  fixture;                                           // Whole file
+    std::deque<std::pair<int, int> > frames;                        // Offset and size of each frame
+    unsigned int frameIndex, frameCount;                            // Next frame / Sent frames
+    double       frameTimes[256];                                   // Send times of the last frames
+
+    // Flight model
+    NAVDATA      navdata;                                           // Navdata to send
+    int          flying, takeoff, emergency;                        // Flight state
+    int          pcmdFlag;                                          // Progressive command
+    float        pcmd[4];                                           // Roll, pitch, gaz and yaw
+    double       roll, pitch, yaw, altitude, u, v, w;               // Attitude [rad], altitude [m] and velocity in the body frame [m/s]
+    double       battery;                                           // Battery [%]
+    double       lastCommand;                                       // Time of the last AT command [ms]
+    unsigned int commandCount;                                      // Received AT commands
+    std::map<std::string, std::string> config;                      // Configuration
+
+    // Thread
+    int    flag;
+    HANDLE thread, mutex;
+    UINT   loop(void);
+    static UINT WINAPI run(void *args) {
+        return reinterpret_cast<ARDroneSimulator*>(args)->loop();
+    }
+
+    // Services
+    void   serveFtp(void);
+    void   serveFtpCommand(const char *line);
+    void   serveFtpData(void);
+    void   serveCommand(void);
+    void   serveCommandLine(const char *line);
+    void   sendNavdata(void);
+    void   sendFrame(void);
+    void   sendConfig(void);
+    void   acceptVideo(void);
+    void   step(double dt);
+    int    loadFixture(const char *filename);
+};
+
 // --------------------------------------------------------------------------
 // double ardGetTickCount(void)
 // High-resolution timer.
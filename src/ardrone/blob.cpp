@@ -0,0 +1,409 @@
+#include "ardrone.h"
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::ColorBlobTracker(Minimum area)
+// Constructor of ColorBlobTracker class. This will be called when you create it.
+// --------------------------------------------------------------------------
+ColorBlobTracker::ColorBlobTracker(int minArea)
+{
+    // Settings
+    this->minArea = (minArea > 0) ? minArea : 1;
+
+    // Color table (Nothing is in the range until setRange())
+    lut = new unsigned char[1 << (BLOB_LUT_BITS * 3)];
+    memset(lut, 0, 1 << (BLOB_LUT_BITS * 3));
+
+    // Labels
+    parent    = new int[BLOB_MAX_LABELS];
+    moments   = new BLOB_MOMENTS[BLOB_MAX_LABELS];
+    numLabels = 0;
+
+    // Buffers (Allocated by the first frame)
+    mask     = NULL;
+    prevRuns = currRuns = NULL;
+    numPrev  = numCurr  = firstPrev = 0;
+
+    // Result
+    roi = nextRoi = cvRect(0, 0, 0, 0);
+    reset();
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::~ColorBlobTracker()
+// Destructor of ColorBlobTracker class. This will be called when you destroy it.
+// --------------------------------------------------------------------------
+ColorBlobTracker::~ColorBlobTracker()
+{
+    release();
+    delete [] lut;
+    delete [] parent;
+    delete [] moments;
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::setRange(Lower HSV, Upper HSV)
+// Set the color range in HSV of OpenCV (H: 0-180, S: 0-255, V: 0-255). Both ends
+// are included. When the lower hue is greater than the upper one, the range
+// wraps around (e.g. 170-10 for red). The table is made from the center of each
+// cell of the quantized BGR cube.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ColorBlobTracker::setRange(CvScalar lower, CvScalar upper)
+{
+    const int cells = 1 << BLOB_LUT_BITS;
+    const int shift = 8 - BLOB_LUT_BITS;
+
+    for (int b = 0; b < cells; b++) {
+        for (int g = 0; g < cells; g++) {
+            for (int r = 0; r < cells; r++) {
+                // Center of the cell
+                const int B = (b << shift) + (1 << shift) / 2;
+                const int G = (g << shift) + (1 << shift) / 2;
+                const int R = (r << shift) + (1 << shift) / 2;
+
+                // BGR to HSV (Same as CV_BGR2HSV)
+                const int vmax = MAX(MAX(B, G), R);
+                const int diff = vmax - MIN(MIN(B, G), R);
+                const double v = vmax;
+                const double s = (vmax > 0) ? 255.0 * diff / vmax : 0.0;
+                double h = 0.0;
+                if (diff > 0) {
+                    if      (vmax == R) h =         60.0 * (G - B) / diff;
+                    else if (vmax == G) h = 120.0 + 60.0 * (B - R) / diff;
+                    else                h = 240.0 + 60.0 * (R - G) / diff;
+                    if (h < 0.0) h += 360.0;
+                }
+                h *= 0.5;
+
+                // In the range or not
+                int in = (s >= lower.val[1] && s <= upper.val[1] && v >= lower.val[2] && v <= upper.val[2]);
+                if (lower.val[0] <= upper.val[0]) in = in && (h >= lower.val[0] && h <= upper.val[0]);
+                else                              in = in && (h >= lower.val[0] || h <= upper.val[0]);
+                lut[(b << (BLOB_LUT_BITS * 2)) | (g << BLOB_LUT_BITS) | r] = in ? 255 : 0;
+            }
+        }
+    }
+
+    // The last result is of the old color
+    reset();
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::update(Camera image)
+// Find the largest blob of the color on a new frame. The search is limited to
+// the area predicted from the last detection, and made on the whole image when
+// nothing was found.
+// Return value Found: 1  Not found: 0
+// --------------------------------------------------------------------------
+int ColorBlobTracker::update(const IplImage *image)
+{
+    if (!image || image->nChannels != 3 || image->depth != IPL_DEPTH_8U) return 0;
+
+    // Allocate the buffers for the size
+    CvSize size = cvGetSize(image);
+    if (!mask || mask->width != size.width || mask->height != size.height) {
+        if (!allocate(size)) return 0;
+        nextRoi = cvRect(0, 0, size.width, size.height);
+    }
+
+    // Clear the mask of the last search area
+    for (int y = roi.y; y < roi.y + roi.height; y++) {
+        memset(mask->imageData + y * mask->widthStep + roi.x, 0, roi.width);
+    }
+
+    // Search area
+    roi = nextRoi;
+    if (roi.width <= 0 || roi.height <= 0) roi = cvRect(0, 0, size.width, size.height);
+
+    // Labels
+    numLabels = 0;
+    numPrev   = 0;
+
+    // Color test, runs and moments in one pass
+    const int shift = 8 - BLOB_LUT_BITS;
+    for (int y = roi.y; y < roi.y + roi.height; y++) {
+        const unsigned char *src = (const unsigned char*)image->imageData + y * image->widthStep + roi.x * 3;
+        unsigned char *dst = (unsigned char*)mask->imageData + y * mask->widthStep;
+        int start = -1;
+        numCurr = 0;
+
+        for (int x = roi.x; x < roi.x + roi.width; x++, src += 3) {
+            const unsigned char in = lut[((src[0] >> shift) << (BLOB_LUT_BITS * 2)) | ((src[1] >> shift) << BLOB_LUT_BITS) | (src[2] >> shift)];
+            dst[x] = in;
+
+            // Start or end of a run
+            if (in) {
+                if (start < 0) start = x;
+            }
+            else if (start >= 0) {
+                addRun(start, x - 1, y);
+                start = -1;
+            }
+        }
+        if (start >= 0) addRun(start, roi.x + roi.width - 1, y);
+
+        // This row is the previous one of the next row
+        BLOB_RUN *swap = prevRuns;
+        prevRuns = currRuns;
+        currRuns = swap;
+        numPrev  = numCurr;
+    }
+
+    // Merge the moments of the connected labels and find the largest one
+    int best = -1;
+    for (int i = 0; i < numLabels; i++) {
+        const int root = findLabel(i);
+        if (root != i) {
+            BLOB_MOMENTS *dst = &moments[root];
+            const BLOB_MOMENTS *src = &moments[i];
+            dst->m00 += src->m00;
+            dst->m10 += src->m10;
+            dst->m01 += src->m01;
+            dst->m20 += src->m20;
+            dst->m11 += src->m11;
+            dst->m02 += src->m02;
+            dst->left   = MIN(dst->left,   src->left);
+            dst->top    = MIN(dst->top,    src->top);
+            dst->right  = MAX(dst->right,  src->right);
+            dst->bottom = MAX(dst->bottom, src->bottom);
+        }
+    }
+    for (int i = 0; i < numLabels; i++) {
+        if (parent[i] != i || moments[i].m00 < minArea) continue;
+        if (best < 0 || moments[i].m00 > moments[best].m00) best = i;
+    }
+
+    // Not found
+    if (best < 0) {
+        blob.found = 0;
+        velocity   = cvPoint2D32f(0.0, 0.0);
+        nextRoi    = cvRect(0, 0, size.width, size.height);
+        return 0;
+    }
+
+    // Centroid and orientation
+    const BLOB_MOMENTS *m = &moments[best];
+    const double cx = m->m10 / m->m00;
+    const double cy = m->m01 / m->m00;
+    const double mu20 = m->m20 / m->m00 - cx * cx;
+    const double mu02 = m->m02 / m->m00 - cy * cy;
+    const double mu11 = m->m11 / m->m00 - cx * cy;
+
+    // Motion from the last detection
+    if (blob.found) velocity = cvPoint2D32f(cx - blob.center.x, cy - blob.center.y);
+    else            velocity = cvPoint2D32f(0.0, 0.0);
+
+    // Result
+    blob.found  = 1;
+    blob.area   = m->m00;
+    blob.center = cvPoint2D32f(cx, cy);
+    blob.angle  = 0.5 * atan2(2.0 * mu11, mu20 - mu02);
+    blob.rect   = cvRect(m->left, m->top, m->right - m->left + 1, m->bottom - m->top + 1);
+
+    // Search area of the next frame
+    predict(size);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::getBlob(Blob)
+// Obtaining the result of the last update().
+// Return value Found: 1  Not found: 0
+// --------------------------------------------------------------------------
+int ColorBlobTracker::getBlob(COLOR_BLOB *blob)
+{
+    if (blob) *blob = this->blob;
+    return this->blob.found;
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::getSearchArea()
+// Obtaining the area searched by the last update().
+// Return value Rectangle
+// --------------------------------------------------------------------------
+CvRect ColorBlobTracker::getSearchArea(void)
+{
+    return roi;
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::getMask()
+// Obtaining the mask of the color. It is zero outside of the search area.
+// Return value IplImage (NULL before the first update())
+// --------------------------------------------------------------------------
+IplImage* ColorBlobTracker::getMask(void)
+{
+    return mask;
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::draw(Image)
+// Draw the blob and the search area of the last update().
+// Return value NONE
+// --------------------------------------------------------------------------
+void ColorBlobTracker::draw(IplImage *image)
+{
+    if (!image) return;
+
+    // Search area
+    cvRectangle(image, cvPoint(roi.x, roi.y), cvPoint(roi.x + roi.width - 1, roi.y + roi.height - 1), CV_RGB(0, 0, 255));
+
+    // Blob
+    if (blob.found) {
+        const CvPoint c = cvPointFrom32f(blob.center);
+        const double r = sqrt(blob.area / M_PI);
+        cvRectangle(image, cvPoint(blob.rect.x, blob.rect.y), cvPoint(blob.rect.x + blob.rect.width - 1, blob.rect.y + blob.rect.height - 1), CV_RGB(0, 255, 0));
+        cvLine(image, c, cvPoint(c.x + (int)(r * cos(blob.angle)), c.y + (int)(r * sin(blob.angle))), CV_RGB(255, 0, 0), 2);
+        cvCircle(image, c, 3, CV_RGB(255, 0, 0), CV_FILLED);
+    }
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::reset()
+// Forget the blob. The whole image is searched on the next frame.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ColorBlobTracker::reset(void)
+{
+    memset(&blob, 0, sizeof(blob));
+    velocity = cvPoint2D32f(0.0, 0.0);
+    if (mask) nextRoi = cvRect(0, 0, mask->width, mask->height);
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::allocate(Image size)
+// Allocate the buffers for the image size.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ColorBlobTracker::allocate(CvSize size)
+{
+    // Release the old ones
+    release();
+
+    // Mask
+    mask = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    if (!mask) {
+        printf("ERROR: cvCreateImage() failed. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+    cvSetZero(mask);
+
+    // Runs (A row has (width + 1) / 2 at most)
+    prevRuns = new BLOB_RUN[size.width / 2 + 1];
+    currRuns = new BLOB_RUN[size.width / 2 + 1];
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::release()
+// Release the buffers.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ColorBlobTracker::release(void)
+{
+    // Mask
+    if (mask) cvReleaseImage(&mask);
+
+    // Runs
+    delete [] prevRuns;
+    delete [] currRuns;
+    prevRuns = currRuns = NULL;
+    numPrev  = numCurr  = 0;
+
+    // Forget them
+    roi = nextRoi = cvRect(0, 0, 0, 0);
+    reset();
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::addRun(Left, Right, Row)
+// Label a run with the runs of the previous row touching it (8-connected),
+// and add it to the moments of the label.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ColorBlobTracker::addRun(int x0, int x1, int y)
+{
+    // The runs are in order, so skip the ones on the left
+    if (numCurr == 0) firstPrev = 0;
+    while (firstPrev < numPrev && prevRuns[firstPrev].x1 < x0 - 1) firstPrev++;
+
+    // Join the labels of the touching runs
+    int label = -1;
+    for (int i = firstPrev; i < numPrev && prevRuns[i].x0 <= x1 + 1; i++) {
+        if (prevRuns[i].label < 0) continue;
+        const int root = findLabel(prevRuns[i].label);
+        if (label < 0)          label = root;
+        else if (root != label) parent[root] = label;
+    }
+
+    // New label (Too many ones are ignored)
+    if (label < 0 && numLabels < BLOB_MAX_LABELS) {
+        label = numLabels++;
+        parent[label] = label;
+        BLOB_MOMENTS *m = &moments[label];
+        m->m00 = m->m10 = m->m01 = m->m20 = m->m11 = m->m02 = 0.0;
+        m->left = x0;
+        m->right = x1;
+        m->top = m->bottom = y;
+    }
+
+    // Add the run
+    BLOB_RUN *run = &currRuns[numCurr++];
+    run->x0    = x0;
+    run->x1    = x1;
+    run->label = label;
+    if (label < 0) return;
+
+    // Moments of the pixels x0 to x1 in the row y
+    const double n   = x1 - x0 + 1;
+    const double sx  = 0.5 * n * (x0 + x1);
+    const double sxx = (x1 * (x1 + 1.0) * (2.0 * x1 + 1.0) - (x0 - 1.0) * x0 * (2.0 * x0 - 1.0)) / 6.0;
+    BLOB_MOMENTS *m = &moments[label];
+    m->m00 += n;
+    m->m10 += sx;
+    m->m01 += n * y;
+    m->m20 += sxx;
+    m->m11 += sx * y;
+    m->m02 += n * y * y;
+    if (x0 < m->left)   m->left   = x0;
+    if (x1 > m->right)  m->right  = x1;
+    if (y  > m->bottom) m->bottom = y;
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::findLabel(Label)
+// Find the root of a label.
+// Return value Root label
+// --------------------------------------------------------------------------
+int ColorBlobTracker::findLabel(int label)
+{
+    while (parent[label] != label) {
+        parent[label] = parent[parent[label]];
+        label = parent[label];
+    }
+    return label;
+}
+
+// --------------------------------------------------------------------------
+// ColorBlobTracker::predict(Image size)
+// Predict the search area of the next frame. It is twice the bounding box
+// around the centroid moved by the last motion, and some margin.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ColorBlobTracker::predict(CvSize size)
+{
+    const int cx = cvRound(blob.center.x + velocity.x);
+    const int cy = cvRound(blob.center.y + velocity.y);
+    const int hw = blob.rect.width  + BLOB_ROI_MARGIN + abs(cvRound(velocity.x));
+    const int hh = blob.rect.height + BLOB_ROI_MARGIN + abs(cvRound(velocity.y));
+
+    // Inside of the image
+    const int left   = MAX(cx - hw, 0);
+    const int top    = MAX(cy - hh, 0);
+    const int right  = MIN(cx + hw, size.width);
+    const int bottom = MIN(cy + hh, size.height);
+    if (right <= left || bottom <= top) nextRoi = cvRect(0, 0, size.width, size.height);
+    else                                nextRoi = cvRect(left, top, right - left, bottom - top);
+}
\ No newline at end of file
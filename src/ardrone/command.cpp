@@ -1,5 +1,80 @@
 #include "ardrone.h"
 
+// --------------------------------------------------------------------------
+// ATCommandQueue::ATCommandQueue()
+// Constructor of ATCommandQueue class. This will be called when you create it.
+// --------------------------------------------------------------------------
+ATCommandQueue::ATCommandQueue()
+{
+    // Entry i is free for the i-th push
+    for (int i = 0; i < ATCMD_QUEUE_SIZE; i++) {
+        entries[i].sequence = i;
+        entries[i].size     = 0;
+    }
+    tail = head = 0;
+}
+
+// --------------------------------------------------------------------------
+// ATCommandQueue::push(Commands, Size of the commands)
+// Add the commands to the queue. This can be called from any thread.
+// Return value SUCCESS: 1  FAILED: 0 (The queue is full)
+// --------------------------------------------------------------------------
+int ATCommandQueue::push(const char *data, int size)
+{
+    if (size < 1 || size > ATCMD_ENTRY_SIZE) return 0;
+
+    // Claim an entry
+    LONG pos = tail;
+    ATCMD_ENTRY *entry;
+    while (1) {
+        entry = &entries[pos & (ATCMD_QUEUE_SIZE - 1)];
+        LONG diff = (LONG)((ULONG)entry->sequence - (ULONG)pos);
+
+        // Free, try to move the tail
+        if (diff == 0) {
+            if (InterlockedCompareExchange(&tail, pos + 1, pos) == pos) break;
+        }
+        // Not popped yet
+        else if (diff < 0) return 0;
+
+        // Another thread got it
+        pos = tail;
+    }
+
+    // Write the commands
+    memcpy(entry->data, data, size);
+    entry->size = size;
+
+    // Publish to the consumer
+    InterlockedExchange(&entry->sequence, pos + 1);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ATCommandQueue::pop(Buffer, Size of the buffer)
+// Remove the oldest entry. Only one thread can call this.
+// Return value SUCCESS: Size of the commands  FAILED: 0 (The queue is empty)
+// --------------------------------------------------------------------------
+int ATCommandQueue::pop(char *data, int size)
+{
+    ATCMD_ENTRY *entry = &entries[head & (ATCMD_QUEUE_SIZE - 1)];
+
+    // Not published yet
+    if ((LONG)((ULONG)entry->sequence - (ULONG)(head + 1)) < 0) return 0;
+
+    // Read the commands
+    int n = entry->size;
+    if (n > size) n = size;
+    memcpy(data, entry->data, n);
+
+    // Give the entry back to the producers
+    InterlockedExchange(&entry->sequence, head + ATCMD_QUEUE_SIZE);
+    head++;
+
+    return n;
+}
+
 // --------------------------------------------------------------------------
 // ARDrone::initCommand()
 // Initialize AT command.
@@ -8,14 +83,238 @@
 int ARDrone::initCommand(void)
 {
     // Open the socket
-    if (!sockCommand.open(ip, ARDRONE_COMMAND_PORT)) {
-        printf("ERROR: UDPSocket::open(port=%d) failed. (%s, %d)\n", ARDRONE_COMMAND_PORT, __FILE__, __LINE__);
+    if (!openSocket(&sockCommand, ports.command, local.command)) {
+        printf("ERROR: ARDrone::openSocket(port=%d) failed. (%s, %d)\n", ports.command, __FILE__, __LINE__);
         return 0;
     }
 
+    // Make Sleep() accurate to 1ms
+    timeBeginPeriod(1);
+
+    // Start from hovering (The set point of the last session is not sent)
+    clearSetPoint();
+
+    // Create an event to wake up the command thread
+    eventCommand = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    // Enable thread loop
+    flagCommand = 1;
+
+    // Create a thread
+    UINT id;
+    threadCommand = (HANDLE)_beginthreadex(NULL, 0, runCommand, this, 0, &id);
+    if (threadCommand == INVALID_HANDLE_VALUE || threadCommand == 0) {
+        printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
+        threadCommand = INVALID_HANDLE_VALUE;
+        flagCommand = 0;
+        timeEndPeriod(1);
+        return 0;
+    }
+
+    // Commands should go out on time
+    SetThreadPriority(threadCommand, THREAD_PRIORITY_ABOVE_NORMAL);
+
     return 1;
 }
 
+// --------------------------------------------------------------------------
+// ARDrone::loopCommand()
+// Thread function. Sends the latest AT*PCMD and AT*COMWDG at a fixed rate,
+// independently of the main loop. The commands queued since the last tick go
+// in the same datagram, and urgent ones (AT*REF) are sent as soon as they arrive.
+// This is the only thread that assigns the sequence numbers.
+// Return value 0
+// --------------------------------------------------------------------------
+UINT ARDrone::loopCommand(void)
+{
+    double next = ardGetTickCount();
+    timerWdg = next;
+
+    while (flagCommand) {
+        // Gather the queued commands
+        drainCommands();
+
+        // Time to send AT*PCMD
+        double now = ardGetTickCount();
+        if (now >= next) {
+            // Get the latest set point
+            int mode;
+            float v[4];
+            WaitForSingleObject(mutexCommand, INFINITE);
+            mode = pcmdMode;
+            memcpy(v, pcmdValue, sizeof(v));
+            const double period = 1000.0 / rateCommand;
+            const int expired = (now - timePcmd > timeoutCommand);
+            ReleaseMutex(mutexCommand);
+
+            // The application stopped calling move3D(), hover
+            if (expired) {
+                mode = 0;
+                v[0] = v[1] = v[2] = v[3] = 0.0f;
+            }
+
+            // Send AT*PCMD
+            char buf[ATCMD_ENTRY_SIZE];
+            ATEncoder encoder(buf, sizeof(buf));
+            encoder.command(ATCMD_PCMD).arg(mode).arg(v[0]).arg(v[1]).arg(v[2]).arg(v[3]).end();
+
+            // Reset Watch-Dog
+            if (now - timerWdg > ARDRONE_WATCHDOG_INTERVAL) {
+                encoder.command(ATCMD_COMWDG).end();
+                timerWdg = now;
+            }
+            appendCommands(encoder.data(), encoder.size());
+
+            // Next period (Skip the missed periods)
+            next += period;
+            if (next < now) next = now;
+        }
+
+        // Send them in one datagram
+        flushCommands();
+
+        // Sleep until the next period or an urgent command
+        now = ardGetTickCount();
+        if (next > now) WaitForSingleObject(eventCommand, (DWORD)(next - now));
+    }
+
+    // Send the rest (e.g. AT*REF for landing)
+    drainCommands();
+    flushCommands();
+
+    // Disable thread loop
+    flagCommand = 0;
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::sendCommand(Encoded commands, Send right away or not)
+// Queue AT commands. The sequence numbers are inserted by the command thread.
+// ex) sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_REF).arg(290718208).end())
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::sendCommand(const ATEncoder &encoder, int urgent)
+{
+    // Overflowed or rejected
+    if (encoder.size() < 1) {
+        printf("ERROR: Too long or invalid AT command. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // AT*REF (Take off, landing and emergency) should not wait for the next tick
+    return pushCommand(encoder.data(), encoder.size(), urgent || encoder.urgent());
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::sendConfig(Key, Value, Send right away or not)
+// Queue AT*CONFIG. For AR.Drone 2.0, AT*CONFIG_IDS is put in the same entry,
+// so no other command can come between them.
+// Use applyConfig() to wait for the acknowledgement.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::sendConfig(const char *key, const char *value, int urgent)
+{
+    char buf[ATCMD_ENTRY_SIZE];
+    ATEncoder encoder(buf, sizeof(buf));
+
+    // AR.Drone 2.0 needs the configuration IDs
+    if (version.major == ARDRONE_VERSION_2) {
+        encoder.command(ATCMD_CONFIG_IDS).arg(ARDRONE_SESSION_ID).arg(ARDRONE_PROFILE_ID).arg(ARDRONE_APPLOCATION_ID).end();
+    }
+
+    // AT*CONFIG
+    encoder.command(ATCMD_CONFIG).arg(key).arg(value).end();
+
+    return sendCommand(encoder, urgent);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::pushCommand(Commands, Size of the commands, Send right away or not)
+// Put the commands into the queue. Normal commands wait for the next tick of
+// the command thread to share its datagram, urgent ones wake it up.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::pushCommand(const char *data, int size, int urgent)
+{
+    // Check the size
+    if (size < 1 || size > ATCMD_ENTRY_SIZE) return 0;
+
+    // The queue is full, wait for the command thread
+    while (!queueCommand.push(data, size)) {
+        if (!flagCommand) {
+            printf("ERROR: AT command queue is full. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
+        Sleep(1);
+    }
+
+    // Wake up the command thread
+    if (urgent && eventCommand != INVALID_HANDLE_VALUE) SetEvent(eventCommand);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::drainCommands()
+// Move all the queued commands into the datagram. Called by the command thread only.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::drainCommands(void)
+{
+    char data[ATCMD_ENTRY_SIZE];
+    int size;
+
+    while ((size = queueCommand.pop(data, sizeof(data))) > 0) {
+        appendCommands(data, size);
+    }
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::appendCommands(Commands, Size of the commands)
+// Assign the sequence numbers and add the commands to the datagram.
+// The datagram is sent first when they do not fit in it.
+// Called by the command thread only.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::appendCommands(const char *data, int size)
+{
+    // Insert the sequence numbers
+    char buf[ATCMD_DATAGRAM_SIZE];
+    int n = ATEncoder::expand(buf, sizeof(buf), data, size, &seq);
+    if (n < 1) {
+        printf("ERROR: Too long AT commands. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Does not fit (The last byte is for the terminator)
+    if (sizeCommand + n > ATCMD_DATAGRAM_SIZE - 1) flushCommands();
+
+    // Add to the datagram
+    memcpy(bufCommand + sizeCommand, buf, n);
+    sizeCommand += n;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::flushCommands()
+// Send the datagram. Called by the command thread only.
+// Return value SUCCESS: Number of sent bytes  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::flushCommands(void)
+{
+    // Nothing to send
+    if (sizeCommand < 1) return 0;
+
+    // Send the datagram
+    bufCommand[sizeCommand] = '\0';
+    int n = sockCommand.send2(bufCommand, sizeCommand + 1);
+    sizeCommand = 0;
+
+    return n;
+}
+
 // --------------------------------------------------------------------------
 // ARDrone::takeoff()
 // Take off the AR.Drone.
@@ -23,8 +322,10 @@ int ARDrone::initCommand(void)
 // --------------------------------------------------------------------------
 void ARDrone::takeoff(void)
 {
-    if (navdata.ardrone_state & ARDRONE_EMERGENCY_MASK) sockCommand.sendf("AT*REF=%d,290717952\r", seq++);
-    else                                                sockCommand.sendf("AT*REF=%d,290718208\r", seq++);
+    char buf[ATCMD_ENTRY_SIZE];
+
+    if (navdata.ardrone_state & ARDRONE_EMERGENCY_MASK) sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_REF).arg(290717952).end());
+    else                                                sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_REF).arg(290718208).end());
 }
 
 // --------------------------------------------------------------------------
@@ -34,7 +335,10 @@ void ARDrone::takeoff(void)
 // --------------------------------------------------------------------------
 void ARDrone::landing(void)
 {
-    sockCommand.sendf("AT*REF=%d,290717696\r", seq++);
+    char buf[ATCMD_ENTRY_SIZE];
+
+    clearSetPoint();
+    sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_REF).arg(290717696).end());
 }
 
 // --------------------------------------------------------------------------
@@ -44,7 +348,10 @@ void ARDrone::landing(void)
 // --------------------------------------------------------------------------
 void ARDrone::emergency(void)
 {
-    sockCommand.sendf("AT*REF=%d,290717952\r", seq++);
+    char buf[ATCMD_ENTRY_SIZE];
+
+    clearSetPoint();
+    sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_REF).arg(290717952).end());
 }
 
 // --------------------------------------------------------------------------
@@ -60,6 +367,7 @@ void ARDrone::move(double vx, double vy, double vr)
 // --------------------------------------------------------------------------
 // ARDrone::move3D(X velocity[m/s], Y velocity[m/s], Z velocity[m/s], Rotational speed[rad/s])
 // Move the AR.Drone in 3D space.
+// This only updates the set point; the command thread sends it at a fixed rate.
 // Return value NONE
 // --------------------------------------------------------------------------
 void ARDrone::move3D(double vx, double vy, double vz, double vr)
@@ -67,7 +375,13 @@ void ARDrone::move3D(double vx, double vy, double vz, double vr)
     const float gain = 0.4f;
     float v[4] = {-vy*gain, -vx*gain, vz*gain, -vr*gain};
     int mode = (fabs(vx) > 0.0 || fabs(vy) > 0.0);
-    sockCommand.sendf("AT*PCMD=%d,%d,%d,%d,%d,%d\r", seq++, mode, *(int*)(&v[0]), *(int*)(&v[1]), *(int*)(&v[2]), *(int*)(&v[3]));
+
+    // Overwrite the set point
+    WaitForSingleObject(mutexCommand, INFINITE);
+    pcmdMode = mode;
+    memcpy(pcmdValue, v, sizeof(pcmdValue));
+    timePcmd = ardGetTickCount();
+    ReleaseMutex(mutexCommand);
 }
 
 // --------------------------------------------------------------------------
@@ -79,16 +393,12 @@ void ARDrone::move3D(double vx, double vy, double vz, double vr)
 // --------------------------------------------------------------------------
 void ARDrone::setCamera(int channel)
 {
-    // ARDrone 2.0
-    if (version.major == ARDRONE_VERSION_2) {
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        sockCommand.sendf("AT*CONFIG=%d,\"video:video_channel\",\"%d\"\r", seq++, channel);
-        Sleep(100);
-    }
-    // ARDrone 1.0
-    else {
-        sockCommand.sendf("AT*CONFIG=%d,\"video:video_channel\",\"%d\"\r", seq++, channel);
-    }
+    char value[12];
+    value[ATEncoder::formatInt(value, channel)] = '\0';
+
+    // Wait until the AR.Drone accepts it
+    const CONFIG_ITEM item = {"video:video_channel", value, 1, 0};
+    applyConfig(&item, 1);
 }
 
 //// --------------------------------------------------------------------------
@@ -101,8 +411,7 @@ void ARDrone::setCamera(int channel)
 //void ARDrone::startRecord(void)
 //{
 //    if (version.major == ARDRONE_VERSION_2) {
-//        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-//        sockCommand.sendf("AT*CONFIG=%d,\"video:video_on_usb\",\"TRUE\"\r", seq++);
+//        sendConfig("video:video_on_usb", "TRUE");
 //        Sleep(100);
 //    }
 //}
@@ -116,8 +425,7 @@ void ARDrone::setCamera(int channel)
 //void ARDrone::stopRecord(void)
 //{
 //    if (version.major == ARDRONE_VERSION_2) {
-//        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-//        sockCommand.sendf("AT*CONFIG=%d,\"video:video_on_usb\",\"FALSE\"\r", seq++);
+//        sendConfig("video:video_on_usb", "FALSE");
 //        Sleep(100);
 //    }
 //}
@@ -129,9 +437,10 @@ void ARDrone::setCamera(int channel)
 // --------------------------------------------------------------------------
 void ARDrone::setAnimation(int id, int duration)
 {
-    sockCommand.sendf("AT*ANIM=%d,%d,%d\r", seq++, id, duration);
-    //sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-    //sockCommand.sendf("AT*CONFIG=%d,\"leds:flight_anim\",\"%d,%d\"\r", seq++, id, duration);
+    char buf[ATCMD_ENTRY_SIZE];
+
+    sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_ANIM).arg(id).arg(duration).end());
+    //sendConfig("leds:flight_anim", "%d,%d", id, duration);
     //Sleep(100);
 }
 
@@ -142,9 +451,10 @@ void ARDrone::setAnimation(int id, int duration)
 // --------------------------------------------------------------------------
 void ARDrone::setLED(int id, float freq, int duration)
 {
-    sockCommand.sendf("AT*LED=%d,%d,%d,%d\r", seq++, id, *(int*)(&freq), duration);
-    //sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-    //sockCommand.sendf("AT*CONFIG=%d,\"leds:leds_anim\",\"%d,%d,%d\"\r", seq++, id, *(int*)(&freq), duration);
+    char buf[ATCMD_ENTRY_SIZE];
+
+    sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_LED).arg(id).arg(freq).arg(duration).end());
+    //sendConfig("leds:leds_anim", "%d,%d,%d", id, *(int*)(&freq), duration);
     //Sleep(100);
 }
 
@@ -155,7 +465,9 @@ void ARDrone::setLED(int id, float freq, int duration)
 // --------------------------------------------------------------------------
 void ARDrone::resetWatchDog(void)
 {
-    if (navdata.ardrone_state & ARDRONE_COM_WATCHDOG_MASK) sockCommand.sendf("AT*COMWDG=%d\r", seq++);
+    char buf[ATCMD_ENTRY_SIZE];
+
+    if (navdata.ardrone_state & ARDRONE_COM_WATCHDOG_MASK) sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_COMWDG).end());
 }
 
 // --------------------------------------------------------------------------
@@ -165,7 +477,9 @@ void ARDrone::resetWatchDog(void)
 // --------------------------------------------------------------------------
 void ARDrone::resetEmergency(void)
 {
-    if (navdata.ardrone_state & ARDRONE_EMERGENCY_MASK) sockCommand.sendf("AT*REF=%d,290717952\r", seq++);
+    char buf[ATCMD_ENTRY_SIZE];
+
+    if (navdata.ardrone_state & ARDRONE_EMERGENCY_MASK) sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_REF).arg(290717952).end());
 }
 
 // --------------------------------------------------------------------------
@@ -175,7 +489,9 @@ void ARDrone::resetEmergency(void)
 // --------------------------------------------------------------------------
 void ARDrone::flatTrim(void)
 {
-	sockCommand.sendf("AT*FTRIM=%d,\r", seq++);
+    char buf[ATCMD_ENTRY_SIZE];
+
+	sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_FTRIM).raw(",").end());
 } 
 
 // --------------------------------------------------------------------------
@@ -185,7 +501,54 @@ void ARDrone::flatTrim(void)
 // --------------------------------------------------------------------------
 void ARDrone::hover(void)
 {
-    sockCommand.sendf("AT*PCMD=%d,%d,%d,%d,%d,%d\r", seq++, 0, 0, 0, 0, 0);
+    move3D(0.0, 0.0, 0.0, 0.0);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::setCommandRate(Rate[Hz])
+// Change the rate of AT*PCMD sent by the command thread.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::setCommandRate(double rate)
+{
+    // Check the range
+    if (rate < 1.0)   rate = 1.0;
+    if (rate > 200.0) rate = 200.0;
+
+    WaitForSingleObject(mutexCommand, INFINITE);
+    rateCommand = rate;
+    ReleaseMutex(mutexCommand);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::setCommandTimeout(Timeout [ms])
+// Change the time until the command thread stops sending the set point and
+// hovers, when move3D() is not called. Call move3D() faster than this.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::setCommandTimeout(double timeout)
+{
+    // Check the range
+    if (timeout < 10.0)    timeout = 10.0;
+    if (timeout > 10000.0) timeout = 10000.0;
+
+    WaitForSingleObject(mutexCommand, INFINITE);
+    timeoutCommand = timeout;
+    ReleaseMutex(mutexCommand);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::clearSetPoint()
+// Set the set point to hovering.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::clearSetPoint(void)
+{
+    WaitForSingleObject(mutexCommand, INFINITE);
+    pcmdMode = 0;
+    pcmdValue[0] = pcmdValue[1] = pcmdValue[2] = pcmdValue[3] = 0.0f;
+    timePcmd = 0.0;
+    ReleaseMutex(mutexCommand);
 }
 
 // --------------------------------------------------------------------------
@@ -195,6 +558,23 @@ void ARDrone::hover(void)
 // --------------------------------------------------------------------------
 void ARDrone::finalizeCommand(void)
 {
+    // Disable the loop
+    flagCommand = 0;
+
+    // Destroy the thread
+    if (threadCommand != INVALID_HANDLE_VALUE) {
+        WaitForSingleObject(threadCommand, INFINITE);
+        CloseHandle(threadCommand);
+        threadCommand = INVALID_HANDLE_VALUE;
+        timeEndPeriod(1);
+    }
+
+    // Delete the event
+    if (eventCommand != INVALID_HANDLE_VALUE) {
+        CloseHandle(eventCommand);
+        eventCommand = INVALID_HANDLE_VALUE;
+    }
+
     // Close the socket
     sockCommand.close();
 }
\ No newline at end of file
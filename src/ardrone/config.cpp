@@ -1,5 +1,130 @@
 #include "ardrone.h"
 
+// --------------------------------------------------------------------------
+// configBlank(Character)
+// Spaces, line breaks and the terminator of the dump.
+// Return value BLANK: 1  OTHERS: 0
+// --------------------------------------------------------------------------
+static inline int configBlank(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0');
+}
+
+// --------------------------------------------------------------------------
+// ConfigCache::ConfigCache()
+// Constructor of ConfigCache class. This will be called when you create it.
+// --------------------------------------------------------------------------
+ConfigCache::ConfigCache()
+{
+}
+
+// --------------------------------------------------------------------------
+// ConfigCache::clear()
+// Remove all the keys.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ConfigCache::clear(void)
+{
+    table.clear();
+    line.clear();
+}
+
+// --------------------------------------------------------------------------
+// ConfigCache::parse(Received data, Size of the data)
+// Feed the bytes from the config port. Completed lines update the table,
+// and the rest is kept for the next call.
+// Return value Number of changed keys
+// --------------------------------------------------------------------------
+int ConfigCache::parse(const char *data, int size)
+{
+    int changed = 0;
+
+    for (int i = 0; i < size; i++) {
+        const char c = data[i];
+
+        // End of a line
+        if (c == '\n' || c == '\0') {
+            changed += parseLine(line.data(), (int)line.size());
+            line.clear();
+        }
+        // Carriage return
+        else if (c != '\r') line += c;
+    }
+
+    return changed;
+}
+
+// --------------------------------------------------------------------------
+// ConfigCache::parseLine(Line, Size of the line)
+// Parse "key = value" in a complete line. The line may end with "\r\n"
+// and may start with the terminator of the previous dump.
+// Return value CHANGED: 1  NOT CHANGED: 0
+// --------------------------------------------------------------------------
+int ConfigCache::parseLine(const char *data, int size)
+{
+    // Trim the spaces
+    int begin = 0, end = size;
+    while (begin < end && configBlank(data[begin])) begin++;
+    while (end > begin && configBlank(data[end - 1])) end--;
+
+    // Separator
+    const char *sep = (const char*)memchr(data + begin, '=', end - begin);
+    if (!sep) return 0;
+
+    // Key and value without the spaces around them
+    int key_end = (int)(sep - data), value_begin = key_end + 1;
+    while (key_end > begin && configBlank(data[key_end - 1])) key_end--;
+    while (value_begin < end && configBlank(data[value_begin])) value_begin++;
+    if (key_end <= begin) return 0;
+
+    return set(std::string(data + begin, key_end - begin).c_str(), std::string(data + value_begin, end - value_begin).c_str());
+}
+
+// --------------------------------------------------------------------------
+// ConfigCache::set(Key, Value)
+// Update the key.
+// Return value CHANGED: 1  NOT CHANGED: 0
+// --------------------------------------------------------------------------
+int ConfigCache::set(const char *key, const char *value)
+{
+    std::map<std::string, std::string>::iterator it = table.find(key);
+
+    // Same value
+    if (it != table.end() && it->second == value) return 0;
+
+    // Add or overwrite
+    table[key] = value;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ConfigCache::get(Key, Value, Size of the value)
+// Obtaining the value of the key.
+// Return value SUCCESS: 1  FAILED: 0 (Not found)
+// --------------------------------------------------------------------------
+int ConfigCache::get(const char *key, char *value, int size)
+{
+    std::map<std::string, std::string>::const_iterator it = table.find(key);
+    if (it == table.end() || size < 1) return 0;
+
+    // Copy the value
+    strncpy(value, it->second.c_str(), size - 1);
+    value[size - 1] = '\0';
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ConfigCache::size()
+// Obtaining the number of keys.
+// Return value Number of keys
+// --------------------------------------------------------------------------
+int ConfigCache::size(void)
+{
+    return (int)table.size();
+}
+
 // --------------------------------------------------------------------------
 // ARDrone::initConfig()
 // Initialize the Config.
@@ -7,125 +132,311 @@
 // --------------------------------------------------------------------------
 int ARDrone::initConfig(void)
 {
-    //// Open the socket.
-    //if (!sockConfig.open(ip, ARDRONE_CONFIG_PORT)) {
-    //    printf("ERROR: TCPSocket::open(port=%d) failed. (%s, %d)\n", ARDRONE_CONFIG_PORT, __FILE__, __LINE__);
-    //    return 0;
-    //}
+    char buf[ATCMD_ENTRY_SIZE];
+
+    // Open the socket (Without it, all the keys are sent)
+    if (!sockConfig.open(ip, ports.config)) {
+        printf("WARNING: TCPSocket::open(port=%d) failed, sending all the configuration. (%s, %d)\n", ports.config, __FILE__, __LINE__);
+    }
+    // Read the current configuration, so the keys already set are skipped
+    else getConfig();
+
+    // Send undocumented commands
+    sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_PMODE).arg(2).end());
+    sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_MISC).arg(2).arg(20).arg(2000).arg(3000).end());
 
     // AR.Drone 2.0
     if (version.major == ARDRONE_VERSION_2) {
-        // Send undocumented command
-        sockCommand.sendf("AT*PMODE=%d,%d\r", seq++, 2);
-        Sleep(100);
-
-        // Send undocumented command
-        sockCommand.sendf("AT*MISC=%d,%d,%d,%d,%d\r", seq++, 2, 20, 2000, 3000);
-        Sleep(100);
-
-        // Set the configuration IDs
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        sockCommand.sendf("AT*CONFIG=%d,\"custom:session_id\",\"%s\"\r", seq++, ARDRONE_SESSION_ID);
-        Sleep(100);
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        sockCommand.sendf("AT*CONFIG=%d,\"custom:profile_id\",\"%s\"\r", seq++, ARDRONE_PROFILE_ID);
-        Sleep(100);
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        sockCommand.sendf("AT*CONFIG=%d,\"custom:application_id\",\"%s\"\r", seq++, ARDRONE_APPLOCATION_ID);
-        Sleep(100);
-
-        // Enable video
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        sockCommand.sendf("AT*CONFIG=%d,\"general:video_enable\",\"TRUE\"\r", seq++);
-        Sleep(100);
-
-        // Disable bitrate control mode
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        sockCommand.sendf("AT*CONFIG=%d,\"video:bitrate_ctrl_mode\",\"0\"\r", seq++);
-        Sleep(100);
-
-        // Output video with 360p
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        sockCommand.sendf("AT*CONFIG=%d,\"video:video_codec\",\"%d\"\r", seq++, 0x81);
-        //sockCommand.sendf("AT*CONFIG=%d,\"video:video_codec\",\"%d\"\r", seq++, 0x82);
-        Sleep(100);
-
-        // Output video with 720p
-        //sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        //sockCommand.sendf("AT*CONFIG=%d,\"video:video_codec\",\"%d\"\r", seq++, 0x83);
-        //Sleep(100);
-
-        // Set video channel
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        sockCommand.sendf("AT*CONFIG=%d,\"video:video_channel\",\"0\"\r", seq++);
-        Sleep(100);
-
-        // Send flat trim
-        sockCommand.sendf("AT*FTRIM=%d,\r", seq++);
-        Sleep(100);
+        const CONFIG_ITEM items[] = {
+            // Set the configuration IDs (Each one must be accepted before the next)
+            {"custom:session_id",       ARDRONE_SESSION_ID,     1, 0},
+            {"custom:profile_id",       ARDRONE_PROFILE_ID,     1, 0},
+            {"custom:application_id",   ARDRONE_APPLOCATION_ID, 1, 0},
+
+            // Disable BOOTSTRAP mode of Navdata
+            {"general:navdata_demo",    "TRUE",                 0, 0},
+
+            // Enable video
+            {"general:video_enable",    "TRUE",                 0, 0},
+
+            // Disable bitrate control mode
+            {"video:bitrate_ctrl_mode", "0",                    0, 0},
+
+            // Output video with 360p (0x81)
+            {"video:video_codec",       "129",                  0, 1000},
+            // Output video with 720p (0x83)
+            //{"video:video_codec",     "131",                  0, 1000},
+
+            // Set video channel
+            {"video:video_channel",     "0",                    1, 0},
+        };
+        applyConfig(items, sizeof(items) / sizeof(items[0]));
     }
     // AR.Drone 1.0
     else {
-        // Send undocumented command
-        sockCommand.sendf("AT*PMODE=%d,%d\r", seq++, 2);
-        Sleep(100);
-
-        // Send undocumented command
-        sockCommand.sendf("AT*MISC=%d,%d,%d,%d,%d\r", seq++, 2, 20, 2000, 3000);
-        Sleep(100);
-
-        // Enable video
-        sockCommand.sendf("AT*CONFIG=%d,\"general:video_enable\",\"TRUE\"\r", seq++);
-        Sleep(100);
-
-        // Disable bitrate control mode
-        sockCommand.sendf("AT*CONFIG=%d,\"video:bitrate_ctrl_mode\",\"0\"\r", seq++);
-        Sleep(100);
-
-        // Output video with UVLC
-        sockCommand.sendf("AT*CONFIG=%d,\"video:video_codec\",\"%d\"\r", seq++, 0x20);
-        Sleep(100);
-
-        // Output video with P264
-        //sockCommand.sendf("AT*CONFIG=%d,\"video:video_codec\",\"%d\"\r", seq++, 0x40);
-        //Sleep(100);
-        
-        // Set video channel
-        sockCommand.sendf("AT*CONFIG=%d,\"video:video_channel\",\"0\"\r", seq++);
-        Sleep(100);
-
-        // Send flat trim
-        sockCommand.sendf("AT*FTRIM=%d,\r", seq++);
-        Sleep(100);
+        const CONFIG_ITEM items[] = {
+            // Disable BOOTSTRAP mode of Navdata
+            {"general:navdata_demo",    "TRUE",                 0, 0},
+
+            // Enable video
+            {"general:video_enable",    "TRUE",                 0, 0},
+
+            // Disable bitrate control mode
+            {"video:bitrate_ctrl_mode", "0",                    0, 0},
+
+            // Output video with UVLC (0x20)
+            {"video:video_codec",       "32",                   0, 1000},
+            // Output video with P264 (0x40)
+            //{"video:video_codec",     "64",                   0, 1000},
+
+            // Set video channel
+            {"video:video_channel",     "0",                    1, 0},
+        };
+        applyConfig(items, sizeof(items) / sizeof(items[0]));
     }
-    
+
+    // Send flat trim
+    sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_FTRIM).raw(",").end(), 1);
+
     return 1;
 }
 
+// --------------------------------------------------------------------------
+// ARDrone::applyConfig(Items, Number of items)
+// Send the configuration and wait for the acknowledgements.
+// Items up to a barrier go out together and are retried together.
+// Items which are not acknowledged are reported, and the rest are still sent.
+// Return value SUCCESS: 1  FAILED: 0 (Some items were not acknowledged)
+// --------------------------------------------------------------------------
+int ARDrone::applyConfig(const CONFIG_ITEM *items, int num)
+{
+    int result = 1;
+    int i = 0;
+    while (i < num) {
+        // Items up to the next barrier
+        int j = i, timeout = 0;
+        while (j < num) {
+            const int t = items[j].timeout > 0 ? items[j].timeout : ARDRONE_CONFIG_TIMEOUT;
+            if (t > timeout) timeout = t;
+            if (items[j++].barrier) break;
+        }
+
+        // Skip the items which already hold the value
+        int last = -1;
+        for (int k = i; k < j; k++) {
+            if (!matchConfig(items[k].key, items[k].value)) last = k;
+        }
+        if (last < 0) {
+            i = j;
+            continue;
+        }
+
+        // Send them and wait for the acknowledgement
+        int retry;
+        for (retry = 0; retry <= ARDRONE_CONFIG_RETRIES; retry++) {
+            // Acknowledge the previous one left
+            if (navdata.ardrone_state & ARDRONE_COMMAND_MASK) ackConfig(ARDRONE_CONFIG_TIMEOUT);
+
+            // Send them in a datagram (Wake up the command thread with the last one)
+            for (int k = i; k <= last; k++) {
+                if (!matchConfig(items[k].key, items[k].value)) sendConfig(items[k].key, items[k].value, k == last);
+            }
+
+            // Accepted
+            if (ackConfig(timeout)) break;
+        }
+
+        // Failed (The AR.Drone may have applied them anyway, so go on like the older versions)
+        if (retry > ARDRONE_CONFIG_RETRIES) {
+            for (int k = i; k <= last; k++) {
+                if (!matchConfig(items[k].key, items[k].value)) printf("WARNING: AT*CONFIG(%s) was not acknowledged. (%s, %d)\n", items[k].key, __FILE__, __LINE__);
+            }
+            result = 0;
+            i = j;
+            continue;
+        }
+
+        // Update the cache
+        WaitForSingleObject(mutexConfig, INFINITE);
+        for (int k = i; k <= last; k++) {
+            // Other keys belong to the previous session/profile/application
+            if (!strncmp(items[k].key, "custom:", 7) && !matchConfig(items[k].key, items[k].value)) config.clear();
+            config.set(items[k].key, items[k].value);
+        }
+        ReleaseMutex(mutexConfig);
+
+        i = j;
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::ackConfig(Timeout [ms])
+// Wait for ARDRONE_COMMAND_MASK in Navdata, then send AT*CTRL=5 and wait
+// until it is cleared. After that, the AR.Drone accepts the next AT*CONFIG.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::ackConfig(double timeout)
+{
+    char buf[ATCMD_ENTRY_SIZE];
+
+    // The AR.Drone received AT*CONFIG
+    if (!waitState(ARDRONE_COMMAND_MASK, ARDRONE_COMMAND_MASK, timeout)) return 0;
+
+    // Send ACK
+    sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_CTRL).arg(5).arg(0).end(), 1);
+
+    // The AR.Drone is ready for the next one
+    return waitState(ARDRONE_COMMAND_MASK, 0, timeout);
+}
+
 // --------------------------------------------------------------------------
 // ARDrone::getConfig()
 // Get the AR.Drone's configurations.
-// Not work yet.
-// Return value SUCCESS: 1  FAILED: 0
+// Request the dump with AT*CTRL=4 and parse it into the cache as it arrives.
+// Return value SUCCESS: Number of keys  FAILED: 0
 // --------------------------------------------------------------------------
 int ARDrone::getConfig(void)
 {
-    //// Send ACK
-    //sockCommand.sendf("AT*CTRL=%d,4,0\r", seq++);
+    char buf[ATCMD_ENTRY_SIZE];
+
+    // Send ACK
+    sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_CTRL).arg(4).arg(0).end(), 1);
+
+    // Receive the lines until they stop (They are parsed in the ring buffer)
+    int received = 0;
+    const double deadline = ardGetTickCount() + ARDRONE_CONFIG_READ_TIMEOUT;
+    while (ardGetTickCount() < deadline) {
+        // Nothing comes any more
+        int size;
+        const char *line = sockConfig.readUntil("\n", &size, received ? ARDRONE_CONFIG_READ_IDLE : (int)(deadline - ardGetTickCount()) + 1);
+        if (!line) break;
+        received += size;
+
+        // Update the cache
+        WaitForSingleObject(mutexConfig, INFINITE);
+        config.parseLine(line, size);
+        ReleaseMutex(mutexConfig);
+    }
+
+    // The last line without "\n"
+    int rest = sockConfig.available();
+    if (rest > 0) {
+        const char *line = sockConfig.readExact(rest, 0);
+        received += rest;
+        WaitForSingleObject(mutexConfig, INFINITE);
+        config.parseLine(line, rest);
+        ReleaseMutex(mutexConfig);
+    }
+
+    // Acknowledge the dump
+    if (navdata.ardrone_state & ARDRONE_COMMAND_MASK) ackConfig(ARDRONE_CONFIG_TIMEOUT);
 
-    //// Receive the data
-    //char buf[1024];
-    //int size = sockConfig.receive((void*)&buf, sizeof(buf));
-    //printf("size = %d\n", size);
+    // Received nothing
+    if (!received) {
+        printf("ERROR: No configuration. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
 
-    //// Received something
-    //if (size > 0) {
-    //    printf("received = %s\n", buf);
-    //}
+    WaitForSingleObject(mutexConfig, INFINITE);
+    int n = config.size();
+    ReleaseMutex(mutexConfig);
+
+    return n;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::refreshConfig()
+// Read the AR.Drone's configurations again.
+// Return value SUCCESS: Number of keys  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::refreshConfig(void)
+{
+    return getConfig();
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::getConfigString(Key, Value, Size of the value)
+// Obtaining a cached configuration as a string.
+// Return value SUCCESS: 1  FAILED: 0 (Not found)
+// --------------------------------------------------------------------------
+int ARDrone::getConfigString(const char *key, char *value, int size)
+{
+    WaitForSingleObject(mutexConfig, INFINITE);
+    int found = config.get(key, value, size);
+    ReleaseMutex(mutexConfig);
+
+    return found;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::getConfigInt(Key, Value)
+// Obtaining a cached configuration as an integer.
+// Return value SUCCESS: 1  FAILED: 0 (Not found or not a number)
+// --------------------------------------------------------------------------
+int ARDrone::getConfigInt(const char *key, int *value)
+{
+    char str[64], *end;
+    if (!getConfigString(key, str, sizeof(str))) return 0;
+
+    long n = strtol(str, &end, 0);
+    if (end == str) return 0;
+    *value = (int)n;
 
     return 1;
 }
 
+// --------------------------------------------------------------------------
+// ARDrone::getConfigDouble(Key, Value)
+// Obtaining a cached configuration as a real number.
+// Return value SUCCESS: 1  FAILED: 0 (Not found or not a number)
+// --------------------------------------------------------------------------
+int ARDrone::getConfigDouble(const char *key, double *value)
+{
+    char str[64], *end;
+    if (!getConfigString(key, str, sizeof(str))) return 0;
+
+    double d = strtod(str, &end);
+    if (end == str) return 0;
+    *value = d;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::getConfigBool(Key, Value)
+// Obtaining a cached configuration of "TRUE" or "FALSE".
+// Return value SUCCESS: 1  FAILED: 0 (Not found or not a boolean)
+// --------------------------------------------------------------------------
+int ARDrone::getConfigBool(const char *key, int *value)
+{
+    char str[64];
+    if (!getConfigString(key, str, sizeof(str))) return 0;
+
+    if      (!strcmp(str, "TRUE"))  *value = 1;
+    else if (!strcmp(str, "FALSE")) *value = 0;
+    else return 0;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::matchConfig(Key, Value)
+// Check the cached value of the key is the same.
+// Return value SAME: 1  DIFFERENT OR UNKNOWN: 0
+// --------------------------------------------------------------------------
+int ARDrone::matchConfig(const char *key, const char *value)
+{
+    char str[256];
+
+    WaitForSingleObject(mutexConfig, INFINITE);
+    int found = config.get(key, str, sizeof(str));
+    ReleaseMutex(mutexConfig);
+
+    return found && !strcmp(str, value);
+}
+
 // --------------------------------------------------------------------------
 // ARDrone::finalizeConfig()
 // Finalize configuration.
@@ -133,6 +444,6 @@ int ARDrone::getConfig(void)
 // --------------------------------------------------------------------------
 void ARDrone::finalizeConfig(void)
 {
-    //// Close the socket
-    //sockConfig.close();
+    // Close the socket
+    sockConfig.close();
 }
\ No newline at end of file
@@ -0,0 +1,253 @@
+#include "ardrone.h"
+
+// Noise parameters
+#define EKF_Q_ACCEL     (2.0)           // Process noise of acceleration [(m/s^2)^2*s]
+#define EKF_Q_ANGLE     (0.5)           // Process noise of attitude rate [(rad/s)^2*s]
+#define EKF_R_ANGLE     (1.0e-4)        // Measurement noise of roll and pitch [rad^2]
+#define EKF_R_YAW       (1.0e-3)        // Measurement noise of yaw [rad^2]
+#define EKF_R_VELOCITY  (1.0e-2)        // Measurement noise of velocity [(m/s)^2]
+#define EKF_R_ALTITUDE  (2.5e-3)        // Measurement noise of sonar [m^2]
+#define EKF_MAX_DT      (0.5)           // Maximum step of the prediction [s]
+
+// Indices of the state vector
+enum { EKF_X = 0, EKF_Y, EKF_Z, EKF_VX, EKF_VY, EKF_VZ, EKF_ROLL, EKF_PITCH, EKF_YAW };
+
+// --------------------------------------------------------------------------
+// ekfWrapAngle(Angle [rad])
+// Wrap the angle into [-PI, PI].
+// Return value Wrapped angle [rad]
+// --------------------------------------------------------------------------
+static inline double ekfWrapAngle(double a)
+{
+    while (a >  M_PI) a -= 2.0 * M_PI;
+    while (a < -M_PI) a += 2.0 * M_PI;
+    return a;
+}
+
+// --------------------------------------------------------------------------
+// NavdataEKF::NavdataEKF()
+// Constructor of NavdataEKF class. This will be called when you create it.
+// --------------------------------------------------------------------------
+NavdataEKF::NavdataEKF()
+{
+    reset();
+}
+
+// --------------------------------------------------------------------------
+// NavdataEKF::reset()
+// Initialize the state. The next Navdata becomes the origin.
+// Return value NONE
+// --------------------------------------------------------------------------
+void NavdataEKF::reset(void)
+{
+    memset(X, 0, sizeof(X));
+    memset(P, 0, sizeof(P));
+    last_tick   = 0.0;
+    initialized = 0;
+}
+
+// --------------------------------------------------------------------------
+// NavdataEKF::update(Navdata, Timestamp [ms])
+// Predict the state up to the timestamp and correct it with the Navdata.
+// Return value NONE
+// --------------------------------------------------------------------------
+void NavdataEKF::update(const NAVDATA *navdata, double tick)
+{
+    // Measurements
+    const double roll     = navdata->phi   * 0.001 * DEG_TO_RAD;
+    const double pitch    = navdata->theta * 0.001 * DEG_TO_RAD;
+    const double yaw      = navdata->psi   * 0.001 * DEG_TO_RAD;
+    const double altitude = navdata->altitude * 0.001;
+    const double vx       = navdata->vx * 0.001;
+    const double vy       = navdata->vy * 0.001;
+
+    // Initialize with the first Navdata
+    if (!initialized) {
+        const double c = cos(yaw), s = sin(yaw);
+        memset(P, 0, sizeof(P));
+        X[EKF_X]     = X[EKF_Y] = 0.0;
+        X[EKF_Z]     = altitude;
+        X[EKF_VX]    = c * vx - s * vy;
+        X[EKF_VY]    = s * vx + c * vy;
+        X[EKF_VZ]    = 0.0;
+        X[EKF_ROLL]  = roll;
+        X[EKF_PITCH] = pitch;
+        X[EKF_YAW]   = yaw;
+        P[EKF_Z][EKF_Z]       = EKF_R_ALTITUDE;
+        P[EKF_VX][EKF_VX]     = P[EKF_VY][EKF_VY] = EKF_R_VELOCITY;
+        P[EKF_VZ][EKF_VZ]     = 1.0;
+        P[EKF_ROLL][EKF_ROLL] = P[EKF_PITCH][EKF_PITCH] = EKF_R_ANGLE;
+        P[EKF_YAW][EKF_YAW]   = EKF_R_YAW;
+        last_tick   = tick;
+        initialized = 1;
+        return;
+    }
+
+    // Elapsed time (Long gaps are clamped, the covariance grows instead)
+    double dt = (tick - last_tick) * 0.001;
+    if (dt > EKF_MAX_DT) dt = EKF_MAX_DT;
+    last_tick = tick;
+
+    // Prediction
+    if (dt > 0.0) predict(dt);
+
+    // Measurement rows
+    double H[EKF_STATE_SIZE];
+
+    // Roll and pitch
+    memset(H, 0, sizeof(H));
+    H[EKF_ROLL] = 1.0;
+    correct(H, roll - X[EKF_ROLL], EKF_R_ANGLE);
+    H[EKF_ROLL] = 0.0;
+    H[EKF_PITCH] = 1.0;
+    correct(H, pitch - X[EKF_PITCH], EKF_R_ANGLE);
+    H[EKF_PITCH] = 0.0;
+
+    // Yaw
+    H[EKF_YAW] = 1.0;
+    correct(H, ekfWrapAngle(yaw - X[EKF_YAW]), EKF_R_YAW);
+    H[EKF_YAW] = 0.0;
+
+    // Velocity in the body frame (h = Rz(yaw)^T * v)
+    {
+        const double c = cos(X[EKF_YAW]), s = sin(X[EKF_YAW]);
+        const double wx = X[EKF_VX], wy = X[EKF_VY];
+
+        // Forward
+        H[EKF_VX]  =  c;
+        H[EKF_VY]  =  s;
+        H[EKF_YAW] = -s * wx + c * wy;
+        correct(H, vx - (c * wx + s * wy), EKF_R_VELOCITY);
+
+        // Left (linearized at the corrected state)
+        const double c2 = cos(X[EKF_YAW]), s2 = sin(X[EKF_YAW]);
+        const double wx2 = X[EKF_VX], wy2 = X[EKF_VY];
+        H[EKF_VX]  = -s2;
+        H[EKF_VY]  =  c2;
+        H[EKF_YAW] = -c2 * wx2 - s2 * wy2;
+        correct(H, vy - (-s2 * wx2 + c2 * wy2), EKF_R_VELOCITY);
+        H[EKF_VX] = H[EKF_VY] = H[EKF_YAW] = 0.0;
+    }
+
+    // Sonar altitude (0 means out of range)
+    if (navdata->altitude > 0) {
+        H[EKF_Z] = 1.0;
+        correct(H, altitude - X[EKF_Z], EKF_R_ALTITUDE);
+    }
+
+    // Keep the yaw in range
+    X[EKF_YAW] = ekfWrapAngle(X[EKF_YAW]);
+}
+
+// --------------------------------------------------------------------------
+// NavdataEKF::predict(Elapsed time [s])
+// Constant velocity model. P = F*P*F^T + Q where F = [I dt*I 0; 0 I 0; 0 0 I].
+// Return value NONE
+// --------------------------------------------------------------------------
+void NavdataEKF::predict(double dt)
+{
+    // State
+    X[EKF_X] += X[EKF_VX] * dt;
+    X[EKF_Y] += X[EKF_VY] * dt;
+    X[EKF_Z] += X[EKF_VZ] * dt;
+
+    // F*P (Only position rows change)
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < EKF_STATE_SIZE; j++) P[i][j] += dt * P[i + 3][j];
+    }
+
+    // (F*P)*F^T (Only position columns change)
+    for (int i = 0; i < EKF_STATE_SIZE; i++) {
+        for (int j = 0; j < 3; j++) P[i][j] += dt * P[i][j + 3];
+    }
+
+    // Process noise (Discrete white noise acceleration)
+    const double dt2 = dt * dt, dt3 = dt2 * dt;
+    for (int i = 0; i < 3; i++) {
+        P[i][i]         += EKF_Q_ACCEL * dt3 / 3.0;
+        P[i][i + 3]     += EKF_Q_ACCEL * dt2 / 2.0;
+        P[i + 3][i]     += EKF_Q_ACCEL * dt2 / 2.0;
+        P[i + 3][i + 3] += EKF_Q_ACCEL * dt;
+        P[i + 6][i + 6] += EKF_Q_ANGLE * dt;
+    }
+}
+
+// --------------------------------------------------------------------------
+// NavdataEKF::correct(Measurement row, Innovation, Measurement noise)
+// Scalar measurement update, so no matrix inversion is needed.
+// Return value NONE
+// --------------------------------------------------------------------------
+void NavdataEKF::correct(const double *H, double innovation, double r)
+{
+    // PH^T and HPH^T + R
+    double PHt[EKF_STATE_SIZE];
+    double S = r;
+    for (int i = 0; i < EKF_STATE_SIZE; i++) {
+        double sum = 0.0;
+        for (int j = 0; j < EKF_STATE_SIZE; j++) sum += P[i][j] * H[j];
+        PHt[i] = sum;
+        S += H[i] * sum;
+    }
+    if (S <= 0.0) return;
+
+    // Kalman gain and the state
+    const double inv = 1.0 / S;
+    double K[EKF_STATE_SIZE];
+    for (int i = 0; i < EKF_STATE_SIZE; i++) {
+        K[i] = PHt[i] * inv;
+        X[i] += K[i] * innovation;
+    }
+
+    // P = P - K*(HP) where HP = (PH^T)^T
+    for (int i = 0; i < EKF_STATE_SIZE; i++) {
+        for (int j = 0; j < EKF_STATE_SIZE; j++) P[i][j] -= K[i] * PHt[j];
+    }
+}
+
+// --------------------------------------------------------------------------
+// NavdataEKF::getEstimate(Estimate)
+// Obtaining the current estimate.
+// Return value NONE
+// --------------------------------------------------------------------------
+void NavdataEKF::getEstimate(STATE_ESTIMATE *estimate)
+{
+    estimate->tick  = last_tick;
+    estimate->x     = X[EKF_X];
+    estimate->y     = X[EKF_Y];
+    estimate->z     = X[EKF_Z];
+    estimate->vx    = X[EKF_VX];
+    estimate->vy    = X[EKF_VY];
+    estimate->vz    = X[EKF_VZ];
+    estimate->roll  = X[EKF_ROLL];
+    estimate->pitch = X[EKF_PITCH];
+    estimate->yaw   = X[EKF_YAW];
+    memcpy(estimate->cov, P, sizeof(P));
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::getEstimate(Estimate)
+// Obtaining a snapshot of the position, velocity and attitude estimated by the EKF.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::getEstimate(STATE_ESTIMATE *estimate)
+{
+    if (!estimate) return 0;
+
+    WaitForSingleObject(mutexNavdata, INFINITE);
+    ekf.getEstimate(estimate);
+    ReleaseMutex(mutexNavdata);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::resetEstimate()
+// Reset the EKF. The current position becomes the origin.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::resetEstimate(void)
+{
+    WaitForSingleObject(mutexNavdata, INFINITE);
+    ekf.reset();
+    ReleaseMutex(mutexNavdata);
+}
\ No newline at end of file
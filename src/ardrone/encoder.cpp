@@ -0,0 +1,252 @@
+#include "ardrone.h"
+
+// Prefixes of AT commands (Indexed by ATCMD_ID)
+#define ATCMD_PREFIX(str, urgent) { str, sizeof(str) - 1, urgent }
+static const struct {
+    const char *str;    // Prefix
+    int        length;  // Length of the prefix
+    int        urgent;  // Should be sent right away
+} ATCMD_PREFIXES[ATCMD_NUM] = {
+    ATCMD_PREFIX("AT*REF=",        1),
+    ATCMD_PREFIX("AT*PCMD=",       0),
+    ATCMD_PREFIX("AT*FTRIM=",      0),
+    ATCMD_PREFIX("AT*CONFIG=",     0),
+    ATCMD_PREFIX("AT*CONFIG_IDS=", 0),
+    ATCMD_PREFIX("AT*COMWDG=",     0),
+    ATCMD_PREFIX("AT*LED=",        0),
+    ATCMD_PREFIX("AT*ANIM=",       0),
+    ATCMD_PREFIX("AT*CTRL=",       0),
+    ATCMD_PREFIX("AT*PMODE=",      0),
+    ATCMD_PREFIX("AT*MISC=",       0),
+};
+
+// Two digits of 0 to 99
+static const char ATCMD_DIGITS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// --------------------------------------------------------------------------
+// ATEncoder::ATEncoder(Output buffer, Size of the buffer)
+// Constructor of ATEncoder class. This will be called when you create it.
+// --------------------------------------------------------------------------
+ATEncoder::ATEncoder(char *buf, int size)
+{
+    this->buf = buf;
+    capacity  = size;
+    length    = 0;
+    overflow  = 0;
+    flag      = 0;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::put(Bytes, Number of bytes)
+// Append the bytes. The encoder is marked as overflowed when they do not fit.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ATEncoder::put(const char *str, int n)
+{
+    if (length + n > capacity) {
+        overflow = 1;
+        return;
+    }
+    memcpy(buf + length, str, n);
+    length += n;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::command(Command ID)
+// Begin a command. The sequence number is left as ATCMD_SEQ_MARKER.
+// Return value The encoder
+// --------------------------------------------------------------------------
+ATEncoder& ATEncoder::command(int id)
+{
+    if (id < 0 || id >= ATCMD_NUM) {
+        overflow = 1;
+        return *this;
+    }
+
+    const char marker = ATCMD_SEQ_MARKER;
+    put(ATCMD_PREFIXES[id].str, ATCMD_PREFIXES[id].length);
+    put(&marker, 1);
+    flag |= ATCMD_PREFIXES[id].urgent;
+
+    return *this;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::arg(Integer argument)
+// Append ",<value>".
+// Return value The encoder
+// --------------------------------------------------------------------------
+ATEncoder& ATEncoder::arg(int value)
+{
+    char str[12];
+    str[0] = ',';
+    put(str, 1 + formatInt(str + 1, value));
+    return *this;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::arg(Float argument)
+// Append the IEEE 754 bits of the value as a signed integer.
+// Return value The encoder
+// --------------------------------------------------------------------------
+ATEncoder& ATEncoder::arg(float value)
+{
+    int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return arg(bits);
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::arg(String argument)
+// Append ",\"<str>\"". A string with a control character (ATCMD_SEQ_MARKER
+// would become a sequence number) or a quote is rejected.
+// Return value The encoder
+// --------------------------------------------------------------------------
+ATEncoder& ATEncoder::arg(const char *str)
+{
+    if (!checkString(str, 1)) return *this;
+    put(",\"", 2);
+    put(str, (int)strlen(str));
+    put("\"", 1);
+    return *this;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::raw(String)
+// Append the string as it is. Control characters are rejected like arg().
+// Return value The encoder
+// --------------------------------------------------------------------------
+ATEncoder& ATEncoder::raw(const char *str)
+{
+    if (!checkString(str, 0)) return *this;
+    put(str, (int)strlen(str));
+    return *this;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::checkString(String, Reject quotes or not)
+// Check the string has no control character (and no quote). The encoder is
+// marked as failed when it has.
+// Return value VALID: 1  INVALID: 0
+// --------------------------------------------------------------------------
+int ATEncoder::checkString(const char *str, int quote)
+{
+    for (const unsigned char *p = (const unsigned char*)str; *p; p++) {
+        if (*p < 0x20 || (quote && *p == '"')) {
+            printf("ERROR: Invalid character 0x%02X in an AT command. (%s, %d)\n", *p, __FILE__, __LINE__);
+            overflow = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::end()
+// Terminate the command.
+// Return value The encoder
+// --------------------------------------------------------------------------
+ATEncoder& ATEncoder::end(void)
+{
+    put("\r", 1);
+    return *this;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::data()
+// Obtaining the encoded commands (Not null-terminated).
+// Return value Pointer to the commands
+// --------------------------------------------------------------------------
+const char* ATEncoder::data(void) const
+{
+    return buf;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::size()
+// Obtaining the size of the encoded commands.
+// Return value SUCCESS: Size of the commands  FAILED: 0 (Overflowed)
+// --------------------------------------------------------------------------
+int ATEncoder::size(void) const
+{
+    return overflow ? 0 : length;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::urgent()
+// Check the commands contain AT*REF or not.
+// Return value YES: 1  NO: 0
+// --------------------------------------------------------------------------
+int ATEncoder::urgent(void) const
+{
+    return flag;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::formatInt(Output buffer (>= 11 bytes), Value)
+// Same as sprintf("%d") but two digits at a time. Not null-terminated.
+// Return value Number of characters
+// --------------------------------------------------------------------------
+int ATEncoder::formatInt(char *dst, int value)
+{
+    char tmp[12];
+    char *p = tmp + sizeof(tmp);
+    int n = 0;
+
+    // Absolute value (INT_MIN is fine in unsigned)
+    unsigned int u = (value < 0) ? 0u - (unsigned int)value : (unsigned int)value;
+
+    // Two digits at a time from the lowest
+    while (u >= 100) {
+        const unsigned int i = (u % 100) * 2;
+        u /= 100;
+        *--p = ATCMD_DIGITS[i + 1];
+        *--p = ATCMD_DIGITS[i];
+    }
+    if (u >= 10) {
+        *--p = ATCMD_DIGITS[u * 2 + 1];
+        *--p = ATCMD_DIGITS[u * 2];
+    }
+    else *--p = (char)('0' + u);
+
+    // Sign
+    if (value < 0) dst[n++] = '-';
+
+    // Copy
+    const int digits = (int)(tmp + sizeof(tmp) - p);
+    memcpy(dst + n, p, digits);
+
+    return n + digits;
+}
+
+// --------------------------------------------------------------------------
+// ATEncoder::expand(Output buffer, Size of the buffer, Commands, Size of the commands, Sequence number)
+// Replace each ATCMD_SEQ_MARKER with the sequence number, which is incremented.
+// Return value SUCCESS: Size of the output  FAILED: 0
+// --------------------------------------------------------------------------
+int ATEncoder::expand(char *dst, int size, const char *src, int n, int *seq)
+{
+    const char *end = src + n;
+    int length = 0;
+
+    while (src < end) {
+        // Copy up to the next marker
+        const char *marker = (const char*)memchr(src, ATCMD_SEQ_MARKER, end - src);
+        const int run = (int)((marker ? marker : end) - src);
+        if (length + run + (marker ? 11 : 0) > size) return 0;
+        memcpy(dst + length, src, run);
+        length += run;
+        src    += run;
+
+        // Replace the marker with the sequence number
+        if (marker) {
+            length += formatInt(dst + length, (*seq)++);
+            src++;
+        }
+    }
+
+    return length;
+}
\ No newline at end of file
@@ -0,0 +1,470 @@
+#include "ardrone.h"
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::ARDroneFleet(Number of decode threads)
+// Constructor of ARDroneFleet class. This will be called when you create it.
+// --------------------------------------------------------------------------
+ARDroneFleet::ARDroneFleet(int threads)
+{
+    // One thread for each processor
+    if (threads < 1) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        threads = (int)info.dwNumberOfProcessors;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > ARDRONE_FLEET_THREADS) threads = ARDRONE_FLEET_THREADS;
+
+    // Clear the drones
+    for (int i = 0; i < ARDRONE_FLEET_DRONES; i++) {
+        ZeroMemory(&slots[i], sizeof(SLOT));
+    }
+
+    // Create a mutex and a semaphore
+    mutex     = CreateMutex(NULL, FALSE, NULL);
+    semaphore = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+
+    // Statistics
+    start = ardGetTickCount();
+
+    // Enable thread loop
+    flag = 1;
+
+    // Create the threads
+    numWorkers = 0;
+    for (int i = 0; i < threads; i++) {
+        WORKER *worker = &workers[numWorkers];
+        worker->fleet = this;
+        worker->index = numWorkers;
+        worker->mutex = CreateMutex(NULL, FALSE, NULL);
+
+        UINT id;
+        worker->thread = (HANDLE)_beginthreadex(NULL, 0, run, worker, 0, &id);
+        if (worker->thread == INVALID_HANDLE_VALUE || worker->thread == 0) {
+            printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
+            CloseHandle(worker->mutex);
+            break;
+        }
+        numWorkers++;
+    }
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::~ARDroneFleet()
+// Destructor of ARDroneFleet class. This will be called when you destroy it.
+// Close the drones before this.
+// --------------------------------------------------------------------------
+ARDroneFleet::~ARDroneFleet()
+{
+    // Disable the loop and wake up all the threads
+    flag = 0;
+    ReleaseSemaphore(semaphore, numWorkers, NULL);
+
+    // Destroy the threads
+    for (int i = 0; i < numWorkers; i++) {
+        WaitForSingleObject(workers[i].thread, INFINITE);
+        CloseHandle(workers[i].thread);
+        CloseHandle(workers[i].mutex);
+    }
+
+    // Release the drones
+    for (int i = 0; i < ARDRONE_FLEET_DRONES; i++) {
+        if (slots[i].ardrone) slots[i].ardrone->fleet = NULL;
+    }
+
+    // Delete the mutex and the semaphore
+    CloseHandle(semaphore);
+    CloseHandle(mutex);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::add(Pointer to ARDrone, Priority)
+// Add a drone, so its video is decoded by the fleet. Call this before
+// ARDrone::open(). A larger priority is decoded first.
+// Return value SUCCESS: Index  FAILED: -1
+// --------------------------------------------------------------------------
+int ARDroneFleet::add(ARDrone *ardrone, int priority)
+{
+    if (!ardrone || !numWorkers) return -1;
+
+    // The video is running
+    if (ardrone->flagVideo) {
+        printf("ERROR: The AR.Drone is already opened. (%s, %d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    // In another fleet
+    if (ardrone->fleet && ardrone->fleet != this) ardrone->fleet->remove(ardrone);
+
+    WaitForSingleObject(mutex, INFINITE);
+
+    // Already added
+    int index = find(ardrone);
+    if (index >= 0) {
+        slots[index].priority = priority;
+        ReleaseMutex(mutex);
+        return index;
+    }
+
+    // Find an empty slot
+    for (int i = 0; i < ARDRONE_FLEET_DRONES; i++) {
+        if (!slots[i].ardrone) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) {
+        ReleaseMutex(mutex);
+        printf("ERROR: The fleet is full. (%s, %d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    // Register it (The drones are spread over the threads)
+    SLOT *slot = &slots[index];
+    ZeroMemory(slot, sizeof(SLOT));
+    slot->ardrone  = ardrone;
+    slot->priority = priority;
+    slot->home     = index % numWorkers;
+    slot->dropped  = ardrone->droppedVideo;
+    ardrone->fleet      = this;
+    ardrone->fleetIndex = index;
+
+    ReleaseMutex(mutex);
+
+    return index;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::remove(Pointer to ARDrone)
+// Remove a drone. Call this after ARDrone::close().
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneFleet::remove(ARDrone *ardrone)
+{
+    if (!ardrone) return;
+
+    WaitForSingleObject(mutex, INFINITE);
+    const int index = find(ardrone);
+    ReleaseMutex(mutex);
+    if (index < 0) return;
+
+    // The video is running
+    if (ardrone->flagVideo) {
+        printf("ERROR: Close the AR.Drone before removing it. (%s, %d)\n", __FILE__, __LINE__);
+        return;
+    }
+
+    // Wait for the last decode
+    wait(index);
+
+    // Unregister it
+    WaitForSingleObject(mutex, INFINITE);
+    slots[index].ardrone = NULL;
+    ardrone->fleet      = NULL;
+    ardrone->fleetIndex = -1;
+    ReleaseMutex(mutex);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::setPriority(Pointer to ARDrone, Priority)
+// Change the priority of a drone. A larger one is decoded first.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDroneFleet::setPriority(ARDrone *ardrone, int priority)
+{
+    WaitForSingleObject(mutex, INFINITE);
+    const int index = find(ardrone);
+    if (index >= 0) slots[index].priority = priority;
+    ReleaseMutex(mutex);
+
+    return (index >= 0);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::size()
+// Obtaining the number of the drones.
+// Return value Number of the drones
+// --------------------------------------------------------------------------
+int ARDroneFleet::size(void)
+{
+    int n = 0;
+
+    WaitForSingleObject(mutex, INFINITE);
+    for (int i = 0; i < ARDRONE_FLEET_DRONES; i++) {
+        if (slots[i].ardrone) n++;
+    }
+    ReleaseMutex(mutex);
+
+    return n;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::get(Index)
+// Obtaining the drone of the index returned by add().
+// Return value Pointer to ARDrone (NULL: Unused)
+// --------------------------------------------------------------------------
+ARDrone* ARDroneFleet::get(int index)
+{
+    if (index < 0 || index >= ARDRONE_FLEET_DRONES) return NULL;
+
+    WaitForSingleObject(mutex, INFINITE);
+    ARDrone *ardrone = slots[index].ardrone;
+    ReleaseMutex(mutex);
+
+    return ardrone;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::getThreads()
+// Obtaining the number of the decode threads.
+// Return value Number of the threads
+// --------------------------------------------------------------------------
+int ARDroneFleet::getThreads(void)
+{
+    return numWorkers;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::getStats(Pointer to ARDrone, Statistics)
+// Obtaining the decode statistics of a drone since resetStats().
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDroneFleet::getStats(ARDrone *ardrone, FLEET_STATS *stats)
+{
+    if (!stats) return 0;
+    ZeroMemory(stats, sizeof(FLEET_STATS));
+
+    WaitForSingleObject(mutex, INFINITE);
+    const int index = find(ardrone);
+    if (index >= 0) sumStats(index, ardGetTickCount(), stats);
+    ReleaseMutex(mutex);
+    if (index < 0) return 0;
+
+    // Averages
+    if (stats->frames) {
+        stats->latency /= stats->frames;
+        stats->wait    /= stats->frames;
+        stats->decode  /= stats->frames;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::getTotalStats(Statistics)
+// Obtaining the decode statistics of all the drones since resetStats().
+// The frames, drops and fps are summed, and the times are averaged per frame.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDroneFleet::getTotalStats(FLEET_STATS *stats)
+{
+    if (!stats) return 0;
+    ZeroMemory(stats, sizeof(FLEET_STATS));
+
+    WaitForSingleObject(mutex, INFINITE);
+    const double now = ardGetTickCount();
+    for (int i = 0; i < ARDRONE_FLEET_DRONES; i++) {
+        if (slots[i].ardrone) sumStats(i, now, stats);
+    }
+    ReleaseMutex(mutex);
+
+    // Averages
+    if (stats->frames) {
+        stats->latency /= stats->frames;
+        stats->wait    /= stats->frames;
+        stats->decode  /= stats->frames;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::resetStats()
+// Clear the statistics of all the drones.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneFleet::resetStats(void)
+{
+    WaitForSingleObject(mutex, INFINITE);
+    for (int i = 0; i < ARDRONE_FLEET_DRONES; i++) {
+        SLOT *slot = &slots[i];
+        if (!slot->ardrone) continue;
+        slot->frames     = 0;
+        slot->dropped    = slot->ardrone->droppedVideo;
+        slot->latency    = slot->maxLatency = 0.0;
+        slot->wait       = slot->decode     = 0.0;
+    }
+    start = ardGetTickCount();
+    ReleaseMutex(mutex);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::find(Pointer to ARDrone)
+// Look for the slot of a drone. Call this with the mutex.
+// Return value SUCCESS: Index  FAILED: -1
+// --------------------------------------------------------------------------
+int ARDroneFleet::find(ARDrone *ardrone)
+{
+    if (!ardrone) return -1;
+
+    for (int i = 0; i < ARDRONE_FLEET_DRONES; i++) {
+        if (slots[i].ardrone == ardrone) return i;
+    }
+
+    return -1;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::sumStats(Index, Current time, Statistics)
+// Add the totals of a slot to the statistics. Call this with the mutex.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneFleet::sumStats(int index, double now, FLEET_STATS *stats)
+{
+    const SLOT *slot = &slots[index];
+    const double elapsed = now - start;
+
+    stats->frames  += slot->frames;
+    stats->dropped += (unsigned int)(slot->ardrone->droppedVideo - slot->dropped);
+    if (elapsed > 0.0) stats->fps += slot->frames * 1000.0 / elapsed;
+    stats->latency += slot->latency;
+    stats->wait    += slot->wait;
+    stats->decode  += slot->decode;
+    if (slot->maxLatency > stats->maxLatency) stats->maxLatency = slot->maxLatency;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::schedule(Index)
+// Called by ARDrone when a frame is ready to be decoded. A drone being
+// decoded is queued again when it finishes, so only one frame of each drone
+// is decoded at a time.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneFleet::schedule(int index)
+{
+    SLOT *slot = &slots[index];
+
+    // Remember it for the running decode
+    InterlockedExchange(&slot->pending, 1);
+
+    // Queued or being decoded
+    if (InterlockedCompareExchange(&slot->active, 1, 0) != 0) return;
+
+    enqueue(index);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::enqueue(Index)
+// Put an active slot on the queue of its thread and wake up a thread.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneFleet::enqueue(int index)
+{
+    SLOT *slot = &slots[index];
+    WORKER *worker = &workers[slot->home];
+
+    // Add it to the end (The others with the same priority go first)
+    WaitForSingleObject(worker->mutex, INFINITE);
+    slot->queued = ardGetTickCount();
+    worker->queue.push_back(index);
+    ReleaseMutex(worker->mutex);
+
+    // Wake up a thread
+    ReleaseSemaphore(semaphore, 1, NULL);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::wait(Index)
+// Wait until the drone is neither queued nor being decoded, and nothing is
+// scheduled for it. Stop calling schedule() before this.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneFleet::wait(int index)
+{
+    if (index < 0 || index >= ARDRONE_FLEET_DRONES) return;
+    while (slots[index].active || slots[index].pending) Sleep(1);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::take(Index of the thread)
+// Take the slot with the highest priority from the queue of the thread, or
+// steal one from the others when it is empty.
+// Return value SUCCESS: Index of the slot  FAILED: -1
+// --------------------------------------------------------------------------
+int ARDroneFleet::take(int worker)
+{
+    for (int i = 0; i < numWorkers; i++) {
+        WORKER *victim = &workers[(worker + i) % numWorkers];
+
+        WaitForSingleObject(victim->mutex, INFINITE);
+
+        // The oldest one of the highest priority
+        int best = -1;
+        for (int j = 0; j < (int)victim->queue.size(); j++) {
+            if (best < 0 || slots[victim->queue[j]].priority > slots[victim->queue[best]].priority) best = j;
+        }
+
+        // Take it
+        if (best >= 0) {
+            const int index = victim->queue[best];
+            victim->queue.erase(victim->queue.begin() + best);
+            ReleaseMutex(victim->mutex);
+            return index;
+        }
+
+        ReleaseMutex(victim->mutex);
+    }
+
+    return -1;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneFleet::loop(Index of the thread)
+// Thread function.
+// Return value 0
+// --------------------------------------------------------------------------
+UINT ARDroneFleet::loop(int worker)
+{
+    while (1) {
+        // Wait for a drone
+        WaitForSingleObject(semaphore, INFINITE);
+        if (!flag) break;
+
+        // Take one
+        const int index = take(worker);
+        if (index < 0) continue;
+        SLOT *slot = &slots[index];
+
+        // Decode a frame
+        const double begin = ardGetTickCount();
+        InterlockedExchange(&slot->pending, 0);
+        RECEIVE_TIMESTAMP timestamp;
+        int more = 0;
+        const int decoded = slot->ardrone->decodeQueued(&timestamp, &more);
+        const double end = ardGetTickCount();
+
+        // Statistics
+        if (decoded) {
+            WaitForSingleObject(mutex, INFINITE);
+            const double latency = timestamp.ready - timestamp.receive;
+            slot->frames++;
+            slot->latency += latency;
+            slot->wait    += begin - slot->queued;
+            slot->decode  += end - begin;
+            if (latency > slot->maxLatency) slot->maxLatency = latency;
+            ReleaseMutex(mutex);
+        }
+
+        // Queue it again when there is more (It stays active)
+        if (more) {
+            enqueue(index);
+            continue;
+        }
+
+        // Scheduled while decoding
+        InterlockedExchange(&slot->active, 0);
+        if (slot->pending && InterlockedCompareExchange(&slot->active, 1, 0) == 0) enqueue(index);
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -7,48 +7,54 @@
 // --------------------------------------------------------------------------
 int ARDrone::initNavdata(void)
 {
+    char buf[ATCMD_ENTRY_SIZE];
+
     // Open the socket
-    if (!sockNavdata.open(ip, ARDRONE_NAVDATA_PORT)) {
-        printf("ERROR: UDPSocket::open(port=%d) failed. (%s, %d)\n", ARDRONE_NAVDATA_PORT, __FILE__, __LINE__);
+    if (!openSocket(&sockNavdata, ports.navdata, local.navdata)) {
+        printf("ERROR: ARDrone::openSocket(port=%d) failed. (%s, %d)\n", ports.navdata, __FILE__, __LINE__);
         return 0;
     }
 
+    // Stamp the packets
+    sockNavdata.setTimestamp(1);
+
     // Clear Navdata
     ZeroMemory(&navdata, sizeof(NAVDATA));
+    ZeroMemory(&timeNavdata, sizeof(RECEIVE_TIMESTAMP));
+    timeNavdata.frame = -1;
+    ekf.reset();
 
     // Start Navdata
     sockNavdata.sendf("\x01\x00\x00\x00");
 
-    // AR.Drone 2.0
-    if (version.major == ARDRONE_VERSION_2) {
-       // Disable BOOTSTRAP mode
-        sockCommand.sendf("AT*CONFIG_IDS=%d,\"%s\",\"%s\",\"%s\"\r", seq++, ARDRONE_SESSION_ID, ARDRONE_PROFILE_ID, ARDRONE_APPLOCATION_ID);
-        sockCommand.sendf("AT*CONFIG=%d,\"general:navdata_demo\",\"TRUE\"\r", seq++);
-        Sleep(100);
+    // Disable BOOTSTRAP mode (The version is not known yet, so the IDs are sent for AR.Drone 1.0 too)
+    ATEncoder encoder(buf, sizeof(buf));
+    encoder.command(ATCMD_CONFIG_IDS).arg(ARDRONE_SESSION_ID).arg(ARDRONE_PROFILE_ID).arg(ARDRONE_APPLOCATION_ID).end();
+    encoder.command(ATCMD_CONFIG).arg("general:navdata_demo").arg("TRUE").end();
+    sendCommand(encoder, 1);
 
-        // Seed ACK
-        sockCommand.sendf("AT*CTRL=%d,0\r", seq++);
-    }
-    // AR.Drone 1.0
-    else {
-       // Disable BOOTSTRAP mode
-        sockCommand.sendf("AT*CONFIG=%d,\"general:navdata_demo\",\"TRUE\"\r", seq++);
-
-        // Send ACK
-        sockCommand.sendf("AT*CTRL=%d,0\r", seq++);
-    }
+    // Seed ACK
+    sendCommand(ATEncoder(buf, sizeof(buf)).command(ATCMD_CTRL).arg(0).end(), 1);
 
     // Create a mutex
     mutexNavdata= CreateMutex(NULL, FALSE, NULL);
 
-    // Enable thread loop
+    // Create an event to notify new Navdata
+    eventNavdata = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    // Enable Navdata
     flagNavdata = 1;
 
-    // Create a thread
-    UINT id;
-    threadNavdata = (HANDLE)_beginthreadex(NULL, 0, runNavdata, this, 0, &id);
-    if (threadNavdata == INVALID_HANDLE_VALUE) {
-        printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
+    // Register to the reactor (The timer repeats the request)
+    if (!Reactor::shared()->add(sockNavdata.getSocket(), onNavdata, this, ARDRONE_KEEPALIVE_INTERVAL)) {
+        printf("ERROR: Reactor::add() failed. (%s, %d)\n", __FILE__, __LINE__);
+        flagNavdata = 0;
+        return 0;
+    }
+
+    // Wait for the first Navdata
+    if (!waitState(0, 0, ARDRONE_NAVDATA_TIMEOUT)) {
+        printf("ERROR: No Navdata. (%s, %d)\n", __FILE__, __LINE__);
         return 0;
     }
 
@@ -56,22 +62,18 @@ int ARDrone::initNavdata(void)
 }
 
 // --------------------------------------------------------------------------
-// ARDrone::loopNavdata()
-// Thread function.
-// Return value 0
+// ARDrone::onNavdata(Pointer to ARDrone, Readable or not)
+// Handler of the reactor.
+// Return value NONE
 // --------------------------------------------------------------------------
-UINT ARDrone::loopNavdata(void)
+void ARDrone::onNavdata(void *arg, int readable)
 {
-    while (flagNavdata) {
-        // Get Navdata
-        if (!getNavdata()) break;
-        Sleep(30);
-    }
-
-    // Disable thread loop
-    flagNavdata = 0;
+    ARDrone *ardrone = reinterpret_cast<ARDrone*>(arg);
 
-    return 0;
+    // Receive Navdata
+    if (readable) ardrone->getNavdata();
+    // Request again
+    else ardrone->sockNavdata.sendf("\x01\x00\x00\x00");
 }
 
 // --------------------------------------------------------------------------
@@ -81,22 +83,96 @@ UINT ARDrone::loopNavdata(void)
 // --------------------------------------------------------------------------
 int ARDrone::getNavdata(void)
 {
-    // Send a request
-    sockNavdata.sendf("\x01\x00\x00\x00");
+    // When the socket became readable
+    const double arrival = Reactor::shared()->getWakeTime();
+
+    // Receive all the queued packets in batches (Full Navdata is sent at 200Hz)
+    int num;
+    do {
+        num = sockNavdata.receiveBatch(&batchNavdata);
+        if (num < 1) break;
+        unsigned int prev_state[ARDRONE_UDP_BATCH];
+        NAVDATA received[ARDRONE_UDP_BATCH];
+        int accepted[ARDRONE_UDP_BATCH];
+        int valid = 0;
+
+        // Update Navdata (One lock for the batch)
+        WaitForSingleObject(mutexNavdata, INFINITE);
+        for (int i = 0; i < num && i < ARDRONE_UDP_BATCH; i++) {
+            const int *buf = (const int*)batchNavdata.data(i);
+            const int size = batchNavdata.size(i);
+            const double tick = batchNavdata.timestamp(i);
+
+            // Check header
+            prev_state[i] = navdata.ardrone_state;
+            accepted[i] = (size >= 4 && buf[0] == ARDRONE_NAVDATA_HEADER);
+            if (!accepted[i]) continue;
+
+            // Packets of BOOTSTRAP mode only have the header (The rest is cleared, not left from the last one)
+            const int copy = (size < (int)sizeof(NAVDATA)) ? size : (int)sizeof(NAVDATA);
+            ZeroMemory(&received[i], sizeof(NAVDATA));
+            memcpy(&received[i], buf, copy);
+            navdata = received[i];
+            valid++;
+
+            // Update the estimate
+            if (size >= (int)sizeof(NAVDATA)) ekf.update(&navdata, tick);
 
-    // Receive data
-    int buf[512];
-    int size = sockNavdata.receive((void*)&buf, sizeof(buf));
-
-    // Received something
-    if (size > 0) {
-        // Check header
-        if (buf[0] == ARDRONE_NAVDATA_HEADER) {
-            // Update Navdata
-            WaitForSingleObject(mutexNavdata, INFINITE);
-            memcpy(&navdata, buf, sizeof(NAVDATA));
-            ReleaseMutex(mutexNavdata);
+            // Record the raw packet
+            if (recorder) recorder->write(buf, size, tick);
+
+            // Timestamps
+            timeNavdata.arrival = arrival;
+            timeNavdata.receive = tick;
+            timeNavdata.ready   = ardGetTickCount();
+        }
+        ReleaseMutex(mutexNavdata);
+
+        // Call the callbacks
+        for (int i = 0; i < num && i < ARDRONE_UDP_BATCH; i++) {
+            if (accepted[i]) invokeCallbacks(&received[i], prev_state[i]);
         }
+
+        // Notify the waiting thread
+        if (valid) SetEvent(eventNavdata);
+    } while (num == batchNavdata.capacity());  // Fewer means nothing is left
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::getNavdataTimestamp(Timestamps)
+// Obtaining when the latest Navdata arrived, was read and was processed.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::getNavdataTimestamp(RECEIVE_TIMESTAMP *timestamp)
+{
+    if (!timestamp || mutexNavdata == INVALID_HANDLE_VALUE) return 0;
+
+    WaitForSingleObject(mutexNavdata, INFINITE);
+    *timestamp = timeNavdata;
+    ReleaseMutex(mutexNavdata);
+
+    return (timestamp->receive > 0.0);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::waitState(State mask, Expected value, Timeout [ms])
+// Wait until (ardrone_state & mask) == value. When mask is 0, this only
+// waits for the first Navdata.
+// Return value SUCCESS: 1  FAILED: 0 (Timeout)
+// --------------------------------------------------------------------------
+int ARDrone::waitState(unsigned int mask, unsigned int value, double timeout)
+{
+    const double deadline = ardGetTickCount() + timeout;
+
+    while (navdata.header != ARDRONE_NAVDATA_HEADER || (navdata.ardrone_state & mask) != value) {
+        // Timeout
+        const double remain = deadline - ardGetTickCount();
+        if (remain <= 0.0 || !flagNavdata) return 0;
+
+        // Wait for the next Navdata (Short slices, in case another thread took the event)
+        WaitForSingleObject(eventNavdata, remain < 10.0 ? (DWORD)remain + 1 : 10);
     }
 
     return 1;
@@ -176,6 +252,159 @@ int ARDrone::onGround(void)
     return 1;
 }
 
+// --------------------------------------------------------------------------
+// ARDrone::addNavdataCallback(Callback function, User argument)
+// Register a callback called on every Navdata packet.
+// Return value SUCCESS: Callback ID  FAILED: -1
+// --------------------------------------------------------------------------
+int ARDrone::addNavdataCallback(ARDRONE_NAVDATA_CALLBACK func, void *arg)
+{
+    return addCallback(ARDRONE_CALLBACK_EVERY, 0, NULL, func, arg);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::addStateCallback(State mask, Callback function, User argument)
+// Register a callback called when any bit of the mask changes.
+// ex) addStateCallback(ARDRONE_EMERGENCY_MASK|ARDRONE_COM_LOST_MASK, func);
+// Return value SUCCESS: Callback ID  FAILED: -1
+// --------------------------------------------------------------------------
+int ARDrone::addStateCallback(unsigned int mask, ARDRONE_NAVDATA_CALLBACK func, void *arg)
+{
+    if (!mask) return -1;
+    return addCallback(ARDRONE_CALLBACK_STATE, mask, NULL, func, arg);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::addThresholdCallback(Predicate, Callback function, User argument)
+// Register a callback called when the predicate turns from FALSE to TRUE.
+// The predicate is evaluated on every Navdata packet, so keep it short.
+// Return value SUCCESS: Callback ID  FAILED: -1
+// --------------------------------------------------------------------------
+int ARDrone::addThresholdCallback(ARDRONE_NAVDATA_PREDICATE pred, ARDRONE_NAVDATA_CALLBACK func, void *arg)
+{
+    if (!pred) return -1;
+    return addCallback(ARDRONE_CALLBACK_THRESHOLD, 0, pred, func, arg);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::addCallback(Type, State mask, Predicate, Callback function, User argument)
+// Register a Navdata callback.
+// Return value SUCCESS: Callback ID  FAILED: -1
+// --------------------------------------------------------------------------
+int ARDrone::addCallback(ARDRONE_CALLBACK_TYPE type, unsigned int mask, ARDRONE_NAVDATA_PREDICATE pred, ARDRONE_NAVDATA_CALLBACK func, void *arg)
+{
+    // No function
+    if (!func) return -1;
+
+    // Find an empty slot
+    int id = -1;
+    WaitForSingleObject(mutexCallback, INFINITE);
+    for (int i = 0; i < ARDRONE_MAX_CALLBACKS; i++) {
+        if (callbacks[i].type == ARDRONE_CALLBACK_UNUSED) {
+            ZeroMemory(&callbacks[i], sizeof(NAVDATA_CALLBACK));
+            callbacks[i].type = type;
+            callbacks[i].mask = mask;
+            callbacks[i].pred = pred;
+            callbacks[i].func = func;
+            callbacks[i].arg  = arg;
+            id = i;
+            break;
+        }
+    }
+    ReleaseMutex(mutexCallback);
+
+    // No slot
+    if (id < 0) printf("ERROR: Too many Navdata callbacks. (%s, %d)\n", __FILE__, __LINE__);
+
+    return id;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::removeCallback(Callback ID)
+// Unregister the Navdata callback.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::removeCallback(int id)
+{
+    if (id < 0 || id >= ARDRONE_MAX_CALLBACKS) return;
+
+    // It will not be called after this function returns
+    WaitForSingleObject(mutexCallback, INFINITE);
+    callbacks[id].type = ARDRONE_CALLBACK_UNUSED;
+    ReleaseMutex(mutexCallback);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::getCallbackStats(Callback ID, Statistics)
+// Obtaining timing counters of the Navdata callback.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::getCallbackStats(int id, CALLBACK_STATS *stats)
+{
+    if (id < 0 || id >= ARDRONE_MAX_CALLBACKS || !stats) return 0;
+
+    WaitForSingleObject(mutexCallback, INFINITE);
+    int type = callbacks[id].type;
+    *stats = callbacks[id].stats;
+    ReleaseMutex(mutexCallback);
+
+    return (type != ARDRONE_CALLBACK_UNUSED);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::invokeCallbacks(Current Navdata, Previous state)
+// Call the registered callbacks. This runs on the reactor thread.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::invokeCallbacks(const NAVDATA *current, unsigned int prev_state)
+{
+    const unsigned int changed = current->ardrone_state ^ prev_state;
+
+    WaitForSingleObject(mutexCallback, INFINITE);
+    for (int i = 0; i < ARDRONE_MAX_CALLBACKS; i++) {
+        NAVDATA_CALLBACK *cb = &callbacks[i];
+
+        // Check the condition
+        int fire = 0;
+        switch (cb->type) {
+            // Every packet
+            case ARDRONE_CALLBACK_EVERY:
+                fire = 1;
+                break;
+
+            // State transition
+            case ARDRONE_CALLBACK_STATE:
+                fire = ((changed & cb->mask) != 0);
+                break;
+
+            // Threshold (Rising edge only)
+            case ARDRONE_CALLBACK_THRESHOLD: {
+                int state = cb->pred(current, cb->arg);
+                fire = (state && !cb->state);
+                cb->state = state;
+                break;
+            }
+
+            // Unused
+            default:
+                break;
+        }
+        if (!fire) continue;
+
+        // Call it with timing
+        double start = ardGetTickCount();
+        cb->func(this, current, cb->arg);
+        double elapsed = ardGetTickCount() - start;
+
+        // Update the counters
+        cb->stats.calls++;
+        cb->stats.total += elapsed;
+        if (elapsed > cb->stats.max) cb->stats.max = elapsed;
+        if (elapsed > ARDRONE_CALLBACK_BUDGET) cb->stats.overruns++;
+    }
+    ReleaseMutex(mutexCallback);
+}
+
 // --------------------------------------------------------------------------
 // ARDrone::finalizeNavdata()
 // Finalize Navdata.
@@ -183,22 +412,22 @@ int ARDrone::onGround(void)
 // --------------------------------------------------------------------------
 void ARDrone::finalizeNavdata(void)
 {
-    // Disable the loop
+    // Unregister from the reactor
+    if (flagNavdata) Reactor::shared()->remove(sockNavdata.getSocket());
     flagNavdata = 0;
 
-    // Destroy teh thread
-    if (threadNavdata != INVALID_HANDLE_VALUE) {
-        WaitForSingleObject(threadNavdata, INFINITE);
-        CloseHandle(threadNavdata);
-        threadNavdata = INVALID_HANDLE_VALUE;
-    }
-
     // Delete the mutex
     if (mutexNavdata != INVALID_HANDLE_VALUE) {
         CloseHandle(mutexNavdata);
         mutexNavdata = INVALID_HANDLE_VALUE;
     }
 
+    // Delete the event
+    if (eventNavdata != INVALID_HANDLE_VALUE) {
+        CloseHandle(eventNavdata);
+        eventNavdata = INVALID_HANDLE_VALUE;
+    }
+
     // Close the socket
     sockNavdata.close();
 }
\ No newline at end of file
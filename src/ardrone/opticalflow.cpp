@@ -0,0 +1,231 @@
+#include "ardrone.h"
+
+// --------------------------------------------------------------------------
+// OpticalFlowTracker::OpticalFlowTracker(Maximum number of points, Columns of the grid, Rows of the grid)
+// Constructor of OpticalFlowTracker class. This will be called when you create it.
+// --------------------------------------------------------------------------
+OpticalFlowTracker::OpticalFlowTracker(int maxPoints, int gridX, int gridY)
+{
+    // Settings
+    this->maxPoints = (maxPoints > 0) ? maxPoints : 1;
+    this->gridX     = (gridX > 0) ? gridX : 1;
+    this->gridY     = (gridY > 0) ? gridY : 1;
+
+    // Points
+    count        = 0;
+    tracked      = 0;
+    pyramidReady = 0;
+
+    // Buffers (Allocated by the first frame)
+    gray        = prevGray    = NULL;
+    pyramid     = prevPyramid = NULL;
+    eig = tmp = mask = NULL;
+    prevPoints = currPoints = nextPoints = NULL;
+    status = NULL;
+}
+
+// --------------------------------------------------------------------------
+// OpticalFlowTracker::~OpticalFlowTracker()
+// Destructor of OpticalFlowTracker class. This will be called when you destroy it.
+// --------------------------------------------------------------------------
+OpticalFlowTracker::~OpticalFlowTracker()
+{
+    release();
+}
+
+// --------------------------------------------------------------------------
+// OpticalFlowTracker::update(Camera image)
+// Track the points on a new frame, and detect new ones when too few are left.
+// Return value Number of the points
+// --------------------------------------------------------------------------
+int OpticalFlowTracker::update(const IplImage *image)
+{
+    if (!image) return 0;
+
+    // Allocate the buffers for the size
+    CvSize size = cvGetSize(image);
+    if (!gray || gray->width != size.width || gray->height != size.height) {
+        if (!allocate(size)) return 0;
+    }
+
+    // Convert the camera image to grayscale
+    if (image->nChannels == 1) cvCopy(image, gray);
+    else                       cvCvtColor(image, gray, CV_BGR2GRAY);
+
+    // Track the points of the previous frame
+    tracked = 0;
+    if (count > 0) {
+        CvTermCriteria criteria = cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 20, 0.3);
+        cvCalcOpticalFlowPyrLK(prevGray, gray, prevPyramid, pyramid, currPoints, nextPoints, count, cvSize(FLOW_WINDOW_SIZE, FLOW_WINDOW_SIZE), FLOW_PYRAMID_LEVEL, status, NULL, criteria, pyramidReady ? CV_LKFLOW_PYR_A_READY : 0);
+
+        // Keep the ones tracked inside the image
+        for (int i = 0; i < count; i++) {
+            if (!status[i]) continue;
+            if (nextPoints[i].x < 0.0f || nextPoints[i].x >= size.width)  continue;
+            if (nextPoints[i].y < 0.0f || nextPoints[i].y >= size.height) continue;
+            prevPoints[tracked] = currPoints[i];
+            currPoints[tracked] = nextPoints[i];
+            tracked++;
+        }
+        count = tracked;
+
+        // The pyramid of this frame is the previous one of the next frame
+        IplImage *swap = prevPyramid;
+        prevPyramid  = pyramid;
+        pyramid      = swap;
+        pyramidReady = 1;
+    }
+    else pyramidReady = 0;
+
+    // Too few points
+    if (count < (maxPoints + 1) / 2) detect();
+
+    // This frame is the previous one of the next frame
+    IplImage *swap = prevGray;
+    prevGray = gray;
+    gray     = swap;
+
+    return count;
+}
+
+// --------------------------------------------------------------------------
+// OpticalFlowTracker::getPoints(Points in the previous frame, Points in the current frame)
+// Obtaining the points of the last update(). The tracked ones come first,
+// and the new ones have the same positions in both.
+// Return value Number of the points
+// --------------------------------------------------------------------------
+int OpticalFlowTracker::getPoints(const CvPoint2D32f **prev, const CvPoint2D32f **curr)
+{
+    if (prev) *prev = prevPoints;
+    if (curr) *curr = currPoints;
+    return count;
+}
+
+// --------------------------------------------------------------------------
+// OpticalFlowTracker::getTracked()
+// Obtaining the number of the points tracked from the previous frame.
+// Return value Number of the points
+// --------------------------------------------------------------------------
+int OpticalFlowTracker::getTracked(void)
+{
+    return tracked;
+}
+
+// --------------------------------------------------------------------------
+// OpticalFlowTracker::draw(Image)
+// Draw the points and the flows of the last update().
+// Return value NONE
+// --------------------------------------------------------------------------
+void OpticalFlowTracker::draw(IplImage *image)
+{
+    if (!image) return;
+
+    for (int i = 0; i < count; i++) {
+        cvCircle(image, cvPointFrom32f(currPoints[i]), 1, CV_RGB(255, 0, 0));
+        if (i < tracked) cvLine(image, cvPointFrom32f(prevPoints[i]), cvPointFrom32f(currPoints[i]), CV_RGB(0, 0, 255), 1, CV_AA, 0);
+    }
+}
+
+// --------------------------------------------------------------------------
+// OpticalFlowTracker::reset()
+// Forget the points. They are detected again on the next frame.
+// Return value NONE
+// --------------------------------------------------------------------------
+void OpticalFlowTracker::reset(void)
+{
+    count        = 0;
+    tracked      = 0;
+    pyramidReady = 0;
+}
+
+// --------------------------------------------------------------------------
+// OpticalFlowTracker::allocate(Image size)
+// Allocate the buffers for the image size.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int OpticalFlowTracker::allocate(CvSize size)
+{
+    // Release the old ones
+    release();
+
+    // Images (The pyramids need (width + 8) * height / 3 bytes)
+    gray        = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    prevGray    = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    pyramid     = cvCreateImage(cvSize(size.width + 8, size.height / 3), IPL_DEPTH_8U, 1);
+    prevPyramid = cvCreateImage(cvSize(size.width + 8, size.height / 3), IPL_DEPTH_8U, 1);
+    eig         = cvCreateImage(size, IPL_DEPTH_32F, 1);
+    tmp         = cvCreateImage(size, IPL_DEPTH_32F, 1);
+    mask        = cvCreateImage(size, IPL_DEPTH_8U, 1);
+
+    // Points
+    prevPoints = new CvPoint2D32f[maxPoints];
+    currPoints = new CvPoint2D32f[maxPoints];
+    nextPoints = new CvPoint2D32f[maxPoints];
+    status     = new char[maxPoints];
+
+    if (!gray || !prevGray || !pyramid || !prevPyramid || !eig || !tmp || !mask) {
+        printf("ERROR: cvCreateImage() failed. (%s, %d)\n", __FILE__, __LINE__);
+        release();
+        return 0;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// OpticalFlowTracker::release()
+// Release the buffers.
+// Return value NONE
+// --------------------------------------------------------------------------
+void OpticalFlowTracker::release(void)
+{
+    // Images
+    if (gray)        cvReleaseImage(&gray);
+    if (prevGray)    cvReleaseImage(&prevGray);
+    if (pyramid)     cvReleaseImage(&pyramid);
+    if (prevPyramid) cvReleaseImage(&prevPyramid);
+    if (eig)         cvReleaseImage(&eig);
+    if (tmp)         cvReleaseImage(&tmp);
+    if (mask)        cvReleaseImage(&mask);
+
+    // Points
+    delete [] prevPoints;
+    delete [] currPoints;
+    delete [] nextPoints;
+    delete [] status;
+    prevPoints = currPoints = nextPoints = NULL;
+    status = NULL;
+
+    // Forget them
+    reset();
+}
+
+// --------------------------------------------------------------------------
+// OpticalFlowTracker::detect()
+// Detect new features in the cells of the grid where no point is left.
+// Return value NONE
+// --------------------------------------------------------------------------
+void OpticalFlowTracker::detect(void)
+{
+    if (count >= maxPoints) return;
+
+    // Size of a cell
+    const int w = (gray->width  + gridX - 1) / gridX;
+    const int h = (gray->height + gridY - 1) / gridY;
+
+    // Mask the cells having points
+    cvSet(mask, cvScalarAll(255));
+    for (int i = 0; i < count; i++) {
+        const int x = (int)currPoints[i].x / w * w;
+        const int y = (int)currPoints[i].y / h * h;
+        cvRectangle(mask, cvPoint(x, y), cvPoint(x + w - 1, y + h - 1), cvScalarAll(0), CV_FILLED);
+    }
+
+    // Detect features in the others
+    int n = maxPoints - count;
+    cvGoodFeaturesToTrack(gray, eig, tmp, currPoints + count, &n, 0.1, 5.0, mask);
+
+    // They have not moved yet
+    for (int i = count; i < count + n; i++) prevPoints[i] = currPoints[i];
+    count += n;
+}
\ No newline at end of file
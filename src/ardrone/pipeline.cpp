@@ -0,0 +1,609 @@
+#include "ardrone.h"
+
+// --------------------------------------------------------------------------
+// FrameQueue::FrameQueue(Number of the entries)
+// Constructor of FrameQueue class. This will be called when you create it.
+// --------------------------------------------------------------------------
+FrameQueue::FrameQueue(int size)
+{
+    // Power of 2
+    capacity = 1;
+    while (capacity < size) capacity <<= 1;
+
+    // Entry i is free for the i-th push
+    entries = new ENTRY[capacity];
+    for (int i = 0; i < capacity; i++) {
+        entries[i].sequence = i;
+        entries[i].frame    = NULL;
+    }
+    head = tail = 0;
+    count = 0;
+
+    // Create the semaphores
+    items  = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+    spaces = CreateSemaphore(NULL, capacity, 0x7fffffff, NULL);
+    closed = 0;
+}
+
+// --------------------------------------------------------------------------
+// FrameQueue::~FrameQueue()
+// Destructor of FrameQueue class. This will be called when you destroy it.
+// --------------------------------------------------------------------------
+FrameQueue::~FrameQueue()
+{
+    CloseHandle(items);
+    CloseHandle(spaces);
+    delete [] entries;
+}
+
+// --------------------------------------------------------------------------
+// FrameQueue::push(Frame, Timeout [ms])
+// Add a frame. When the queue is full, this waits for a free entry.
+// Return value SUCCESS: 1  FAILED: 0 (Timeout or closed)
+// --------------------------------------------------------------------------
+int FrameQueue::push(PIPELINE_FRAME *frame, DWORD timeout)
+{
+    // Wait for a free entry
+    if (closed || WaitForSingleObject(spaces, timeout) != WAIT_OBJECT_0) return 0;
+    if (closed) return 0;
+
+    // Claim an entry
+    LONG pos;
+    ENTRY *entry;
+    while (1) {
+        pos = tail;
+        entry = &entries[pos & (capacity - 1)];
+        LONG diff = (LONG)((ULONG)entry->sequence - (ULONG)pos);
+
+        // Free, try to move the tail
+        if (diff == 0) {
+            if (InterlockedCompareExchange(&tail, pos + 1, pos) == pos) break;
+        }
+        // A consumer is still reading it
+        else if (diff < 0) Sleep(0);
+    }
+
+    // Write the frame
+    entry->frame = frame;
+
+    // Publish to the consumers
+    InterlockedExchange(&entry->sequence, pos + 1);
+    InterlockedIncrement(&count);
+    ReleaseSemaphore(items, 1, NULL);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// FrameQueue::pop(Timeout [ms])
+// Remove the oldest frame. When the queue is empty, this waits for a frame.
+// Return value SUCCESS: Frame  FAILED: NULL (Timeout or closed)
+// --------------------------------------------------------------------------
+PIPELINE_FRAME* FrameQueue::pop(DWORD timeout)
+{
+    // Wait for a frame
+    if (closed || WaitForSingleObject(items, timeout) != WAIT_OBJECT_0) return NULL;
+    if (closed) return NULL;
+
+    // Claim an entry
+    LONG pos;
+    ENTRY *entry;
+    while (1) {
+        pos = head;
+        entry = &entries[pos & (capacity - 1)];
+        LONG diff = (LONG)((ULONG)entry->sequence - (ULONG)(pos + 1));
+
+        // Published, try to move the head
+        if (diff == 0) {
+            if (InterlockedCompareExchange(&head, pos + 1, pos) == pos) break;
+        }
+        // A producer is still writing it
+        else if (diff < 0) Sleep(0);
+    }
+
+    // Read the frame
+    PIPELINE_FRAME *frame = entry->frame;
+
+    // Give the entry back to the producers
+    InterlockedExchange(&entry->sequence, pos + capacity);
+    InterlockedDecrement(&count);
+    ReleaseSemaphore(spaces, 1, NULL);
+
+    return frame;
+}
+
+// --------------------------------------------------------------------------
+// FrameQueue::size()
+// Obtaining the number of the frames.
+// Return value Number of the frames
+// --------------------------------------------------------------------------
+int FrameQueue::size(void)
+{
+    return (int)count;
+}
+
+// --------------------------------------------------------------------------
+// FrameQueue::close()
+// Wake up all the threads waiting in push() or pop(). They fail after this.
+// Return value NONE
+// --------------------------------------------------------------------------
+void FrameQueue::close(void)
+{
+    closed = 1;
+    ReleaseSemaphore(items,  PIPELINE_THREADS + 2, NULL);
+    ReleaseSemaphore(spaces, PIPELINE_THREADS + 2, NULL);
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::FramePipeline()
+// Constructor of FramePipeline class. This will be called when you create it.
+// --------------------------------------------------------------------------
+FramePipeline::FramePipeline()
+{
+    // Frames (The images are allocated by the stages)
+    ZeroMemory(frames, sizeof(frames));
+
+    // Queues (Created by start())
+    pool = NULL;
+    for (int i = 0; i <= PIPELINE_STAGES; i++) queues[i] = NULL;
+
+    // Stages
+    ZeroMemory(stages, sizeof(stages));
+    numStages = 0;
+    source    = NULL;
+    sourceArg = NULL;
+
+    // Threads
+    ZeroMemory(workers, sizeof(workers));
+    for (int i = 0; i <= PIPELINE_THREADS; i++) workers[i].thread = INVALID_HANDLE_VALUE;
+    numWorkers = 0;
+    number     = 0;
+    flag       = 0;
+    start_tick = ardGetTickCount();
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::~FramePipeline()
+// Destructor of FramePipeline class. This will be called when you destroy it.
+// --------------------------------------------------------------------------
+FramePipeline::~FramePipeline()
+{
+    stop();
+
+    // Release the images
+    for (int i = 0; i < PIPELINE_FRAMES; i++) {
+        if (frames[i].image) cvReleaseImage(&frames[i].image);
+        if (frames[i].gray)  cvReleaseImage(&frames[i].gray);
+    }
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::setSource(Function, Argument)
+// Set the function making the frames. It is called on its own thread, and
+// should fill frame->image (See prepare()). Without a source, feed the images
+// with push(). Call this before start().
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int FramePipeline::setSource(PIPELINE_SOURCE func, void *arg)
+{
+    // Running
+    if (flag) {
+        printf("ERROR: The pipeline is running. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    source    = func;
+    sourceArg = arg;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::addStage(Function, Argument, Number of the threads, Name, Size of the input queue)
+// Add a stage after the last one. Call this before start(). A stage with
+// several threads processes the frames at the same time, so it may reorder them.
+// Return value SUCCESS: Index  FAILED: -1
+// --------------------------------------------------------------------------
+int FramePipeline::addStage(PIPELINE_STAGE func, void *arg, int threads, const char *name, int queueSize)
+{
+    // Running
+    if (flag) {
+        printf("ERROR: The pipeline is running. (%s, %d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    // Too many stages or threads
+    if (threads < 1) threads = 1;
+    int total = threads;
+    for (int i = 0; i < numStages; i++) total += stages[i].threads;
+    if (!func || numStages >= PIPELINE_STAGES || total > PIPELINE_THREADS) {
+        printf("ERROR: Invalid stage. (%s, %d)\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    // Add it
+    STAGE *stage = &stages[numStages];
+    stage->func      = func;
+    stage->arg       = arg;
+    stage->threads   = threads;
+    stage->queueSize = (queueSize > 0) ? queueSize : PIPELINE_QUEUE_SIZE;
+    stage->maxDepth  = 0;
+    if (name) _snprintf_s(stage->name, sizeof(stage->name), _TRUNCATE, "%s", name);
+    else      _snprintf_s(stage->name, sizeof(stage->name), _TRUNCATE, "stage%d", numStages);
+
+    return numStages++;
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::start()
+// Create the queues and start the threads of the source and the stages.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int FramePipeline::start(void)
+{
+    // Already running
+    if (flag) return 1;
+
+    // No stage
+    if (numStages < 1) {
+        printf("ERROR: No stage. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // All the frames are free
+    pool = new FrameQueue(PIPELINE_FRAMES);
+    for (int i = 0; i < PIPELINE_FRAMES; i++) {
+        frames[i].refs = 0;
+        pool->push(&frames[i], 0);
+    }
+
+    // Inputs of the stages and the output
+    for (int i = 0; i < numStages; i++) queues[i] = new FrameQueue(stages[i].queueSize);
+    queues[numStages] = new FrameQueue(PIPELINE_QUEUE_SIZE);
+
+    // Statistics
+    number = 0;
+    resetStats();
+
+    // Enable thread loop
+    flag = 1;
+
+    // Create the threads of the stages
+    numWorkers = 0;
+    for (int i = 0; i < numStages; i++) {
+        for (int j = 0; j < stages[i].threads; j++) {
+            WORKER *worker = &workers[numWorkers];
+            worker->pipeline = this;
+            worker->stage    = i;
+
+            UINT id;
+            worker->thread = (HANDLE)_beginthreadex(NULL, 0, run, worker, 0, &id);
+            if (worker->thread == INVALID_HANDLE_VALUE || worker->thread == 0) {
+                printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
+                worker->thread = INVALID_HANDLE_VALUE;
+                stop();
+                return 0;
+            }
+            numWorkers++;
+        }
+    }
+
+    // Create the thread of the source
+    WORKER *worker = &workers[PIPELINE_THREADS];
+    worker->pipeline = this;
+    worker->stage    = -1;
+    if (source) {
+        UINT id;
+        worker->thread = (HANDLE)_beginthreadex(NULL, 0, run, worker, 0, &id);
+        if (worker->thread == INVALID_HANDLE_VALUE || worker->thread == 0) {
+            printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
+            worker->thread = INVALID_HANDLE_VALUE;
+            stop();
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::stop()
+// Stop the threads and delete the queues. The frames which are not released
+// are dropped.
+// Return value NONE
+// --------------------------------------------------------------------------
+void FramePipeline::stop(void)
+{
+    // Not running
+    if (!pool) return;
+
+    // Disable the loop and wake up all the threads
+    flag = 0;
+    pool->close();
+    for (int i = 0; i <= numStages; i++) queues[i]->close();
+
+    // Destroy the threads
+    for (int i = 0; i <= PIPELINE_THREADS; i++) {
+        if (workers[i].thread != INVALID_HANDLE_VALUE) {
+            WaitForSingleObject(workers[i].thread, INFINITE);
+            CloseHandle(workers[i].thread);
+            workers[i].thread = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    // Delete the queues
+    for (int i = 0; i <= numStages; i++) {
+        delete queues[i];
+        queues[i] = NULL;
+    }
+    delete pool;
+    pool = NULL;
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::push(Image, Timeout [ms])
+// Copy an image into a free frame and send it to the first stage. Use this
+// instead of a source. Only one thread may call this.
+// Return value SUCCESS: 1  FAILED: 0 (No free frame in time, or not running)
+// --------------------------------------------------------------------------
+int FramePipeline::push(const IplImage *image, DWORD timeout)
+{
+    if (!flag || !image) return 0;
+    WORKER *worker = &workers[PIPELINE_THREADS];
+
+    // Get a free frame
+    PIPELINE_FRAME *frame = acquire(timeout);
+    if (!frame) {
+        worker->dropped++;
+        return 0;
+    }
+
+    // Copy the image
+    const double tick = ardGetTickCount();
+    cvCopy(image, prepare(&frame->image, cvGetSize(image), image->nChannels));
+    frame->number = (unsigned int)InterlockedIncrement(&number) - 1;
+    frame->tick   = tick;
+    worker->frames++;
+    worker->busy += ardGetTickCount() - tick;
+
+    // To the first stage
+    forward(worker, 0, frame);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::pop(Timeout [ms])
+// Obtaining a frame which passed all the stages, oldest first. Only the latest
+// frames are kept, so the stages never wait for this. Release the frame when
+// it is no longer used.
+// Return value SUCCESS: Frame  FAILED: NULL (Timeout or not running)
+// --------------------------------------------------------------------------
+PIPELINE_FRAME* FramePipeline::pop(DWORD timeout)
+{
+    if (!flag) return NULL;
+    return queues[numStages]->pop(timeout);
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::release(Frame)
+// Release a reference of a frame. The last one gives it back to the pool.
+// Return value NONE
+// --------------------------------------------------------------------------
+void FramePipeline::release(PIPELINE_FRAME *frame)
+{
+    if (!frame || !pool) return;
+    if (InterlockedDecrement(&frame->refs) == 0) pool->push(frame, 0);
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::addRef(Frame)
+// Add a reference of a frame, so a stage can keep it after passing it on.
+// Release it with release().
+// Return value NONE
+// --------------------------------------------------------------------------
+void FramePipeline::addRef(PIPELINE_FRAME *frame)
+{
+    if (frame) InterlockedIncrement(&frame->refs);
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::prepare(Pointer to an image of a frame, Size, Number of channels)
+// Allocate the image unless it has the size and the channels. Frames are
+// reused, so this allocates only when the size changes.
+// Return value Image
+// --------------------------------------------------------------------------
+IplImage* FramePipeline::prepare(IplImage **image, CvSize size, int channels)
+{
+    if (*image && (*image)->width == size.width && (*image)->height == size.height && (*image)->nChannels == channels) return *image;
+    if (*image) cvReleaseImage(image);
+    *image = cvCreateImage(size, IPL_DEPTH_8U, channels);
+    return *image;
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::getStages()
+// Obtaining the number of the stages.
+// Return value Number of the stages
+// --------------------------------------------------------------------------
+int FramePipeline::getStages(void)
+{
+    return numStages;
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::getName(Index of the stage)
+// Obtaining the name of a stage (-1: Source).
+// Return value Name
+// --------------------------------------------------------------------------
+const char* FramePipeline::getName(int stage)
+{
+    if (stage < 0) return "source";
+    if (stage >= numStages) return "";
+    return stages[stage].name;
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::getStats(Index of the stage, Statistics)
+// Obtaining the statistics of a stage (-1: Source) since resetStats().
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int FramePipeline::getStats(int stage, PIPELINE_STATS *stats)
+{
+    if (!stats || stage < -1 || stage >= numStages) return 0;
+    ZeroMemory(stats, sizeof(PIPELINE_STATS));
+
+    // Sum the threads of the stage
+    const double elapsed = ardGetTickCount() - start_tick;
+    for (int i = 0; i <= PIPELINE_THREADS; i++) {
+        if (i >= numWorkers && i < PIPELINE_THREADS) continue;
+        const WORKER *worker = &workers[i];
+        if (worker->stage != stage) continue;
+        stats->frames  += worker->frames;
+        stats->dropped += worker->dropped;
+        stats->busy    += worker->busy;
+        stats->latency += worker->latency;
+    }
+
+    // Averages
+    if (elapsed > 0.0) stats->fps = stats->frames * 1000.0 / elapsed;
+    if (stats->frames) {
+        stats->busy    /= stats->frames;
+        stats->latency /= stats->frames;
+    }
+
+    // Input queue
+    if (stage >= 0) {
+        if (flag) stats->depth = queues[stage]->size();
+        stats->maxDepth = (int)stages[stage].maxDepth;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::resetStats()
+// Clear the statistics.
+// Return value NONE
+// --------------------------------------------------------------------------
+void FramePipeline::resetStats(void)
+{
+    for (int i = 0; i <= PIPELINE_THREADS; i++) {
+        workers[i].frames  = 0;
+        workers[i].dropped = 0;
+        workers[i].busy    = 0.0;
+        workers[i].latency = 0.0;
+    }
+    for (int i = 0; i < numStages; i++) stages[i].maxDepth = 0;
+    start_tick = ardGetTickCount();
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::acquire(Timeout [ms])
+// Get a free frame from the pool.
+// Return value SUCCESS: Frame  FAILED: NULL
+// --------------------------------------------------------------------------
+PIPELINE_FRAME* FramePipeline::acquire(DWORD timeout)
+{
+    PIPELINE_FRAME *frame = pool->pop(timeout);
+    if (!frame) return NULL;
+
+    // A new reference and no results
+    frame->refs = 1;
+    for (int i = 0; i < PIPELINE_STAGES; i++) frame->data[i] = NULL;
+
+    return frame;
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::forward(Thread, Index of the next stage, Frame)
+// Send a frame to the next stage. It waits while the stage is busy. The output
+// does not wait, but the oldest frame in it is dropped.
+// Return value NONE
+// --------------------------------------------------------------------------
+void FramePipeline::forward(WORKER *worker, int stage, PIPELINE_FRAME *frame)
+{
+    // To the next stage
+    if (stage < numStages) {
+        if (!queues[stage]->push(frame)) release(frame);
+        return;
+    }
+
+    // To the output
+    while (!queues[stage]->push(frame, 0)) {
+        // Stopped
+        if (!flag) {
+            release(frame);
+            return;
+        }
+
+        // Drop the oldest one
+        PIPELINE_FRAME *old = queues[stage]->pop(0);
+        if (old) {
+            release(old);
+            worker->dropped++;
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+// FramePipeline::loop(Thread)
+// Thread function. Makes frames (Source) or processes the frames of a stage.
+// Return value 0
+// --------------------------------------------------------------------------
+UINT FramePipeline::loop(WORKER *worker)
+{
+    while (flag) {
+        // Source
+        if (worker->stage < 0) {
+            // Wait for a free frame
+            PIPELINE_FRAME *frame = acquire(INFINITE);
+            if (!frame) break;
+
+            // Make a frame
+            const double start = ardGetTickCount();
+            const int result = source(sourceArg, frame);
+            if (result <= 0) {
+                release(frame);
+                if (result < 0) break;
+                continue;
+            }
+            frame->number = (unsigned int)InterlockedIncrement(&number) - 1;
+            frame->tick   = ardGetTickCount();
+            worker->frames++;
+            worker->busy += frame->tick - start;
+
+            // To the first stage
+            forward(worker, 0, frame);
+        }
+        // Stage
+        else {
+            STAGE *stage = &stages[worker->stage];
+
+            // Wait for a frame
+            PIPELINE_FRAME *frame = queues[worker->stage]->pop();
+            if (!frame) break;
+
+            // Depth of the queue including this one
+            const LONG depth = queues[worker->stage]->size() + 1;
+            if (depth > stage->maxDepth) stage->maxDepth = depth;
+
+            // Process it
+            const double start = ardGetTickCount();
+            const int result = stage->func(stage->arg, frame);
+            const double end = ardGetTickCount();
+            worker->frames++;
+            worker->busy    += end - start;
+            worker->latency += end - frame->tick;
+
+            // To the next stage
+            if (result) forward(worker, worker->stage + 1, frame);
+            else {
+                worker->dropped++;
+                release(frame);
+            }
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
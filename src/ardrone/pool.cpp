@@ -0,0 +1,144 @@
+#include "ardrone.h"
+
+// --------------------------------------------------------------------------
+// WorkerPool::WorkerPool(Number of threads)
+// Constructor of WorkerPool class. This will be called when you create it.
+// --------------------------------------------------------------------------
+WorkerPool::WorkerPool(int num)
+{
+    // Check the number
+    if (num < 1) num = 1;
+    if (num > ARDRONE_WORKER_THREADS) num = ARDRONE_WORKER_THREADS;
+
+    // Create a mutex and a semaphore
+    mutex     = CreateMutex(NULL, FALSE, NULL);
+    semaphore = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+
+    // Enable thread loop
+    flag = 1;
+
+    // Create the threads
+    this->num = 0;
+    for (int i = 0; i < num; i++) {
+        UINT id;
+        threads[this->num] = (HANDLE)_beginthreadex(NULL, 0, run, this, 0, &id);
+        if (threads[this->num] == INVALID_HANDLE_VALUE || threads[this->num] == 0) {
+            printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
+            break;
+        }
+        this->num++;
+    }
+}
+
+// --------------------------------------------------------------------------
+// WorkerPool::~WorkerPool()
+// Destructor of WorkerPool class. This will be called when you destroy it.
+// The queued tasks are finished before the threads exit.
+// --------------------------------------------------------------------------
+WorkerPool::~WorkerPool()
+{
+    // Disable the loop and wake up all the threads
+    WaitForSingleObject(mutex, INFINITE);
+    flag = 0;
+    ReleaseMutex(mutex);
+    ReleaseSemaphore(semaphore, num, NULL);
+
+    // Destroy the threads
+    for (int i = 0; i < num; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+
+    // Delete the mutex and the semaphore
+    CloseHandle(semaphore);
+    CloseHandle(mutex);
+}
+
+// --------------------------------------------------------------------------
+// WorkerPool::submit(Task function, Argument)
+// Queue a task. It runs on one of the threads.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int WorkerPool::submit(WORKER_TASK func, void *arg)
+{
+    if (!func || !num) return 0;
+
+    // Add the task
+    TASK task = {func, arg};
+    WaitForSingleObject(mutex, INFINITE);
+    tasks.push_back(task);
+    ReleaseMutex(mutex);
+
+    // Wake up a thread
+    ReleaseSemaphore(semaphore, 1, NULL);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// WorkerPool::loop()
+// Thread function.
+// Return value 0
+// --------------------------------------------------------------------------
+UINT WorkerPool::loop(void)
+{
+    while (1) {
+        // Wait for a task
+        WaitForSingleObject(semaphore, INFINITE);
+
+        // Take the oldest one
+        WaitForSingleObject(mutex, INFINITE);
+        if (tasks.empty()) {
+            const int exit = !flag;
+            ReleaseMutex(mutex);
+            if (exit) break;
+            continue;
+        }
+        TASK task = tasks.front();
+        tasks.pop_front();
+        ReleaseMutex(mutex);
+
+        // Run it
+        task.func(task.arg);
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// WorkerPool::shared()
+// Obtaining the pool shared by all the drones. It is created on first use
+// and lives until the process exits.
+// Return value Pointer to the pool
+// --------------------------------------------------------------------------
+WorkerPool* WorkerPool::shared(void)
+{
+    static WorkerPool *volatile pool = NULL;
+
+    // Create the pool (Only one thread wins)
+    if (!pool) {
+        WorkerPool *p = new WorkerPool();
+        if (InterlockedCompareExchangePointer((PVOID*)&pool, p, NULL) != NULL) delete p;
+    }
+
+    return pool;
+}
+
+// --------------------------------------------------------------------------
+// WorkerPool::decoder()
+// Obtaining the pool decoding the video of all the drones. It is created on
+// first use and lives until the process exits.
+// Return value Pointer to the pool
+// --------------------------------------------------------------------------
+WorkerPool* WorkerPool::decoder(void)
+{
+    static WorkerPool *volatile pool = NULL;
+
+    // Create the pool (Only one thread wins)
+    if (!pool) {
+        WorkerPool *p = new WorkerPool(ARDRONE_DECODE_THREADS);
+        if (InterlockedCompareExchangePointer((PVOID*)&pool, p, NULL) != NULL) delete p;
+    }
+
+    return pool;
+}
\ No newline at end of file
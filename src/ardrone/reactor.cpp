@@ -0,0 +1,346 @@
+#include "ardrone.h"
+
+// --------------------------------------------------------------------------
+// Reactor::Reactor()
+// Constructor of Reactor class. This will be called when you create it.
+// --------------------------------------------------------------------------
+Reactor::Reactor()
+{
+    // Initialize the entries
+    num = 0;
+    wake = 0.0;
+    thread = INVALID_HANDLE_VALUE;
+    threadId = 0;
+    running = INVALID_SOCKET;
+
+    // Keep WinSock initialized while the reactor lives (WSACleanup() of the last drone must not close the loopback socket)
+    WSAData wsaData;
+    wsa = (WSAStartup(MAKEWORD(1,1), &wsaData) == 0);
+
+    // Create a mutex
+    mutex = CreateMutex(NULL, FALSE, NULL);
+
+    // Create a loopback socket (A datagram to itself wakes up select())
+    wakeup = INVALID_SOCKET;
+    openWakeup();
+
+    // Enable thread loop
+    flag = 1;
+
+    // Create a thread
+    UINT id;
+    thread = (HANDLE)_beginthreadex(NULL, 0, run, this, 0, &id);
+    threadId = id;
+    if (thread == INVALID_HANDLE_VALUE || thread == 0) {
+        printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
+        thread = INVALID_HANDLE_VALUE;
+    }
+    // Navdata should not wait for the decoders
+    else SetThreadPriority(thread, THREAD_PRIORITY_ABOVE_NORMAL);
+}
+
+// --------------------------------------------------------------------------
+// Reactor::~Reactor()
+// Destructor of Reactor class. This will be called when you destroy it.
+// --------------------------------------------------------------------------
+Reactor::~Reactor()
+{
+    // Disable the loop
+    WaitForSingleObject(mutex, INFINITE);
+    flag = 0;
+    ReleaseMutex(mutex);
+    notify();
+
+    // Destroy the thread
+    if (thread != INVALID_HANDLE_VALUE) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        thread = INVALID_HANDLE_VALUE;
+    }
+
+    // Close the loopback socket
+    if (wakeup != INVALID_SOCKET) {
+        closesocket(wakeup);
+        wakeup = INVALID_SOCKET;
+    }
+
+    // Delete the mutex
+    CloseHandle(mutex);
+
+    // Finalize WSA
+    if (wsa) WSACleanup();
+}
+
+// --------------------------------------------------------------------------
+// Reactor::openWakeup()
+// Create the loopback socket. A datagram sent to itself wakes up select().
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int Reactor::openWakeup(void)
+{
+    // Create a socket
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET) {
+        printf("ERROR: socket() failed. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Bind to a free port of the loopback address
+    sockaddr_in addr;
+    int len = (int)sizeof(sockaddr_in);
+    memset(&addr, 0, sizeof(sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = 0;
+    addr.sin_addr.S_un.S_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (sockaddr*)&addr, sizeof(sockaddr_in)) == SOCKET_ERROR ||
+        getsockname(sock, (sockaddr*)&addr, &len) == SOCKET_ERROR) {
+        printf("ERROR: bind() failed. (%s, %d)\n", __FILE__, __LINE__);
+        closesocket(sock);
+        return 0;
+    }
+
+    // Set to the non-blocking mode
+    u_long nonblock = 1;
+    ioctlsocket(sock, FIONBIO, &nonblock);
+
+    wakeup_addr = addr;
+    wakeup = sock;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// Reactor::purge()
+// Find the sockets that were closed before remove() and drop them, so that
+// select() works again. A dead loopback socket is created again.
+// Return value Number of the dropped sockets
+// --------------------------------------------------------------------------
+int Reactor::purge(void)
+{
+    int dropped = 0;
+    int error, len;
+
+    // Registered sockets
+    WaitForSingleObject(mutex, INFINITE);
+    for (int i = 0; i < num; ) {
+        len = (int)sizeof(error);
+        if (getsockopt(entries[i].sock, SOL_SOCKET, SO_ERROR, (char*)&error, &len) == SOCKET_ERROR) {
+            printf("ERROR: Socket %d was closed before Reactor::remove(). (%s, %d)\n", (int)entries[i].sock, __FILE__, __LINE__);
+            entries[i] = entries[--num];
+            dropped++;
+        }
+        else i++;
+    }
+    ReleaseMutex(mutex);
+
+    // Loopback socket
+    len = (int)sizeof(error);
+    if (wakeup != INVALID_SOCKET && getsockopt(wakeup, SOL_SOCKET, SO_ERROR, (char*)&error, &len) == SOCKET_ERROR) {
+        closesocket(wakeup);
+        wakeup = INVALID_SOCKET;
+        dropped++;
+    }
+    if (wakeup == INVALID_SOCKET) openWakeup();
+
+    return dropped;
+}
+
+// --------------------------------------------------------------------------
+// Reactor::add(Socket, Handler, Argument, Interval of the timer [ms])
+// Register a socket. The handler is called when the socket becomes readable,
+// and also every interval when it is not 0.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int Reactor::add(SOCKET sock, REACTOR_HANDLER func, void *arg, int interval)
+{
+    if (sock == INVALID_SOCKET || !func || thread == INVALID_HANDLE_VALUE) return 0;
+
+    // Add the entry
+    WaitForSingleObject(mutex, INFINITE);
+    if (num >= ARDRONE_REACTOR_SOCKETS || num >= FD_SETSIZE - 1) {
+        ReleaseMutex(mutex);
+        printf("ERROR: Too many sockets. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+    ENTRY *entry = &entries[num++];
+    entry->sock     = sock;
+    entry->func     = func;
+    entry->arg      = arg;
+    entry->interval = (interval > 0) ? interval : 0;
+    entry->next     = ardGetTickCount() + entry->interval;
+    ReleaseMutex(mutex);
+
+    // Wait for the new socket too
+    notify();
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// Reactor::remove(Socket)
+// Unregister the socket. The handler is never called after this returns,
+// so the socket and the argument can be released safely.
+// Return value NONE
+// --------------------------------------------------------------------------
+void Reactor::remove(SOCKET sock)
+{
+    // Remove the entry
+    WaitForSingleObject(mutex, INFINITE);
+    for (int i = 0; i < num; i++) {
+        if (entries[i].sock == sock) {
+            entries[i] = entries[--num];
+            break;
+        }
+    }
+
+    // Wait for its handler running now (Handlers are short)
+    while (running == sock && GetCurrentThreadId() != threadId) {
+        ReleaseMutex(mutex);
+        Sleep(1);
+        WaitForSingleObject(mutex, INFINITE);
+    }
+    ReleaseMutex(mutex);
+
+    // Stop waiting for the socket
+    notify();
+}
+
+// --------------------------------------------------------------------------
+// Reactor::getWakeTime()
+// Obtaining the time select() returned. In a handler, this is when its
+// socket was found readable.
+// Return value Time [ms]
+// --------------------------------------------------------------------------
+double Reactor::getWakeTime(void)
+{
+    return wake;
+}
+
+// --------------------------------------------------------------------------
+// Reactor::notify()
+// Wake up select() of the thread.
+// Return value NONE
+// --------------------------------------------------------------------------
+void Reactor::notify(void)
+{
+    if (wakeup == INVALID_SOCKET) return;
+    char c = 0;
+    sendto(wakeup, &c, 1, 0, (sockaddr*)&wakeup_addr, sizeof(sockaddr_in));
+}
+
+// --------------------------------------------------------------------------
+// Reactor::loop()
+// Thread function.
+// Return value 0
+// --------------------------------------------------------------------------
+UINT Reactor::loop(void)
+{
+    while (1) {
+        fd_set fds;
+        FD_ZERO(&fds);
+
+        // Sockets to wait for and the nearest timer
+        WaitForSingleObject(mutex, INFINITE);
+        if (!flag) {
+            ReleaseMutex(mutex);
+            break;
+        }
+        const double now = ardGetTickCount();
+        double wait = -1.0;
+        int maxfd = (wakeup != INVALID_SOCKET) ? (int)wakeup : 0;
+        for (int i = 0; i < num; i++) {
+            FD_SET(entries[i].sock, &fds);
+            if ((int)entries[i].sock > maxfd) maxfd = (int)entries[i].sock;
+            if (entries[i].interval > 0) {
+                const double remain = entries[i].next - now;
+                if (wait < 0.0 || remain < wait) wait = (remain > 0.0) ? remain : 0.0;
+            }
+        }
+        ReleaseMutex(mutex);
+        if (wakeup != INVALID_SOCKET) FD_SET(wakeup, &fds);
+        // Without the loopback socket, new sockets are found by polling
+        else if (wait < 0.0 || wait > 10.0) wait = 10.0;
+
+        // Wait for any of them (No timeout when there is no timer)
+        const int ms = (int)ceil(wait);
+        timeval tv;
+        tv.tv_sec  = ms / 1000;
+        tv.tv_usec = (ms % 1000) * 1000;
+        int n = select(maxfd + 1, &fds, NULL, NULL, (wait < 0.0) ? NULL : &tv);
+
+        wake = ardGetTickCount();
+
+        // A socket was closed before remove(), drop it and try again
+        if (n == SOCKET_ERROR) {
+            if (!purge()) Sleep(10);
+            continue;
+        }
+
+        // Drain the loopback socket
+        if (wakeup != INVALID_SOCKET && FD_ISSET(wakeup, &fds)) {
+            char buf[16];
+            while (recv(wakeup, buf, sizeof(buf), 0) > 0);
+        }
+
+        // Handlers to call
+        WaitForSingleObject(mutex, INFINITE);
+        const double tick = wake;
+        int ready = 0;
+        for (int i = 0; i < num; i++) {
+            ENTRY *entry = &entries[i];
+            const int readable = (n > 0 && FD_ISSET(entry->sock, &fds)) ? 1 : 0;
+            const int expired  = (entry->interval > 0 && tick >= entry->next) ? 1 : 0;
+            if (expired) entry->next = tick + entry->interval;
+            if (!readable && !expired) continue;
+            fired[ready].sock     = entry->sock;
+            fired[ready].readable = readable;
+            fired[ready].expired  = expired;
+            ready++;
+        }
+        ReleaseMutex(mutex);
+
+        // Call them out of the lock, so remove() of the other sockets does not wait
+        for (int i = 0; i < ready; i++) {
+            // Removed in the meantime
+            WaitForSingleObject(mutex, INFINITE);
+            ENTRY entry;
+            int found = 0;
+            for (int j = 0; j < num; j++) {
+                if (entries[j].sock == fired[i].sock) {
+                    entry = entries[j];
+                    found = 1;
+                    break;
+                }
+            }
+            if (found) running = entry.sock;
+            ReleaseMutex(mutex);
+            if (!found) continue;
+
+            // Call the handler (remove() waits for it)
+            if (fired[i].readable) entry.func(entry.arg, 1);
+            if (fired[i].expired)  entry.func(entry.arg, 0);
+            running = INVALID_SOCKET;
+        }
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Reactor::shared()
+// Obtaining the reactor shared by all the drones. It is created on first use
+// and lives until the process exits.
+// Return value Pointer to the reactor
+// --------------------------------------------------------------------------
+Reactor* Reactor::shared(void)
+{
+    static Reactor *volatile reactor = NULL;
+
+    // Create the reactor (Only one thread wins)
+    if (!reactor) {
+        Reactor *r = new Reactor();
+        if (InterlockedCompareExchangePointer((PVOID*)&reactor, r, NULL) != NULL) delete r;
+    }
+
+    return reactor;
+}
\ No newline at end of file
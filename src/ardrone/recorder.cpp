@@ -0,0 +1,530 @@
+#include "ardrone.h"
+
+// --------------------------------------------------------------------------
+// FlightRecorder::FlightRecorder()
+// Constructor of FlightRecorder class. This will be called when you create it.
+// --------------------------------------------------------------------------
+FlightRecorder::FlightRecorder()
+{
+    // File
+    hFile    = INVALID_HANDLE_VALUE;
+    hMapping = NULL;
+    view     = NULL;
+
+    // Layout
+    chunk_size = FLIGHT_RECORDER_CHUNK_SIZE;
+    num_chunks = 0;
+    chunk      = 0;
+
+    // Counters
+    count   = 0;
+    dropped = 0;
+
+    // Thread for flushing
+    flagFlush   = 0;
+    threadFlush = INVALID_HANDLE_VALUE;
+    eventFlush  = INVALID_HANDLE_VALUE;
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorder::~FlightRecorder()
+// Destructor of FlightRecorder class. This will be called when you destroy it.
+// --------------------------------------------------------------------------
+FlightRecorder::~FlightRecorder()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorder::open(File name, Size of the file [MB])
+// Create and preallocate a recording file.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int FlightRecorder::open(const char *filename, int size_mb)
+{
+    // Already opened
+    if (view) close();
+
+    // Number of chunks
+    if (size_mb < 1) size_mb = 1;
+    num_chunks = (unsigned int)(((double)size_mb * 1024 * 1024 - sizeof(FLIGHT_RECORDER_HEADER)) / chunk_size);
+    const DWORD file_size = sizeof(FLIGHT_RECORDER_HEADER) + num_chunks * chunk_size;
+
+    // Create a file
+    hFile = CreateFile(filename, GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        printf("ERROR: CreateFile(%s) failed. (%s, %d)\n", filename, __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Preallocate
+    SetFilePointer(hFile, file_size, NULL, FILE_BEGIN);
+    if (!SetEndOfFile(hFile)) {
+        printf("ERROR: SetEndOfFile() failed. (%s, %d)\n", __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+
+    // Map the whole file
+    hMapping = CreateFileMapping(hFile, NULL, PAGE_READWRITE, 0, file_size, NULL);
+    if (hMapping == NULL) {
+        printf("ERROR: CreateFileMapping() failed. (%s, %d)\n", __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+    view = (unsigned char*)MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, file_size);
+    if (view == NULL) {
+        printf("ERROR: MapViewOfFile() failed. (%s, %d)\n", __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+
+    // Write the file header
+    FLIGHT_RECORDER_HEADER *header = (FLIGHT_RECORDER_HEADER*)view;
+    memcpy(header->magic, FLIGHT_RECORDER_MAGIC, sizeof(header->magic));
+    header->version    = 1;
+    header->chunk_size = chunk_size;
+    header->num_chunks = num_chunks;
+    header->closed     = 0;
+    GetSystemTimeAsFileTime(&header->start_time);
+    header->start_tick = ardGetTickCount();
+
+    // Reset counters
+    chunk   = 0;
+    count   = 0;
+    dropped = 0;
+
+    // Create an event
+    eventFlush = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (eventFlush == NULL) {
+        printf("ERROR: CreateEvent() failed. (%s, %d)\n", __FILE__, __LINE__);
+        eventFlush = INVALID_HANDLE_VALUE;
+        close();
+        return 0;
+    }
+
+    // Enable thread loop
+    flagFlush = 1;
+
+    // Create a thread
+    UINT id;
+    threadFlush = (HANDLE)_beginthreadex(NULL, 0, runFlush, this, 0, &id);
+    if (threadFlush == INVALID_HANDLE_VALUE || threadFlush == 0) {
+        printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
+        threadFlush = INVALID_HANDLE_VALUE;
+        close();
+        return 0;
+    }
+
+    // Disk I/O should not disturb the reactor thread
+    SetThreadPriority(threadFlush, THREAD_PRIORITY_BELOW_NORMAL);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorder::write(Raw Navdata, Size of data, Timestamp [ms])
+// Append a record. Only one thread may call this.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int FlightRecorder::write(const void *data, int size, double tick)
+{
+    // Not opened
+    if (!view) return 0;
+
+    // Size of the record (8-byte aligned)
+    const unsigned int record_size = (sizeof(FLIGHT_RECORDER_RECORD) + size + 7) & ~7u;
+    if (size <= 0 || record_size > chunk_size - sizeof(FLIGHT_RECORDER_CHUNK)) {
+        dropped++;
+        return 0;
+    }
+
+    // Current chunk
+    FLIGHT_RECORDER_CHUNK *header = (FLIGHT_RECORDER_CHUNK*)(view + sizeof(FLIGHT_RECORDER_HEADER) + chunk * chunk_size);
+
+    // Move to the next chunk if it's full
+    if (header->magic == FLIGHT_RECORDER_CHUNK_MAGIC && sizeof(FLIGHT_RECORDER_CHUNK) + header->used + record_size > chunk_size) {
+        // The file is full
+        if ((unsigned int)chunk + 1 >= num_chunks) {
+            dropped++;
+            return 0;
+        }
+
+        // Next chunk
+        InterlockedIncrement(&chunk);
+        header = (FLIGHT_RECORDER_CHUNK*)((unsigned char*)header + chunk_size);
+
+        // Wake up the flushing thread
+        SetEvent(eventFlush);
+    }
+
+    // Initialize the chunk
+    if (header->magic != FLIGHT_RECORDER_CHUNK_MAGIC) {
+        header->index      = chunk;
+        header->used       = 0;
+        header->count      = 0;
+        header->first_tick = tick;
+        header->last_tick  = tick;
+        header->magic      = FLIGHT_RECORDER_CHUNK_MAGIC;
+    }
+
+    // Write the record
+    FLIGHT_RECORDER_RECORD *record = (FLIGHT_RECORDER_RECORD*)((unsigned char*)header + sizeof(FLIGHT_RECORDER_CHUNK) + header->used);
+    record->size     = size;
+    record->reserved = 0;
+    record->tick     = tick;
+    memcpy((unsigned char*)record + sizeof(FLIGHT_RECORDER_RECORD), data, size);
+
+    // Commit the record after its contents
+    MemoryBarrier();
+    header->last_tick = tick;
+    header->used     += record_size;
+    header->count++;
+    count++;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorder::loopFlush()
+// Thread function. Flushes finished chunks and touches the next one.
+// Return value 0
+// --------------------------------------------------------------------------
+UINT FlightRecorder::loopFlush(void)
+{
+    // Page size
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const unsigned int page = info.dwPageSize;
+
+    LONG flushed = 0;
+    LONG touched = -1;
+    while (flagFlush) {
+        // Wait for a new chunk or 1 sec
+        WaitForSingleObject(eventFlush, 1000);
+        const LONG current = chunk;
+        unsigned char *base = view + sizeof(FLIGHT_RECORDER_HEADER);
+
+        // Touch the pages of the next chunk to avoid page faults on writing
+        if (current + 1 < (LONG)num_chunks && touched < current + 1) {
+            // (An atomic no-op, since the writer may have entered the chunk already)
+            unsigned char *next = base + (current + 1) * chunk_size;
+            for (unsigned int i = 0; i < chunk_size; i += page) InterlockedCompareExchange((volatile LONG*)(next + i), 0, 0);
+            touched = current + 1;
+        }
+
+        // Flush from the last flushed chunk to the current one
+        FlushViewOfFile(base + flushed * chunk_size, (current - flushed + 1) * chunk_size);
+        flushed = current;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorder::close()
+// Finalize the file. Unused chunks are cut off.
+// Return value NONE
+// --------------------------------------------------------------------------
+void FlightRecorder::close(void)
+{
+    // Disable the loop
+    flagFlush = 0;
+
+    // Destroy the thread
+    if (threadFlush != INVALID_HANDLE_VALUE) {
+        SetEvent(eventFlush);
+        WaitForSingleObject(threadFlush, INFINITE);
+        CloseHandle(threadFlush);
+        threadFlush = INVALID_HANDLE_VALUE;
+    }
+
+    // Delete the event
+    if (eventFlush != INVALID_HANDLE_VALUE) {
+        CloseHandle(eventFlush);
+        eventFlush = INVALID_HANDLE_VALUE;
+    }
+
+    // Used size of the file
+    DWORD file_size = 0;
+    if (view) {
+        // Mark as closed
+        FLIGHT_RECORDER_HEADER *header = (FLIGHT_RECORDER_HEADER*)view;
+        FLIGHT_RECORDER_CHUNK *last = (FLIGHT_RECORDER_CHUNK*)(view + sizeof(FLIGHT_RECORDER_HEADER) + chunk * chunk_size);
+        header->num_chunks = (last->magic == FLIGHT_RECORDER_CHUNK_MAGIC) ? chunk + 1 : chunk;
+        header->closed = 1;
+        file_size = sizeof(FLIGHT_RECORDER_HEADER) + header->num_chunks * chunk_size;
+
+        // Unmap the view
+        FlushViewOfFile(view, 0);
+        UnmapViewOfFile(view);
+        view = NULL;
+    }
+
+    // Close the mapping
+    if (hMapping) {
+        CloseHandle(hMapping);
+        hMapping = NULL;
+    }
+
+    // Close the file
+    if (hFile != INVALID_HANDLE_VALUE) {
+        // Cut off unused chunks
+        if (file_size) {
+            SetFilePointer(hFile, file_size, NULL, FILE_BEGIN);
+            SetEndOfFile(hFile);
+        }
+        CloseHandle(hFile);
+        hFile = INVALID_HANDLE_VALUE;
+    }
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorder::isOpen()
+// Check recording or not.
+// Return value YES:1 NO:0
+// --------------------------------------------------------------------------
+int FlightRecorder::isOpen(void)
+{
+    return (view != NULL);
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorder::getCount()
+// Obtaining the number of records.
+// Return value Number of records
+// --------------------------------------------------------------------------
+unsigned int FlightRecorder::getCount(void)
+{
+    return count;
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorder::getDropped()
+// Obtaining the number of dropped records.
+// Return value Number of dropped records
+// --------------------------------------------------------------------------
+unsigned int FlightRecorder::getDropped(void)
+{
+    return dropped;
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorderReader::FlightRecorderReader()
+// Constructor of FlightRecorderReader class. This will be called when you create it.
+// --------------------------------------------------------------------------
+FlightRecorderReader::FlightRecorderReader()
+{
+    hFile     = INVALID_HANDLE_VALUE;
+    hMapping  = NULL;
+    view      = NULL;
+    file_size = 0;
+    rewind();
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorderReader::~FlightRecorderReader()
+// Destructor of FlightRecorderReader class. This will be called when you destroy it.
+// --------------------------------------------------------------------------
+FlightRecorderReader::~FlightRecorderReader()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorderReader::open(File name)
+// Open a recorded file.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int FlightRecorderReader::open(const char *filename)
+{
+    // Already opened
+    if (view) close();
+
+    // Open the file
+    hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        printf("ERROR: CreateFile(%s) failed. (%s, %d)\n", filename, __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Check the size
+    file_size = GetFileSize(hFile, NULL);
+    if (file_size == INVALID_FILE_SIZE || file_size < sizeof(FLIGHT_RECORDER_HEADER)) {
+        printf("ERROR: %s is not a flight record. (%s, %d)\n", filename, __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+
+    // Map the file
+    hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMapping == NULL) {
+        printf("ERROR: CreateFileMapping() failed. (%s, %d)\n", __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+    view = (unsigned char*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL) {
+        printf("ERROR: MapViewOfFile() failed. (%s, %d)\n", __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+
+    // Check the header
+    FLIGHT_RECORDER_HEADER *header = getHeader();
+    if (memcmp(header->magic, FLIGHT_RECORDER_MAGIC, sizeof(header->magic)) || header->version != 1 || header->chunk_size <= sizeof(FLIGHT_RECORDER_CHUNK)) {
+        printf("ERROR: %s is not a flight record. (%s, %d)\n", filename, __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+
+    // Go to the first record
+    rewind();
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorderReader::read(Pointer to the raw Navdata, Timestamp [ms])
+// Get the next record. The pointer is valid until close().
+// Broken or uncommitted records of a crashed recording are skipped.
+// Return value SUCCESS: Size of data  END: 0
+// --------------------------------------------------------------------------
+int FlightRecorderReader::read(const void **data, double *tick)
+{
+    // Not opened
+    if (!view) return 0;
+
+    FLIGHT_RECORDER_HEADER *header = getHeader();
+    const unsigned int chunk_size = header->chunk_size;
+
+    while (1) {
+        // End of the file
+        const unsigned int chunk_offset = sizeof(FLIGHT_RECORDER_HEADER) + chunk * chunk_size;
+        if (chunk >= header->num_chunks || chunk_offset + chunk_size > file_size) return 0;
+
+        // Check the chunk
+        FLIGHT_RECORDER_CHUNK *c = (FLIGHT_RECORDER_CHUNK*)(view + chunk_offset);
+        if (c->magic != FLIGHT_RECORDER_CHUNK_MAGIC || c->index != chunk) return 0;
+        if (c->used > chunk_size - sizeof(FLIGHT_RECORDER_CHUNK)) return 0;
+
+        // Records in this chunk
+        if (record < c->count && offset + sizeof(FLIGHT_RECORDER_RECORD) <= c->used) {
+            FLIGHT_RECORDER_RECORD *r = (FLIGHT_RECORDER_RECORD*)((unsigned char*)c + sizeof(FLIGHT_RECORDER_CHUNK) + offset);
+            const unsigned int record_size = (sizeof(FLIGHT_RECORDER_RECORD) + r->size + 7) & ~7u;
+            if (r->size > 0 && offset + record_size <= c->used) {
+                if (data) *data = (unsigned char*)r + sizeof(FLIGHT_RECORDER_RECORD);
+                if (tick) *tick = r->tick;
+                offset += record_size;
+                record++;
+                return r->size;
+            }
+        }
+
+        // Next chunk
+        chunk++;
+        record = 0;
+        offset = 0;
+    }
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorderReader::rewind()
+// Go back to the first record.
+// Return value NONE
+// --------------------------------------------------------------------------
+void FlightRecorderReader::rewind(void)
+{
+    chunk  = 0;
+    record = 0;
+    offset = 0;
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorderReader::getHeader()
+// Obtaining the file header.
+// Return value File header (NULL if not opened)
+// --------------------------------------------------------------------------
+FLIGHT_RECORDER_HEADER* FlightRecorderReader::getHeader(void)
+{
+    return (FLIGHT_RECORDER_HEADER*)view;
+}
+
+// --------------------------------------------------------------------------
+// FlightRecorderReader::close()
+// Close the file.
+// Return value NONE
+// --------------------------------------------------------------------------
+void FlightRecorderReader::close(void)
+{
+    // Unmap the view
+    if (view) {
+        UnmapViewOfFile(view);
+        view = NULL;
+    }
+
+    // Close the mapping
+    if (hMapping) {
+        CloseHandle(hMapping);
+        hMapping = NULL;
+    }
+
+    // Close the file
+    if (hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(hFile);
+        hFile = INVALID_HANDLE_VALUE;
+    }
+
+    file_size = 0;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::startRecorder(File name, Size of the file [MB])
+// Start recording every Navdata packet.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::startRecorder(const char *filename, int size_mb)
+{
+    // Navdata is not running
+    if (mutexNavdata == INVALID_HANDLE_VALUE) {
+        printf("ERROR: Navdata is not initialized. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Stop the previous one
+    stopRecorder();
+
+    // Create a file
+    FlightRecorder *tmp = new FlightRecorder();
+    if (!tmp->open(filename, size_mb)) {
+        delete tmp;
+        return 0;
+    }
+
+    // Attach to the Navdata handler
+    WaitForSingleObject(mutexNavdata, INFINITE);
+    recorder = tmp;
+    ReleaseMutex(mutexNavdata);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::stopRecorder()
+// Stop recording.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::stopRecorder(void)
+{
+    // Not recording (The recorder is only set by startRecorder() while Navdata is running)
+    if (!recorder) return;
+
+    // Detach from the Navdata handler
+    WaitForSingleObject(mutexNavdata, INFINITE);
+    FlightRecorder *tmp = recorder;
+    recorder = NULL;
+    ReleaseMutex(mutexNavdata);
+
+    // Close the file out of the lock
+    if (tmp) delete tmp;
+}
\ No newline at end of file
@@ -0,0 +1,1028 @@
+#include "ardrone.h"
+
+// Major states in ctrl_state of Navdata
+#define SIMULATOR_STATE_LANDED      (2)
+#define SIMULATOR_STATE_FLYING      (3)
+#define SIMULATOR_STATE_HOVERING    (4)
+#define SIMULATOR_STATE_TAKEOFF     (6)
+#define SIMULATOR_STATE_LANDING     (8)
+
+// Flight model
+#define SIMULATOR_GRAVITY           (9.81)          // [m/s^2]
+#define SIMULATOR_MAX_TILT          (0.21)          // Tilt for the command of 1.0 [rad] (euler_angle_max)
+#define SIMULATOR_MAX_VZ            (0.7)           // Vertical speed for the command of 1.0 [m/s]
+#define SIMULATOR_MAX_YAW           (100.0)         // Yaw rate for the command of 1.0 [deg/s]
+#define SIMULATOR_ATTITUDE_TIME     (0.1)           // Time constant of the attitude [s]
+#define SIMULATOR_DRAG_TIME         (1.0)           // Time constant of the drag [s]
+#define SIMULATOR_TAKEOFF_ALTITUDE  (0.8)           // Altitude after taking off [m]
+
+// Sizes of the Navdata packets (Demo option is 148 bytes, full Navdata is about 500 bytes)
+#define SIMULATOR_DEMO_SIZE         (148)
+#define SIMULATOR_FULL_SIZE         (500)
+
+// --------------------------------------------------------------------------
+// simOpenServer(Type of the socket, Port number)
+// Create a non-blocking socket bound to the port. TCP sockets listen.
+// Return value SUCCESS: Socket  FAILED: INVALID_SOCKET
+// --------------------------------------------------------------------------
+static SOCKET simOpenServer(int type, int port)
+{
+    // Create a socket
+    SOCKET sock = socket(AF_INET, type, 0);
+    if (sock == INVALID_SOCKET) {
+        printf("ERROR: socket() failed. (%s, %d)\n", __FILE__, __LINE__);
+        return INVALID_SOCKET;
+    }
+
+    // Enable re-use address option (TCP only, two simulators must not share a UDP port)
+    if (type == SOCK_STREAM) {
+        int reuse = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    }
+
+    // Bind the socket
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((u_short)port);
+    addr.sin_addr.S_un.S_addr = htonl(INADDR_ANY);
+    if (bind(sock, (sockaddr*)&addr, sizeof(sockaddr_in)) == SOCKET_ERROR) {
+        printf("ERROR: bind(port=%d) failed. (%s, %d)\n", port, __FILE__, __LINE__);
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+
+    // Listen
+    if (type == SOCK_STREAM && listen(sock, SOMAXCONN) == SOCKET_ERROR) {
+        printf("ERROR: listen() failed. (%s, %d)\n", __FILE__, __LINE__);
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+
+    // Set to the non-blocking mode
+    u_long nonblock = 1;
+    ioctlsocket(sock, FIONBIO, &nonblock);
+
+    return sock;
+}
+
+// --------------------------------------------------------------------------
+// simClose(Socket)
+// Close the socket if it is valid.
+// Return value NONE
+// --------------------------------------------------------------------------
+static void simClose(SOCKET *sock)
+{
+    if (*sock != INVALID_SOCKET) {
+        closesocket(*sock);
+        *sock = INVALID_SOCKET;
+    }
+}
+
+// --------------------------------------------------------------------------
+// simAccept(Listening socket, Socket to replace)
+// Accept a connection. The previous client is dropped (An AR.Drone has one).
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+static int simAccept(SOCKET server, SOCKET *client)
+{
+    SOCKET sock = accept(server, NULL, NULL);
+    if (sock == INVALID_SOCKET) return 0;
+
+    // Drop the previous one
+    simClose(client);
+    *client = sock;
+
+    // Set to the non-blocking mode
+    u_long nonblock = 1;
+    ioctlsocket(sock, FIONBIO, &nonblock);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// simSendAll(Socket, Sending data, Size of data)
+// Send all the data over the non-blocking TCP socket.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+static int simSendAll(SOCKET sock, const char *data, int size)
+{
+    while (size > 0) {
+        int n = send(sock, data, size, 0);
+        if (n > 0) {
+            data += n;
+            size -= n;
+            continue;
+        }
+        if (n == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) return 0;
+
+        // Wait until the socket becomes writable
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        timeval tv = {0, 100000};
+        if (select((int)sock + 1, NULL, &fds, NULL, &tv) < 1) return 0;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::ARDroneSimulator()
+// Constructor of ARDroneSimulator class. This will be called when you create it.
+// --------------------------------------------------------------------------
+ARDroneSimulator::ARDroneSimulator()
+{
+    // Settings
+    version = ARDRONE_VERSION_2;
+    ZeroMemory(&ports, sizeof(ARDRONE_PORTS));
+
+    // Sockets
+    sockFtp     = sockFtpClient   = sockFtpData = INVALID_SOCKET;
+    sockNavdata = sockCommand     = INVALID_SOCKET;
+    sockVideo   = sockVideoClient = INVALID_SOCKET;
+    sockConfig  = sockConfigClient = INVALID_SOCKET;
+    hasNavdata  = hasVideo = 0;
+    retrFtp     = 0.0;
+
+    // Video fixture
+    frameIndex = frameCount = 0;
+    ZeroMemory(frameTimes, sizeof(frameTimes));
+
+    // Flight model
+    ZeroMemory(&navdata, sizeof(NAVDATA));
+    flying = takeoff = emergency = 0;
+    pcmdFlag = 0;
+    pcmd[0] = pcmd[1] = pcmd[2] = pcmd[3] = 0.0f;
+    roll = pitch = yaw = altitude = u = v = w = 0.0;
+    battery = 100.0;
+    lastCommand = 0.0;
+    commandCount = 0;
+
+    // Thread
+    flag   = 0;
+    thread = INVALID_HANDLE_VALUE;
+    mutex  = INVALID_HANDLE_VALUE;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::~ARDroneSimulator()
+// Destructor of ARDroneSimulator class. This will be called when you destroy it.
+// --------------------------------------------------------------------------
+ARDroneSimulator::~ARDroneSimulator()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::open(Version of the AR.Drone, Video fixture, Port numbers)
+// Start the simulator. Without ports, it listens on the default ports plus
+// ARDRONE_SIMULATOR_PORT_OFFSET, so an ARDrone on the same machine can keep
+// its local ports. Without a fixture, no video is sent.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDroneSimulator::open(int version, const char *fixture, const ARDRONE_PORTS *ports)
+{
+    // Running
+    if (flag) close();
+
+    // Initialize WSA
+    WSAData wsaData;
+    WSAStartup(MAKEWORD(1,1), &wsaData);
+
+    // Settings
+    this->version = (version == ARDRONE_VERSION_1) ? ARDRONE_VERSION_1 : ARDRONE_VERSION_2;
+    if (ports) this->ports = *ports;
+    else {
+        this->ports.version = ARDRONE_VERSION_PORT + ARDRONE_SIMULATOR_PORT_OFFSET;
+        this->ports.navdata = ARDRONE_NAVDATA_PORT + ARDRONE_SIMULATOR_PORT_OFFSET;
+        this->ports.video   = ARDRONE_VIDEO_PORT   + ARDRONE_SIMULATOR_PORT_OFFSET;
+        this->ports.command = ARDRONE_COMMAND_PORT + ARDRONE_SIMULATOR_PORT_OFFSET;
+        this->ports.config  = ARDRONE_CONFIG_PORT  + ARDRONE_SIMULATOR_PORT_OFFSET;
+    }
+    versionText = (this->version == ARDRONE_VERSION_2) ? "2.4.8" : "1.11.5";
+
+    // Load the video
+    if (fixture && !loadFixture(fixture)) {
+        printf("ERROR: ARDroneSimulator::loadFixture(%s) failed. (%s, %d)\n", fixture, __FILE__, __LINE__);
+        WSACleanup();
+        return 0;
+    }
+
+    // Open the sockets
+    sockFtp     = simOpenServer(SOCK_STREAM, this->ports.version);
+    sockNavdata = simOpenServer(SOCK_DGRAM,  this->ports.navdata);
+    sockVideo   = simOpenServer(this->version == ARDRONE_VERSION_2 ? SOCK_STREAM : SOCK_DGRAM, this->ports.video);
+    sockCommand = simOpenServer(SOCK_DGRAM,  this->ports.command);
+    sockConfig  = simOpenServer(SOCK_STREAM, this->ports.config);
+    if (sockFtp == INVALID_SOCKET || sockNavdata == INVALID_SOCKET || sockVideo == INVALID_SOCKET || sockCommand == INVALID_SOCKET || sockConfig == INVALID_SOCKET) {
+        close();
+        return 0;
+    }
+
+    // Initial state
+    ZeroMemory(&navdata, sizeof(NAVDATA));
+    navdata.header = ARDRONE_NAVDATA_HEADER;
+    navdata.vision_defined = 1;
+    flying = takeoff = emergency = 0;
+    pcmdFlag = 0;
+    pcmd[0] = pcmd[1] = pcmd[2] = pcmd[3] = 0.0f;
+    roll = pitch = yaw = altitude = u = v = w = 0.0;
+    battery = 100.0;
+    lastCommand = ardGetTickCount();
+    commandCount = 0;
+    frameIndex = frameCount = 0;
+    hasNavdata = hasVideo = 0;
+
+    // Default configuration
+    config.clear();
+    config["general:num_version_soft"] = versionText;
+    config["general:navdata_demo"]     = "TRUE";
+    config["general:video_enable"]     = "TRUE";
+    config["control:euler_angle_max"]  = "0.21";
+    config["control:control_vz_max"]   = "700";
+    config["control:control_yaw"]      = "1.75";
+    config["control:altitude_max"]     = "3000";
+    config["video:video_channel"]      = "0";
+    config["video:video_codec"]        = (this->version == ARDRONE_VERSION_2) ? "129" : "32";
+    config["video:bitrate_ctrl_mode"]  = "0";
+
+    // Create a mutex
+    mutex = CreateMutex(NULL, FALSE, NULL);
+
+    // Enable thread loop
+    flag = 1;
+
+    // Create a thread
+    UINT id;
+    thread = (HANDLE)_beginthreadex(NULL, 0, run, this, 0, &id);
+    if (thread == INVALID_HANDLE_VALUE || thread == 0) {
+        printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
+        thread = INVALID_HANDLE_VALUE;
+        close();
+        return 0;
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::close()
+// Stop the simulator.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::close(void)
+{
+    // Stop the thread
+    const int running = flag;
+    flag = 0;
+    if (thread != INVALID_HANDLE_VALUE) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        thread = INVALID_HANDLE_VALUE;
+    }
+
+    // Delete the mutex
+    if (mutex != INVALID_HANDLE_VALUE) {
+        CloseHandle(mutex);
+        mutex = INVALID_HANDLE_VALUE;
+    }
+
+    // Close the sockets
+    const int opened = (sockFtp != INVALID_SOCKET || sockNavdata != INVALID_SOCKET || sockVideo != INVALID_SOCKET || sockCommand != INVALID_SOCKET || sockConfig != INVALID_SOCKET);
+    simClose(&sockFtp);
+    simClose(&sockFtpClient);
+    simClose(&sockFtpData);
+    simClose(&sockNavdata);
+    simClose(&sockCommand);
+    simClose(&sockVideo);
+    simClose(&sockVideoClient);
+    simClose(&sockConfig);
+    simClose(&sockConfigClient);
+    lineFtp.clear();
+    retrFtp = 0.0;
+
+    // Release the video
+    fixture.clear();
+    frames.clear();
+
+    // Finalize WSA
+    if (running || opened) WSACleanup();
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::getPorts(Port numbers)
+// Obtaining the listening ports. Pass them to ARDrone::setPorts().
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::getPorts(ARDRONE_PORTS *ports)
+{
+    if (ports) *ports = this->ports;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::getNavdata(Navdata)
+// Obtaining the simulated Navdata.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::getNavdata(NAVDATA *navdata)
+{
+    if (!navdata) return;
+    if (mutex != INVALID_HANDLE_VALUE) WaitForSingleObject(mutex, INFINITE);
+    *navdata = this->navdata;
+    if (mutex != INVALID_HANDLE_VALUE) ReleaseMutex(mutex);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::getFrameCount()
+// Obtaining the number of sent video frames.
+// Return value Number of frames
+// --------------------------------------------------------------------------
+unsigned int ARDroneSimulator::getFrameCount(void)
+{
+    return frameCount;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::getFrameTime(Frame number)
+// Obtaining the time the frame was sent. AR.Drone 2.0 frames carry the
+// number in frame_number of the PaVE header. Only the last 256 are kept.
+// Return value Time [ms] (0: Unknown)
+// --------------------------------------------------------------------------
+double ARDroneSimulator::getFrameTime(unsigned int frame)
+{
+    const int n = sizeof(frameTimes) / sizeof(frameTimes[0]);
+    if (frame >= frameCount || frameCount - frame > (unsigned int)n) return 0.0;
+    return frameTimes[frame % n];
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::getCommandCount()
+// Obtaining the number of received AT commands.
+// Return value Number of commands
+// --------------------------------------------------------------------------
+unsigned int ARDroneSimulator::getCommandCount(void)
+{
+    return commandCount;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::loadFixture(File name)
+// Read the video fixture and split it into frames.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDroneSimulator::loadFixture(const char *filename)
+{
+    // Read the whole file
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return 0;
+    fixture.clear();
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) fixture.append(buf, n);
+    fclose(fp);
+
+    // Split it into frames
+    frames.clear();
+    const unsigned char *data = (const unsigned char*)fixture.data();
+    const int size = (int)fixture.size();
+    int offset = 0;
+    while (offset < size) {
+        int length;
+
+        // AR.Drone 1.0 (Size and datagram)
+        if (version == ARDRONE_VERSION_1) {
+            if (size - offset < 4) break;
+            length = data[offset] | (data[offset+1] << 8) | (data[offset+2] << 16) | (data[offset+3] << 24);
+            offset += 4;
+            if (length < 0 || length > size - offset) break;
+        }
+        // AR.Drone 2.0 (PaVE header and payload)
+        else if (size - offset >= 12 && !memcmp(data + offset, "PaVE", 4)) {
+            const int header  = data[offset+6] | (data[offset+7] << 8);
+            const int payload = data[offset+8] | (data[offset+9] << 8) | (data[offset+10] << 16) | (data[offset+11] << 24);
+            length = header + payload;
+            if (length < 12 || length > size - offset) length = size - offset;
+        }
+        // Without PaVE (Up to the next one)
+        else {
+            length = (size - offset < 4096) ? size - offset : 4096;
+            for (int i = 1; i + 4 <= size - offset && i < length; i++) {
+                if (!memcmp(data + offset + i, "PaVE", 4)) {
+                    length = i;
+                    break;
+                }
+            }
+        }
+
+        // Save the frame
+        if (length > 0) frames.push_back(std::make_pair(offset, length));
+        offset += length;
+    }
+
+    return !frames.empty();
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::loop()
+// Thread function. Serves all the sockets and runs the timers.
+// Return value 0
+// --------------------------------------------------------------------------
+UINT ARDroneSimulator::loop(void)
+{
+    double now = ardGetTickCount();
+    double nextPhysics = now, nextNavdata = now, nextVideo = now;
+
+    while (flag) {
+        // Sockets to wait for
+        fd_set fds;
+        FD_ZERO(&fds);
+        SOCKET socks[] = {sockFtp, sockFtpClient, (retrFtp > 0.0) ? sockFtpData : INVALID_SOCKET, sockNavdata, sockCommand, sockVideo, sockVideoClient, sockConfig, sockConfigClient};
+        int maxfd = 0;
+        for (int i = 0; i < (int)(sizeof(socks) / sizeof(socks[0])); i++) {
+            if (socks[i] == INVALID_SOCKET) continue;
+            FD_SET(socks[i], &fds);
+            if ((int)socks[i] > maxfd) maxfd = (int)socks[i];
+        }
+
+        // Wait until the physics step at most
+        now = ardGetTickCount();
+        const double wait = nextPhysics - now;
+        const int us = (wait > 0.0) ? (int)(wait * 1000.0) : 0;
+        timeval tv = {us / 1000000, us % 1000000};
+        int n = select(maxfd + 1, &fds, NULL, NULL, &tv);
+
+        WaitForSingleObject(mutex, INFINITE);
+
+        // Serve the requests
+        if (n > 0) {
+            // FTP
+            if (FD_ISSET(sockFtp, &fds) && simAccept(sockFtp, &sockFtpClient)) {
+                lineFtp.clear();
+                retrFtp = 0.0;
+                simSendAll(sockFtpClient, "220 Simulator\r\n", 15);
+            }
+            if (sockFtpClient != INVALID_SOCKET && FD_ISSET(sockFtpClient, &fds)) serveFtp();
+            if (retrFtp > 0.0 && FD_ISSET(sockFtpData, &fds)) serveFtpData();
+
+            // Navdata (The client is whoever asks)
+            if (FD_ISSET(sockNavdata, &fds)) {
+                char buf[64];
+                int len = (int)sizeof(sockaddr_in);
+                while (recvfrom(sockNavdata, buf, sizeof(buf), 0, (sockaddr*)&addrNavdata, &len) > 0) {
+                    hasNavdata = 1;
+                    len = (int)sizeof(sockaddr_in);
+                }
+            }
+
+            // AT command
+            if (FD_ISSET(sockCommand, &fds)) serveCommand();
+
+            // Video
+            if (FD_ISSET(sockVideo, &fds)) acceptVideo();
+            if (sockVideoClient != INVALID_SOCKET && FD_ISSET(sockVideoClient, &fds)) {
+                char buf[256];
+                int len = recv(sockVideoClient, buf, sizeof(buf), 0);
+                if (len == 0 || (len == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK)) simClose(&sockVideoClient);
+            }
+
+            // Configuration
+            if (FD_ISSET(sockConfig, &fds)) simAccept(sockConfig, &sockConfigClient);
+            if (sockConfigClient != INVALID_SOCKET && FD_ISSET(sockConfigClient, &fds)) {
+                char buf[256];
+                int len = recv(sockConfigClient, buf, sizeof(buf), 0);
+                if (len == 0 || (len == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK)) simClose(&sockConfigClient);
+            }
+        }
+
+        // No data connection for RETR
+        now = ardGetTickCount();
+        if (retrFtp > 0.0 && now > retrFtp) {
+            retrFtp = 0.0;
+            simClose(&sockFtpData);
+            simSendAll(sockFtpClient, "426 Failed\r\n", 12);
+        }
+
+        // Flight model
+        while (nextPhysics <= now) {
+            step(ARDRONE_SIMULATOR_PHYSICS * 0.001);
+            nextPhysics += ARDRONE_SIMULATOR_PHYSICS;
+        }
+
+        // Navdata (15Hz in the demo mode, 200Hz otherwise)
+        if (nextNavdata <= now) {
+            if (hasNavdata) sendNavdata();
+            const double interval = (config["general:navdata_demo"] == "FALSE") ? 5.0 : 1000.0 / 15.0;
+            nextNavdata += interval;
+            if (nextNavdata < now) nextNavdata = now + interval;
+        }
+
+        // Video (15fps for AR.Drone 1.0, 30fps for 2.0)
+        if (nextVideo <= now) {
+            const int ready = (version == ARDRONE_VERSION_2) ? (sockVideoClient != INVALID_SOCKET) : hasVideo;
+            if (ready && !frames.empty()) sendFrame();
+            const double interval = (version == ARDRONE_VERSION_2) ? 1000.0 / 30.0 : 1000.0 / 15.0;
+            nextVideo += interval;
+            if (nextVideo < now) nextVideo = now + interval;
+        }
+
+        ReleaseMutex(mutex);
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::serveFtp()
+// Read the FTP commands and answer them.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::serveFtp(void)
+{
+    // Receive
+    char buf[256];
+    int len = recv(sockFtpClient, buf, sizeof(buf), 0);
+    if (len == 0 || (len == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK)) {
+        simClose(&sockFtpClient);
+        simClose(&sockFtpData);
+        retrFtp = 0.0;
+        return;
+    }
+    if (len < 1) return;
+    lineFtp.append(buf, len);
+
+    // Each line
+    std::string::size_type pos;
+    while ((pos = lineFtp.find('\n')) != std::string::npos) {
+        std::string line = lineFtp.substr(0, pos);
+        lineFtp.erase(0, pos + 1);
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+
+        // TCPSocket::sendf() sends the terminator too
+        const std::string::size_type start = line.find_first_not_of('\0');
+        line.erase(0, (start != std::string::npos) ? start : line.size());
+        serveFtpCommand(line.c_str());
+        if (sockFtpClient == INVALID_SOCKET) break;
+    }
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::serveFtpCommand(Command line)
+// Answer an FTP command. Only passive mode and version.txt are supported.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::serveFtpCommand(const char *line)
+{
+    char reply[128];
+
+    // Login
+    if (!strncmp(line, "USER", 4)) simSendAll(sockFtpClient, "331 OK\r\n", 8);
+    else if (!strncmp(line, "PASS", 4)) simSendAll(sockFtpClient, "230 OK\r\n", 8);
+    else if (!strncmp(line, "TYPE", 4)) simSendAll(sockFtpClient, "200 OK\r\n", 8);
+
+    // Passive mode (A free port for the transfer)
+    else if (!strncmp(line, "PASV", 4)) {
+        simClose(&sockFtpData);
+        retrFtp = 0.0;
+        sockFtpData = simOpenServer(SOCK_STREAM, 0);
+        sockaddr_in addr, data;
+        int len = (int)sizeof(sockaddr_in);
+        if (sockFtpData == INVALID_SOCKET || getsockname(sockFtpClient, (sockaddr*)&addr, &len) == SOCKET_ERROR ||
+            (len = (int)sizeof(sockaddr_in), getsockname(sockFtpData, (sockaddr*)&data, &len)) == SOCKET_ERROR) {
+            simSendAll(sockFtpClient, "425 Failed\r\n", 12);
+            return;
+        }
+        const unsigned int ip = ntohl(addr.sin_addr.S_un.S_addr);
+        const int port = ntohs(data.sin_port);
+        sprintf(reply, "227 Entering Passive Mode (%u,%u,%u,%u,%d,%d)\r\n", (ip >> 24) & 0xFF, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF, port >> 8, port & 0xFF);
+        simSendAll(sockFtpClient, reply, (int)strlen(reply));
+    }
+
+    // Transfer
+    else if (!strncmp(line, "RETR", 4)) {
+        if (!strstr(line, "version.txt") || sockFtpData == INVALID_SOCKET) {
+            simSendAll(sockFtpClient, "550 Failed\r\n", 12);
+            return;
+        }
+        simSendAll(sockFtpClient, "150 OK\r\n", 8);
+
+        // The loop sends the file when the data connection comes
+        retrFtp = ardGetTickCount() + ARDRONE_SIMULATOR_FTP_WAIT;
+    }
+
+    // Logout
+    else if (!strncmp(line, "QUIT", 4)) {
+        simSendAll(sockFtpClient, "221 Bye\r\n", 9);
+        simClose(&sockFtpClient);
+        simClose(&sockFtpData);
+        retrFtp = 0.0;
+    }
+
+    // Others
+    else simSendAll(sockFtpClient, "502 Not implemented\r\n", 21);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::serveFtpData()
+// Accept the data connection of RETR and send version.txt.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::serveFtpData(void)
+{
+    // Accept the data connection
+    SOCKET sock = INVALID_SOCKET;
+    simAccept(sockFtpData, &sock);
+    simClose(&sockFtpData);
+    retrFtp = 0.0;
+
+    // Send the file
+    if (sock == INVALID_SOCKET || !simSendAll(sock, versionText.c_str(), (int)versionText.size())) {
+        simClose(&sock);
+        simSendAll(sockFtpClient, "426 Failed\r\n", 12);
+        return;
+    }
+    simClose(&sock);
+    simSendAll(sockFtpClient, "226 OK\r\n", 8);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::serveCommand()
+// Receive the datagrams of AT commands.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::serveCommand(void)
+{
+    char buf[ATCMD_DATAGRAM_SIZE + 1];
+    int len;
+    while ((len = recvfrom(sockCommand, buf, ATCMD_DATAGRAM_SIZE, 0, NULL, NULL)) > 0) {
+        buf[len] = '\0';
+
+        // Commands are separated by "\r"
+        char *line = buf;
+        while (line && *line) {
+            char *end = strchr(line, '\r');
+            if (end) *end++ = '\0';
+            if (!strncmp(line, "AT*", 3)) serveCommandLine(line);
+            line = end;
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::serveCommandLine(Command)
+// Apply an AT command.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::serveCommandLine(const char *line)
+{
+    lastCommand = ardGetTickCount();
+    commandCount++;
+
+    // Command name and arguments (After the sequence number)
+    const char *args = strchr(line, '=');
+    if (!args) return;
+    std::string name(line + 3, args - line - 3);
+    args = strchr(args, ',');
+
+    // Integer arguments
+    int value[5] = {0, 0, 0, 0, 0}, num = 0;
+    for (const char *p = args; p && num < 5; p = strchr(p + 1, ',')) value[num++] = atoi(p + 1);
+
+    // Take off / Landing / Emergency
+    if (name == "REF" && num > 0) {
+        // Emergency (Toggled by the bit 8)
+        static const int EMERGENCY = 1 << 8, TAKEOFF = 1 << 9;
+        if (value[0] & EMERGENCY) {
+            if (!emergency && (flying || takeoff)) emergency = 1;
+            else if (emergency) emergency = 0;
+        }
+        // Take off
+        else if ((value[0] & TAKEOFF) && !flying && !takeoff && !emergency) takeoff = 1;
+        // Landing
+        else if (!(value[0] & TAKEOFF) && (flying || takeoff)) {
+            flying = 0;
+            takeoff = -1;
+        }
+    }
+
+    // Move (Floats are sent as their bits)
+    else if (name == "PCMD" && num >= 5) {
+        pcmdFlag = value[0];
+        for (int i = 0; i < 4; i++) memcpy(&pcmd[i], &value[i + 1], sizeof(float));
+    }
+
+    // Configuration ("key","value")
+    else if (name == "CONFIG" && args) {
+        const char *k0 = strchr(args, '"');
+        const char *k1 = k0 ? strchr(k0 + 1, '"') : NULL;
+        const char *v0 = k1 ? strchr(k1 + 1, '"') : NULL;
+        const char *v1 = v0 ? strchr(v0 + 1, '"') : NULL;
+        if (v1) {
+            config[std::string(k0 + 1, k1)] = std::string(v0 + 1, v1);
+            navdata.ardrone_state |= ARDRONE_COMMAND_MASK;
+        }
+    }
+
+    // Control mode
+    else if (name == "CTRL" && num > 0) {
+        // ACK
+        if (value[0] == 5) navdata.ardrone_state &= ~ARDRONE_COMMAND_MASK;
+        // Configuration dump
+        else if (value[0] == 4) {
+            sendConfig();
+            navdata.ardrone_state |= ARDRONE_COMMAND_MASK;
+        }
+    }
+
+    // Reset the watchdog
+    else if (name == "COMWDG") {
+        navdata.ardrone_state &= ~ARDRONE_COM_WATCHDOG_MASK;
+    }
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::sendConfig()
+// Send the configuration as "key = value" lines.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::sendConfig(void)
+{
+    if (sockConfigClient == INVALID_SOCKET) return;
+
+    std::string dump;
+    for (std::map<std::string, std::string>::const_iterator it = config.begin(); it != config.end(); ++it) {
+        dump += it->first + " = " + it->second + "\n";
+    }
+    if (!simSendAll(sockConfigClient, dump.c_str(), (int)dump.size())) simClose(&sockConfigClient);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::acceptVideo()
+// Start the video for a client.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::acceptVideo(void)
+{
+    // AR.Drone 1.0 (The client is whoever asks)
+    if (version == ARDRONE_VERSION_1) {
+        char buf[64];
+        int len = (int)sizeof(sockaddr_in);
+        while (recvfrom(sockVideo, buf, sizeof(buf), 0, (sockaddr*)&addrVideo, &len) > 0) {
+            hasVideo = 1;
+            len = (int)sizeof(sockaddr_in);
+        }
+        return;
+    }
+
+    // AR.Drone 2.0
+    if (!simAccept(sockVideo, &sockVideoClient)) return;
+    frameIndex = 0;
+
+    // FFmpeg opens it by HTTP, so answer the request
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sockVideoClient, &fds);
+    timeval tv = {0, 100000};
+    char buf[1024];
+    if (select((int)sockVideoClient + 1, &fds, NULL, NULL, &tv) > 0) {
+        int len = recv(sockVideoClient, buf, sizeof(buf), 0);
+        if (len >= 3 && !strncmp(buf, "GET", 3)) {
+            const char *response = "HTTP/1.0 200 OK\r\nContent-Type: application/octet-stream\r\n\r\n";
+            simSendAll(sockVideoClient, response, (int)strlen(response));
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::sendFrame()
+// Send the next frame of the fixture. PaVE headers are stamped with the
+// frame number and the time, so the receiver can measure the latency.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::sendFrame(void)
+{
+    // Next frame (Loop)
+    if (frameIndex >= frames.size()) frameIndex = 0;
+    std::string frame = fixture.substr(frames[frameIndex].first, frames[frameIndex].second);
+    frameIndex++;
+
+    // Stamp the PaVE header
+    const double now = ardGetTickCount();
+    if (frame.size() >= 28 && !frame.compare(0, 4, "PaVE")) {
+        const unsigned int number = frameCount, time = (unsigned int)now;
+        for (int i = 0; i < 4; i++) {
+            frame[20 + i] = (char)((number >> (8 * i)) & 0xFF);
+            frame[24 + i] = (char)((time   >> (8 * i)) & 0xFF);
+        }
+    }
+
+    // Record the time (Before the receiver can see the frame)
+    frameTimes[frameCount % (sizeof(frameTimes) / sizeof(frameTimes[0]))] = now;
+    frameCount++;
+
+    // Send it
+    if (version == ARDRONE_VERSION_2) {
+        if (!simSendAll(sockVideoClient, frame.data(), (int)frame.size())) simClose(&sockVideoClient);
+    }
+    else sendto(sockVideo, frame.data(), (int)frame.size(), 0, (sockaddr*)&addrVideo, sizeof(sockaddr_in));
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::sendNavdata()
+// Send the Navdata with a demo option and a checksum.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::sendNavdata(void)
+{
+    const int demo = (config["general:navdata_demo"] != "FALSE");
+    unsigned char buf[SIMULATOR_FULL_SIZE];
+    ZeroMemory(buf, sizeof(buf));
+
+    // Header and demo option
+    navdata.sequence++;
+    if (demo) navdata.ardrone_state |= ARDRONE_NAVDATA_DEMO_MASK;
+    else      navdata.ardrone_state &= ~ARDRONE_NAVDATA_DEMO_MASK;
+    navdata.tag  = 0;
+    navdata.size = SIMULATOR_DEMO_SIZE;
+    memcpy(buf, &navdata, sizeof(NAVDATA));
+    int size = 16 + SIMULATOR_DEMO_SIZE;
+
+    // Other options of the full Navdata (Zero, with an unused tag)
+    if (!demo) {
+        const unsigned short tag = 0xFFFE, length = (unsigned short)(SIMULATOR_FULL_SIZE - 8 - size);
+        memcpy(buf + size,     &tag,    2);
+        memcpy(buf + size + 2, &length, 2);
+        size += length;
+    }
+
+    // Checksum option
+    unsigned int checksum = 0;
+    for (int i = 0; i < size; i++) checksum += buf[i];
+    const unsigned short tag = 0xFFFF, length = 8;
+    memcpy(buf + size,     &tag,      2);
+    memcpy(buf + size + 2, &length,   2);
+    memcpy(buf + size + 4, &checksum, 4);
+    size += 8;
+
+    sendto(sockNavdata, (const char*)buf, size, 0, (sockaddr*)&addrNavdata, sizeof(sockaddr_in));
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::step(Time step [s])
+// Advance the flight model and update the Navdata.
+// The attitude follows the command with a first-order lag, and the tilt
+// accelerates the body against a linear drag.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDroneSimulator::step(double dt)
+{
+    // Emergency (Motors are cut)
+    if (emergency) {
+        flying = takeoff = 0;
+        roll = pitch = u = v = w = 0.0;
+        altitude = 0.0;
+    }
+    // Take off
+    else if (takeoff > 0) {
+        w = 1.0;
+        altitude += w * dt;
+        if (altitude >= SIMULATOR_TAKEOFF_ALTITUDE) {
+            altitude = SIMULATOR_TAKEOFF_ALTITUDE;
+            takeoff = 0;
+            flying = 1;
+            w = 0.0;
+        }
+    }
+    // Landing
+    else if (takeoff < 0) {
+        roll = pitch = u = v = 0.0;
+        w = -0.5;
+        altitude += w * dt;
+        if (altitude <= 0.0) {
+            altitude = 0.0;
+            takeoff = 0;
+            w = 0.0;
+        }
+    }
+    // Flying
+    else if (flying) {
+        // Without the progressive flag, the drone hovers
+        const int progressive = (pcmdFlag & 1) && !(navdata.ardrone_state & ARDRONE_COM_WATCHDOG_MASK);
+        const double targetRoll  = progressive ? pcmd[0] * SIMULATOR_MAX_TILT : 0.0;
+        const double targetPitch = progressive ? pcmd[1] * SIMULATOR_MAX_TILT : 0.0;
+        const double gaz = (navdata.ardrone_state & ARDRONE_COM_WATCHDOG_MASK) ? 0.0 : pcmd[2];
+        const double rate = (navdata.ardrone_state & ARDRONE_COM_WATCHDOG_MASK) ? 0.0 : pcmd[3] * SIMULATOR_MAX_YAW * DEG_TO_RAD;
+
+        // Attitude
+        roll  += (targetRoll  - roll)  * dt / SIMULATOR_ATTITUDE_TIME;
+        pitch += (targetPitch - pitch) * dt / SIMULATOR_ATTITUDE_TIME;
+        yaw   += rate * dt;
+        if (yaw >  M_PI) yaw -= 2.0 * M_PI;
+        if (yaw < -M_PI) yaw += 2.0 * M_PI;
+
+        // Velocity in the body frame
+        u += (-SIMULATOR_GRAVITY * tan(pitch) - u / SIMULATOR_DRAG_TIME) * dt;
+        v += (-SIMULATOR_GRAVITY * tan(roll)  - v / SIMULATOR_DRAG_TIME) * dt;
+        w = gaz * SIMULATOR_MAX_VZ;
+
+        // Altitude
+        altitude += w * dt;
+        if (altitude < 0.0) altitude = 0.0;
+
+        // Battery
+        battery -= dt / 7.2;    // 12 minutes
+        if (battery < 0.0) battery = 0.0;
+    }
+
+    // Watchdog
+    if (ardGetTickCount() - lastCommand > ARDRONE_SIMULATOR_WATCHDOG) navdata.ardrone_state |= ARDRONE_COM_WATCHDOG_MASK;
+
+    // State
+    int state = SIMULATOR_STATE_LANDED;
+    if      (takeoff > 0) state = SIMULATOR_STATE_TAKEOFF;
+    else if (takeoff < 0) state = SIMULATOR_STATE_LANDING;
+    else if (flying)      state = (pcmdFlag & 1) ? SIMULATOR_STATE_FLYING : SIMULATOR_STATE_HOVERING;
+    if (flying || takeoff > 0) navdata.ardrone_state |= ARDRONE_FLY_MASK;
+    else                       navdata.ardrone_state &= ~ARDRONE_FLY_MASK;
+    if (emergency) navdata.ardrone_state |= ARDRONE_EMERGENCY_MASK;
+    else           navdata.ardrone_state &= ~ARDRONE_EMERGENCY_MASK;
+    if (!frames.empty()) navdata.ardrone_state |= ARDRONE_VIDEO_MASK;
+    navdata.ctrl_state = state << 16;
+
+    // Demo option
+    navdata.vbat_flying_percentage = (unsigned int)battery;
+    navdata.phi      = (float)(roll  * RAD_TO_DEG * 1000.0);
+    navdata.theta    = (float)(pitch * RAD_TO_DEG * 1000.0);
+    navdata.psi      = (float)(yaw   * RAD_TO_DEG * 1000.0);
+    navdata.altitude = (int)(altitude * 1000.0);
+    navdata.vx       = (float)(u * 1000.0);
+    navdata.vy       = (float)(v * 1000.0);
+    navdata.vz       = (float)(w * 1000.0);
+}
+
+// --------------------------------------------------------------------------
+// ARDroneSimulator::capture(IP address, Version, File name, Duration [ms])
+// Record the video of a real AR.Drone as a fixture of the simulator.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDroneSimulator::capture(const char *addr, int version, const char *filename, double duration)
+{
+    // Open the file
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        printf("ERROR: fopen(%s) failed. (%s, %d)\n", filename, __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Initialize WSA
+    WSAData wsaData;
+    WSAStartup(MAKEWORD(1,1), &wsaData);
+
+    int result = 0;
+    const double deadline = ardGetTickCount() + duration;
+    static char buf[122880];
+
+    // AR.Drone 2.0 (The raw stream)
+    if (version == ARDRONE_VERSION_2) {
+        TCPSocket sock;
+        if (sock.open(addr, ARDRONE_VIDEO_PORT, ARDRONE_VERSION_TIMEOUT)) {
+            while (ardGetTickCount() < deadline) {
+                if (!sock.wait(100)) continue;
+                int n = sock.receive(buf, sizeof(buf));
+                if (n > 0) result = (fwrite(buf, 1, n, fp) == (size_t)n);
+            }
+            sock.close();
+        }
+    }
+    // AR.Drone 1.0 (Size and datagram)
+    else {
+        UDPSocket sock;
+        if (sock.open(addr, ARDRONE_VIDEO_PORT)) {
+            double keepalive = 0.0;
+            while (ardGetTickCount() < deadline) {
+                // Request the video
+                if (ardGetTickCount() > keepalive) {
+                    sock.sendf("\x01\x00\x00\x00");
+                    keepalive = ardGetTickCount() + ARDRONE_KEEPALIVE_INTERVAL;
+                }
+
+                // Save the datagrams
+                int n = sock.receive(buf, sizeof(buf));
+                if (n > 0) {
+                    unsigned char size[4] = {(unsigned char)n, (unsigned char)(n >> 8), (unsigned char)(n >> 16), (unsigned char)(n >> 24)};
+                    result = (fwrite(size, 1, 4, fp) == 4 && fwrite(buf, 1, n, fp) == (size_t)n);
+                }
+                else Sleep(1);
+            }
+            sock.close();
+        }
+    }
+
+    // Finalize
+    fclose(fp);
+    WSACleanup();
+
+    if (!result) printf("ERROR: No video from %s. (%s, %d)\n", addr, __FILE__, __LINE__);
+
+    return result;
+}
\ No newline at end of file
@@ -1,12 +1,27 @@
 #include "ardrone.h"
 
 // --------------------------------------------------------------------------
-// TCPSocket::TCPSocket()
+// TCPSocket::TCPSocket(Size of the ring buffer)
 // Constructor of TCPSocket class. This will be called when you create it.
+// The size is rounded up to a power of two.
 // --------------------------------------------------------------------------
-TCPSocket::TCPSocket()
+TCPSocket::TCPSocket(int size)
 {
     sock = INVALID_SOCKET;
+    timestamp = 0;
+    tick = 0.0;
+
+    // Power of two
+    capacity = 256;
+    while ((int)capacity < size && capacity < 0x40000000) capacity <<= 1;
+
+    // Allocate the ring and its mirror
+    head = tail = 0;
+    ring = (char*)malloc(capacity * 2);
+    if (!ring) {
+        printf("ERROR: malloc() failed. (%s, %d)\n", __FILE__, __LINE__);
+        capacity = 0;
+    }
 }
 
 // --------------------------------------------------------------------------
@@ -15,15 +30,21 @@ TCPSocket::TCPSocket()
 // --------------------------------------------------------------------------
 TCPSocket::~TCPSocket()
 {
+    close();
+    free(ring);
 }
 
 // --------------------------------------------------------------------------
-// TCPSocket::open(IP address, Port number)
+// TCPSocket::open(IP address, Port number, Connection timeout [ms])
 // Initialize specified  socket.
+// When the timeout is 0, connect() waits as long as the system does.
 // Return value SUCCESS: 1  FAILED: 0
 // --------------------------------------------------------------------------
-int TCPSocket::open(const char *addr, int port)
+int TCPSocket::open(const char *addr, int port, int timeout)
 {
+    // Empty the buffer
+    head = tail = 0;
+
     // Create a socket
     sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock == INVALID_SOCKET) {
@@ -44,9 +65,44 @@ int TCPSocket::open(const char *addr, int port)
     //client_addr.sin_addr.S_un.S_addr = inet_addr("192.168.1.2");
 
     // Connect the socket
-    if (connect(sock, (sockaddr*)&server_addr, sizeof(sockaddr_in)) == SOCKET_ERROR) {
-        printf("ERROR: connect() failed. (%s, %d)\n", __FILE__, __LINE__);
-        return 0;
+    if (timeout <= 0) {
+        if (connect(sock, (sockaddr*)&server_addr, sizeof(sockaddr_in)) == SOCKET_ERROR) {
+            printf("ERROR: connect() failed. (%s, %d)\n", __FILE__, __LINE__);
+            close();
+            return 0;
+        }
+    }
+    // Connect with timeout
+    else {
+        // Non-blocking mode
+        u_long nonblock = 1;
+        ioctlsocket(sock, FIONBIO, &nonblock);
+
+        // Start connecting
+        if (connect(sock, (sockaddr*)&server_addr, sizeof(sockaddr_in)) == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK) {
+            printf("ERROR: connect() failed. (%s, %d)\n", __FILE__, __LINE__);
+            close();
+            return 0;
+        }
+
+        // Wait until it becomes writable
+        fd_set wfds, efds;
+        FD_ZERO(&wfds);
+        FD_ZERO(&efds);
+        FD_SET(sock, &wfds);
+        FD_SET(sock, &efds);
+        timeval tv;
+        tv.tv_sec  = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        if (select((int)sock + 1, NULL, &wfds, &efds, &tv) < 1 || !FD_ISSET(sock, &wfds)) {
+            printf("ERROR: connect() timed out. (%s, %d)\n", __FILE__, __LINE__);
+            close();
+            return 0;
+        }
+
+        // Blocking mode again
+        nonblock = 0;
+        ioctlsocket(sock, FIONBIO, &nonblock);
     }
 
     return 1;
@@ -93,11 +149,20 @@ int TCPSocket::sendf(char *str, ...)
 
 // --------------------------------------------------------------------------
 // TCPSocket:::receive(Receiving data, Size of data)
-// Receive the data.
+// Receive the data. The buffered data is returned first.
 // Return value SUCCESS: Number of received bytes  FAILED: 0
 // --------------------------------------------------------------------------
 int TCPSocket::receive(void *data, int size)
 {
+    // The buffered data
+    const int buffered = available();
+    if (buffered > 0 && size > 0) {
+        const int n = (buffered < size) ? buffered : size;
+        memcpy(data, span(n), n);
+        head += n;
+        return n;
+    }
+
     // The socket is invalid.
     if (sock == INVALID_SOCKET) return 0;
 
@@ -105,9 +170,185 @@ int TCPSocket::receive(void *data, int size)
     int n = recv(sock, (char*)data, size, 0);
     //if (n < 1) return 0;
 
+    // Receive time
+    if (timestamp && n > 0) tick = ardGetTickCount();
+
     return n;
 }
 
+// --------------------------------------------------------------------------
+// TCPSocket::wait(Timeout [ms])
+// Wait until the data arrives.
+// Return value ARRIVED: 1  TIMEOUT: 0
+// --------------------------------------------------------------------------
+int TCPSocket::wait(int timeout)
+{
+    // Buffered
+    if (available() > 0) return 1;
+
+    // Wait for the socket
+    return poll(timeout);
+}
+
+// --------------------------------------------------------------------------
+// TCPSocket::available()
+// Obtaining the number of the buffered bytes.
+// Return value Number of bytes
+// --------------------------------------------------------------------------
+int TCPSocket::available(void)
+{
+    return (int)(tail - head);
+}
+
+// --------------------------------------------------------------------------
+// TCPSocket::peek(Size, Timeout [ms])
+// Wait until the size of bytes are buffered, and look at them without
+// consuming. The pointer is valid until the next read.
+// Return value SUCCESS: Pointer to the bytes  FAILED: NULL (Timeout or closed)
+// --------------------------------------------------------------------------
+const char* TCPSocket::peek(int size, int timeout)
+{
+    // Too large
+    if (size < 1 || (unsigned int)size > capacity) return NULL;
+
+    // Fill the buffer
+    const double deadline = (timeout < 0) ? -1.0 : ardGetTickCount() + timeout;
+    while (tail - head < (unsigned int)size) {
+        if (!fill(deadline)) return NULL;
+    }
+
+    return span(size);
+}
+
+// --------------------------------------------------------------------------
+// TCPSocket::readExact(Size, Timeout [ms])
+// Read exactly the size of bytes. The pointer is valid until the next read.
+// Return value SUCCESS: Pointer to the bytes  FAILED: NULL (Timeout or closed)
+// --------------------------------------------------------------------------
+const char* TCPSocket::readExact(int size, int timeout)
+{
+    const char *data = peek(size, timeout);
+    if (data) head += size;
+    return data;
+}
+
+// --------------------------------------------------------------------------
+// TCPSocket::readUntil(Delimiter, Size, Timeout [ms])
+// Read the bytes up to and including the delimiter, e.g. a line with "\n".
+// The pointer is valid until the next read.
+// Return value SUCCESS: Pointer to the bytes  FAILED: NULL (Timeout, closed or too long)
+// --------------------------------------------------------------------------
+const char* TCPSocket::readUntil(const char *delim, int *size, int timeout)
+{
+    const int len = delim ? (int)strlen(delim) : 0;
+    if (len < 1 || !size) return NULL;
+
+    const double deadline = (timeout < 0) ? -1.0 : ardGetTickCount() + timeout;
+    int scanned = 0;
+    while (1) {
+        // Search the new bytes (and the tail of the old ones for a split delimiter)
+        const int n = available();
+        if (n >= len) {
+            const char *data = span(n);
+            int i = (scanned > len - 1) ? scanned - (len - 1) : 0;
+            while (i <= n - len) {
+                const char *p = (const char*)memchr(data + i, delim[0], n - len - i + 1);
+                if (!p) break;
+                if (!memcmp(p, delim, len)) {
+                    *size = (int)(p - data) + len;
+                    head += *size;
+                    return data;
+                }
+                i = (int)(p - data) + 1;
+            }
+        }
+        scanned = n;
+
+        // The buffer is full
+        if ((unsigned int)n >= capacity) {
+            printf("ERROR: No delimiter in the buffer. (%s, %d)\n", __FILE__, __LINE__);
+            return NULL;
+        }
+
+        // Receive more
+        if (!fill(deadline)) return NULL;
+    }
+}
+
+// --------------------------------------------------------------------------
+// TCPSocket::poll(Timeout [ms])
+// Wait for the socket to be readable.
+// Return value READABLE: 1  TIMEOUT: 0
+// --------------------------------------------------------------------------
+int TCPSocket::poll(int timeout)
+{
+    // The socket is invalid.
+    if (sock == INVALID_SOCKET) return 0;
+
+    // Wait for the socket to be readable
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    timeval tv;
+    tv.tv_sec  = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    if (select((int)sock + 1, &fds, NULL, NULL, (timeout < 0) ? NULL : &tv) < 1) return 0;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// TCPSocket::fill(Deadline [ms])
+// Receive as many bytes as the free space allows with one recv().
+// Return value SUCCESS: Number of received bytes  FAILED: 0 (Timeout, closed or full)
+// --------------------------------------------------------------------------
+int TCPSocket::fill(double deadline)
+{
+    // The socket is invalid.
+    if (sock == INVALID_SOCKET || !capacity) return 0;
+
+    // Rewind the empty buffer, so wrapping is rare
+    if (head == tail) head = tail = 0;
+
+    // Full
+    const unsigned int used = tail - head;
+    if (used >= capacity) return 0;
+
+    // Wait for the data
+    int timeout = -1;
+    if (deadline >= 0.0) {
+        const double remain = deadline - ardGetTickCount();
+        timeout = (remain > 0.0) ? (int)ceil(remain) : 0;
+    }
+    if (!poll(timeout)) return 0;
+
+    // Receive into the contiguous free space
+    const unsigned int pos = tail & (capacity - 1);
+    const unsigned int space = capacity - used;
+    const unsigned int contiguous = (capacity - pos < space) ? capacity - pos : space;
+    int n = recv(sock, ring + pos, (int)contiguous, 0);
+    if (n < 1) return 0;
+    tail += n;
+
+    // Receive time
+    if (timestamp) tick = ardGetTickCount();
+
+    return n;
+}
+
+// --------------------------------------------------------------------------
+// TCPSocket::span(Size)
+// Make the next bytes contiguous. Only the wrapped part is copied to the
+// mirror after the end of the ring.
+// Return value Pointer to the bytes
+// --------------------------------------------------------------------------
+const char* TCPSocket::span(int size)
+{
+    const unsigned int pos = head & (capacity - 1);
+    if (pos + size > capacity) memcpy(ring + capacity, ring, pos + size - capacity);
+    return ring + pos;
+}
+
 // --------------------------------------------------------------------------
 // TCPSocket::close()
 // Finalize the socket.
@@ -120,4 +361,30 @@ void TCPSocket::close(void)
         closesocket(sock);
         sock = INVALID_SOCKET;
     }
+
+    // Empty the buffer
+    head = tail = 0;
+}
+
+// --------------------------------------------------------------------------
+// TCPSocket::setTimestamp(Enable or not)
+// Stamp the received data with ardGetTickCount() right after the socket
+// returns it. WinSock has no kernel timestamps (SO_TIMESTAMPNS), so this is
+// the closest to the arrival.
+// Return value NONE
+// --------------------------------------------------------------------------
+void TCPSocket::setTimestamp(int enable)
+{
+    timestamp = enable ? 1 : 0;
+    if (!timestamp) tick = 0.0;
+}
+
+// --------------------------------------------------------------------------
+// TCPSocket::getTimestamp()
+// Obtaining the receive time of the last data.
+// Return value Receive time [ms] (0 when disabled)
+// --------------------------------------------------------------------------
+double TCPSocket::getTimestamp(void)
+{
+    return tick;
 }
\ No newline at end of file
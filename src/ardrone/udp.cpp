@@ -7,6 +7,8 @@
 UDPSocket::UDPSocket()
 {
     sock = INVALID_SOCKET;
+    timestamp = 0;
+    tick = 0.0;
 }
 
 // --------------------------------------------------------------------------
@@ -18,12 +20,17 @@ UDPSocket::~UDPSocket()
 }
 
 // --------------------------------------------------------------------------
-// UDPSocket::open(IP address, Port number)
+// UDPSocket::open(IP address, Port number, Local port number)
 // Initialize specified  socket.
+// The local port is the same as the remote one when it is negative,
+// and 0 lets the system choose it.
 // Return value SUCCESS: 1  FAILED: 0
 // --------------------------------------------------------------------------
-int UDPSocket::open(const char *addr, int port)
+int UDPSocket::open(const char *addr, int port, int local)
 {
+    // Close the previous one
+    close();
+
     // Create a socket.
     sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock == INVALID_SOCKET) {
@@ -40,12 +47,13 @@ int UDPSocket::open(const char *addr, int port)
     // Set the port and address of client
     memset(&client_addr, 0, sizeof(sockaddr_in));
     client_addr.sin_family = AF_INET;
-    client_addr.sin_port = htons((u_short)port);
+    client_addr.sin_port = htons((u_short)(local < 0 ? port : local));
     client_addr.sin_addr.S_un.S_addr = htonl(INADDR_ANY);
 
     // Bind the socket.
     if (bind(sock, (sockaddr*)&client_addr, sizeof(sockaddr_in)) == SOCKET_ERROR) {
-        printf("ERROR: bind() failed. (%s, %d)\n", __FILE__, __LINE__);  
+        printf("ERROR: bind(port=%d) failed. (%s, %d)\n", ntohs(client_addr.sin_port), __FILE__, __LINE__);
+        close();
         return 0;
     }
 
@@ -53,13 +61,7 @@ int UDPSocket::open(const char *addr, int port)
     u_long nonblock = 1;
     if (ioctlsocket(sock, FIONBIO, &nonblock) == SOCKET_ERROR) {
         printf("ERROR: ioctlsocket() failed. (%s, %d)\n", __FILE__, __LINE__);  
-        return 0;
-    }
-
-    // Enable re-use address option
-    int reuse = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) == SOCKET_ERROR) {
-        printf("ERROR: setsockopt() failed. (%s, %d)\n", __FILE__, __LINE__);
+        close();
         return 0;
     }
 
@@ -115,18 +117,75 @@ int UDPSocket::receive(void *data, int size)
     // The socket is invalid.
     if (sock == INVALID_SOCKET) return 0;
 
-    // Receive data
+    // Receive data (Skip the ones from others)
     sockaddr_in addr;
-    int len = (int)sizeof(sockaddr_in);
-    int n = recvfrom(sock, (char*)data, size, 0, (sockaddr*)&addr, &len);
-    if (n < 1) return 0;
+    int n;
+    do {
+        int len = (int)sizeof(sockaddr_in);
+        n = recvfrom(sock, (char*)data, size, 0, (sockaddr*)&addr, &len);
+        if (n < 1) return 0;
+    } while (!fromServer(&addr));
 
-    // Server has the same IP address of client
-    //if (addr.sin_addr.S_un.S_addr != server_addr.sin_addr.S_un.S_addr) return 0;
+    // Receive time
+    if (timestamp) tick = ardGetTickCount();
 
     return n;
 }
 
+// --------------------------------------------------------------------------
+// UDPSocket::receiveBatch(Batch of datagrams)
+// Receive the queued datagrams into the slots until the batch becomes full
+// or nothing is left. A datagram longer than a slot is truncated.
+// Return value SUCCESS: Number of received datagrams  FAILED: 0
+// --------------------------------------------------------------------------
+int UDPSocket::receiveBatch(UDPBatch *batch)
+{
+    // The socket is invalid.
+    if (sock == INVALID_SOCKET || !batch) return 0;
+
+    // Receive data (WinSock has no recvmmsg(), so one by one)
+    batch->used = 0;
+    while (batch->used < batch->num) {
+        sockaddr_in addr;
+        int len = (int)sizeof(sockaddr_in);
+        int n = recvfrom(sock, batch->buf + batch->used * batch->slot, batch->slot, 0, (sockaddr*)&addr, &len);
+        if (n < 1) {
+            // Truncated
+            if (n == SOCKET_ERROR && WSAGetLastError() == WSAEMSGSIZE) n = batch->slot;
+            else break;
+        }
+
+        // From others (The slot is reused)
+        if (!fromServer(&addr)) continue;
+        batch->sizes[batch->used] = n;
+
+        // Receive time
+        if (timestamp) tick = ardGetTickCount();
+        batch->ticks[batch->used++] = timestamp ? tick : 0.0;
+    }
+
+    return batch->used;
+}
+
+// --------------------------------------------------------------------------
+// UDPSocket::sendBatch(Batch of datagrams)
+// Send all the datagrams in the batch.
+// Return value SUCCESS: Number of sent datagrams  FAILED: 0
+// --------------------------------------------------------------------------
+int UDPSocket::sendBatch(const UDPBatch *batch)
+{
+    // The socket is invalid
+    if (sock == INVALID_SOCKET || !batch) return 0;
+
+    // Send data (WinSock has no sendmmsg(), so one by one)
+    int i;
+    for (i = 0; i < batch->used; i++) {
+        if (sendto(sock, batch->buf + i * batch->slot, batch->sizes[i], 0, (sockaddr*)&server_addr, sizeof(sockaddr_in)) < 1) break;
+    }
+
+    return i;
+}
+
 // --------------------------------------------------------------------------
 // UDPSocket::close()
 // Finalize the socket.
@@ -139,4 +198,175 @@ void UDPSocket::close(void)
         closesocket(sock);
         sock = INVALID_SOCKET;
     }
+}
+
+// --------------------------------------------------------------------------
+// UDPSocket::getSocket()
+// Obtaining the socket handle, e.g. to wait for it with Reactor.
+// Return value Socket handle (INVALID_SOCKET when it is not opened)
+// --------------------------------------------------------------------------
+SOCKET UDPSocket::getSocket(void)
+{
+    return sock;
+}
+
+// --------------------------------------------------------------------------
+// UDPSocket::setTimestamp(Enable or not)
+// Stamp the received data with ardGetTickCount() right after the socket
+// returns it. WinSock has no kernel timestamps (SO_TIMESTAMPNS), so this is
+// the closest to the arrival.
+// Return value NONE
+// --------------------------------------------------------------------------
+void UDPSocket::setTimestamp(int enable)
+{
+    timestamp = enable ? 1 : 0;
+    if (!timestamp) tick = 0.0;
+}
+
+// --------------------------------------------------------------------------
+// UDPSocket::getTimestamp()
+// Obtaining the receive time of the last data.
+// Return value Receive time [ms] (0 when disabled)
+// --------------------------------------------------------------------------
+double UDPSocket::getTimestamp(void)
+{
+    return tick;
+}
+
+// --------------------------------------------------------------------------
+// UDPBatch::UDPBatch(Number of slots, Size of a slot [bytes])
+// Constructor of UDPBatch class. This will be called when you create it.
+// --------------------------------------------------------------------------
+UDPBatch::UDPBatch(int num, int size)
+{
+    // Check the sizes
+    if (num < 1) num = 1;
+    if (size < 1) size = 1;
+
+    // Allocate the slots (Each slot keeps the alignment of the first one)
+    this->slot  = (size + 7) & ~7;
+    this->num   = num;
+    this->used  = 0;
+    this->buf   = (char*)malloc((size_t)this->num * this->slot);
+    this->sizes = (int*)calloc(this->num, sizeof(int));
+    this->ticks = (double*)calloc(this->num, sizeof(double));
+    if (!buf || !sizes || !ticks) {
+        printf("ERROR: malloc() failed. (%s, %d)\n", __FILE__, __LINE__);
+        this->num = 0;
+    }
+}
+
+// --------------------------------------------------------------------------
+// UDPBatch::~UDPBatch()
+// Destructor of UDPBatch class. This will be called when you destroy it.
+// --------------------------------------------------------------------------
+UDPBatch::~UDPBatch()
+{
+    free(buf);
+    free(sizes);
+    free(ticks);
+}
+
+// --------------------------------------------------------------------------
+// UDPBatch::add(Datagram, Size of the datagram)
+// Copy a datagram into the next slot for sendBatch().
+// Return value SUCCESS: 1  FAILED: 0 (Full or too large)
+// --------------------------------------------------------------------------
+int UDPBatch::add(const void *data, int size)
+{
+    if (used >= num || size < 0 || size > slot) return 0;
+    memcpy(buf + used * slot, data, size);
+    ticks[used] = 0.0;
+    sizes[used++] = size;
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// UDPBatch::clear()
+// Remove all the datagrams. The slots are kept.
+// Return value NONE
+// --------------------------------------------------------------------------
+void UDPBatch::clear(void)
+{
+    used = 0;
+}
+
+// --------------------------------------------------------------------------
+// UDPBatch::count()
+// Obtaining the number of the datagrams.
+// Return value Number of the datagrams
+// --------------------------------------------------------------------------
+int UDPBatch::count(void) const
+{
+    return used;
+}
+
+// --------------------------------------------------------------------------
+// UDPBatch::capacity()
+// Obtaining the number of the slots.
+// Return value Number of the slots
+// --------------------------------------------------------------------------
+int UDPBatch::capacity(void) const
+{
+    return num;
+}
+
+// --------------------------------------------------------------------------
+// UDPBatch::data(Index)
+// Obtaining the datagram.
+// Return value Pointer to the datagram (NULL for a wrong index)
+// --------------------------------------------------------------------------
+char* UDPBatch::data(int i) const
+{
+    if (i < 0 || i >= used) return NULL;
+    return buf + i * slot;
+}
+
+// --------------------------------------------------------------------------
+// UDPBatch::size(Index)
+// Obtaining the size of the datagram.
+// Return value Size of the datagram [bytes] (0 for a wrong index)
+// --------------------------------------------------------------------------
+int UDPBatch::size(int i) const
+{
+    if (i < 0 || i >= used) return 0;
+    return sizes[i];
+}
+
+// --------------------------------------------------------------------------
+// UDPBatch::timestamp(Index)
+// Obtaining the receive time of the datagram.
+// Return value Receive time [ms] (0 when UDPSocket::setTimestamp() is disabled)
+// --------------------------------------------------------------------------
+double UDPBatch::timestamp(int i) const
+{
+    if (i < 0 || i >= used) return 0.0;
+    return ticks[i];
+}
+
+// --------------------------------------------------------------------------
+// UDPSocket::getLocalPort()
+// Obtaining the port number the socket is bound to.
+// Return value SUCCESS: Port number  FAILED: 0
+// --------------------------------------------------------------------------
+int UDPSocket::getLocalPort(void)
+{
+    if (sock == INVALID_SOCKET) return 0;
+
+    sockaddr_in addr;
+    int len = (int)sizeof(sockaddr_in);
+    if (getsockname(sock, (sockaddr*)&addr, &len) == SOCKET_ERROR) return 0;
+
+    return ntohs(addr.sin_port);
+}
+
+// --------------------------------------------------------------------------
+// UDPSocket::fromServer(Source address)
+// Check the datagram came from the server. Several drones (or simulators on
+// one host) may send to the same local port, so the port is compared too.
+// Return value YES: 1  NO: 0
+// --------------------------------------------------------------------------
+int UDPSocket::fromServer(const sockaddr_in *addr)
+{
+    return addr->sin_addr.S_un.S_addr == server_addr.sin_addr.S_un.S_addr && addr->sin_port == server_addr.sin_port;
 }
\ No newline at end of file
@@ -0,0 +1,217 @@
+#include "ardrone.h"
+
+// --------------------------------------------------------------------------
+// ARDrone::setUndistortion(File name)
+// Load the camera parameters ("intrinsic" and "distortion") written by
+// main_calib.cpp, and undistort the images with them. The calibration must be
+// made with the same image size. NULL disables the undistortion.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::setUndistortion(const char *filename)
+{
+    // Disable
+    if (!filename) return setUndistortion(NULL, NULL);
+
+    // Open the file
+    CvFileStorage *fs = cvOpenFileStorage(filename, 0, CV_STORAGE_READ);
+    if (!fs) {
+        printf("ERROR: cvOpenFileStorage(%s) failed. (%s, %d)\n", filename, __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Read the parameters
+    CvMat *intrinsic  = (CvMat*)cvRead(fs, cvGetFileNodeByName(fs, NULL, "intrinsic"));
+    CvMat *distortion = (CvMat*)cvRead(fs, cvGetFileNodeByName(fs, NULL, "distortion"));
+    int result = 0;
+    if (intrinsic && distortion) result = setUndistortion(intrinsic, distortion);
+    else printf("ERROR: No camera parameters in %s. (%s, %d)\n", filename, __FILE__, __LINE__);
+
+    // Release them
+    if (intrinsic)  cvReleaseMat(&intrinsic);
+    if (distortion) cvReleaseMat(&distortion);
+    cvReleaseFileStorage(&fs);
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::setUndistortion(Camera matrix (3x3), Distortion coefficients (4 or 5))
+// Undistort the images with the camera parameters. The tables are made again
+// for the next frame. NULL disables the undistortion.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::setUndistortion(const CvMat *intrinsic, const CvMat *distortion)
+{
+    // Check the parameters
+    const int enable = (intrinsic && distortion);
+    if (enable) {
+        const int n = distortion->rows * distortion->cols;
+        if (intrinsic->rows != 3 || intrinsic->cols != 3 || n < 4 || n > 5) {
+            printf("ERROR: Invalid camera parameters. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
+    }
+
+    // Enable mutex lock
+    const int lock = (mutexVideo != INVALID_HANDLE_VALUE);
+    if (lock) WaitForSingleObject(mutexVideo, INFINITE);
+
+    // Copy the parameters
+    undistort = enable;
+    if (enable) {
+        const int n = distortion->rows * distortion->cols;
+        for (int i = 0; i < 9; i++) camIntrinsic[i]  = cvGetReal1D(intrinsic, i);
+        for (int i = 0; i < 5; i++) camDistortion[i] = (i < n) ? cvGetReal1D(distortion, i) : 0.0;
+    }
+
+    // Make the tables again
+    releaseUndistortion();
+
+    // Disable mutex lock
+    if (lock) ReleaseMutex(mutexVideo);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::prepareUndistortion(Width, Height)
+// Make the tables for the image size unless they are made. Call this with
+// mutexVideo locked.
+// Return value Ready: 1  Disabled or failed: 0
+// --------------------------------------------------------------------------
+int ARDrone::prepareUndistortion(int width, int height)
+{
+    // Disabled
+    if (!undistort) return 0;
+
+    // Already made
+    if (lutUndistort && lutUndistort->width == width && lutUndistort->height == height) return 1;
+    releaseUndistortion();
+
+    // Float maps
+    CvMat intrinsic  = cvMat(3, 3, CV_64FC1, camIntrinsic);
+    CvMat distortion = cvMat(1, 5, CV_64FC1, camDistortion);
+    CvMat *mapx = cvCreateMat(height, width, CV_32FC1);
+    CvMat *mapy = cvCreateMat(height, width, CV_32FC1);
+    cvInitUndistortMap(&intrinsic, &distortion, mapx, mapy);
+
+    // Fixed-point tables for color images
+    UNDISTORT_LUT *lut = new UNDISTORT_LUT;
+    lut->width  = width;
+    lut->height = height;
+    lut->map1   = cvCreateMat(height, width, CV_16SC2);
+    lut->map2   = cvCreateMat(height, width, CV_16UC1);
+    cvConvertMaps(mapx, mapy, lut->map1, lut->map2);
+
+    // Source pixels for YUV frames
+    const float scale = (float)(1 << UNDISTORT_FRAC_BITS);
+    lut->pixels = new UNDISTORT_PIXEL[width * height];
+    for (int y = 0; y < height; y++) {
+        const float *sx = (const float*)(mapx->data.ptr + y * mapx->step);
+        const float *sy = (const float*)(mapy->data.ptr + y * mapy->step);
+        for (int x = 0; x < width; x++) {
+            UNDISTORT_PIXEL *pixel = &lut->pixels[y * width + x];
+
+            // Outside of the image
+            if (sx[x] < 0.0f || sy[x] < 0.0f || sx[x] > width - 1 || sy[x] > height - 1) {
+                pixel->x = pixel->y = -1;
+                pixel->fx = pixel->fy = 0;
+                continue;
+            }
+
+            // Top-left pixel and the weights (The last row/column uses the one before)
+            int ix = (int)sx[x], iy = (int)sy[x];
+            int fx = (int)((sx[x] - ix) * scale), fy = (int)((sy[x] - iy) * scale);
+            if (ix > width  - 2) { ix = width  - 2; fx = (int)scale - 1; }
+            if (iy > height - 2) { iy = height - 2; fy = (int)scale - 1; }
+            pixel->x  = (short)ix;
+            pixel->y  = (short)iy;
+            pixel->fx = (unsigned char)fx;
+            pixel->fy = (unsigned char)fy;
+        }
+    }
+
+    // YUV to BGR (Video range)
+    for (int i = 0; i < 256; i++) {
+        lut->tableY[i]  =  298 * (i - 16);
+        lut->tableRV[i] =  409 * (i - 128);
+        lut->tableGU[i] = -100 * (i - 128);
+        lut->tableGV[i] = -208 * (i - 128);
+        lut->tableBU[i] =  516 * (i - 128);
+    }
+
+    // Release the float maps
+    cvReleaseMat(&mapx);
+    cvReleaseMat(&mapy);
+
+    lutUndistort = lut;
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::releaseUndistortion()
+// Release the tables. Call this with mutexVideo locked.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::releaseUndistortion(void)
+{
+    if (!lutUndistort) return;
+
+    cvReleaseMat(&lutUndistort->map1);
+    cvReleaseMat(&lutUndistort->map2);
+    delete [] lutUndistort->pixels;
+    delete lutUndistort;
+    lutUndistort = NULL;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::convertUndistorted()
+// Convert the decoded YUV 4:2:0 frame (pFrame) to BGR (bufferBGR) and remap
+// it in the same pass. Call this with mutexVideo locked and the tables made.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::convertUndistorted(void)
+{
+    const UNDISTORT_LUT *lut = lutUndistort;
+    const int shift = UNDISTORT_FRAC_BITS * 2;
+    const int one   = 1 << UNDISTORT_FRAC_BITS;
+
+    // Planes
+    const uint8_t *planeY = pFrame->data[0], *planeU = pFrame->data[1], *planeV = pFrame->data[2];
+    const int strideY = pFrame->linesize[0], strideU = pFrame->linesize[1], strideV = pFrame->linesize[2];
+
+    for (int y = 0; y < lut->height; y++) {
+        const UNDISTORT_PIXEL *pixel = &lut->pixels[y * lut->width];
+        uint8_t *dst = pFrameBGR->data[0] + y * pFrameBGR->linesize[0];
+
+        for (int x = 0; x < lut->width; x++, pixel++, dst += 3) {
+            // Outside of the image
+            if (pixel->x < 0) {
+                dst[0] = dst[1] = dst[2] = 0;
+                continue;
+            }
+
+            // Luma (Bilinear)
+            const uint8_t *p = planeY + pixel->y * strideY + pixel->x;
+            const int top    = p[0]       * (one - pixel->fx) + p[1]           * pixel->fx;
+            const int bottom = p[strideY] * (one - pixel->fx) + p[strideY + 1] * pixel->fx;
+            const int luma   = (top * (one - pixel->fy) + bottom * pixel->fy + (1 << (shift - 1))) >> shift;
+
+            // Chroma (Nearest, they are half size)
+            const int cx = (pixel->x + (pixel->fx >> (UNDISTORT_FRAC_BITS - 1))) >> 1;
+            const int cy = (pixel->y + (pixel->fy >> (UNDISTORT_FRAC_BITS - 1))) >> 1;
+            const int u = planeU[cy * strideU + cx];
+            const int v = planeV[cy * strideV + cx];
+
+            // Convert to BGR
+            const int c = lut->tableY[luma] + 128;
+            int b = (c + lut->tableBU[u]) >> 8;
+            int g = (c + lut->tableGU[u] + lut->tableGV[v]) >> 8;
+            int r = (c + lut->tableRV[v]) >> 8;
+            dst[0] = (uint8_t)(b < 0 ? 0 : (b > 255 ? 255 : b));
+            dst[1] = (uint8_t)(g < 0 ? 0 : (g > 255 ? 255 : g));
+            dst[2] = (uint8_t)(r < 0 ? 0 : (r > 255 ? 255 : r));
+        }
+    }
+}
\ No newline at end of file
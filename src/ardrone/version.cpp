@@ -1,58 +1,194 @@
 #include "ardrone.h"
 
+// Cache of the version information for each IP address and FTP port
+#define VERSION_CACHE_SIZE (16)
+static struct {
+    char         ip[16];        // IP address
+    int          port;          // Port number of FTP
+    VERSION_INFO version;       // Version information
+    double       tick;          // Time of the probe [ms]
+} versionCache[VERSION_CACHE_SIZE];
+static volatile LONG versionLock = 0;
+static double versionLifetime = ARDRONE_VERSION_LIFETIME;
+
 // --------------------------------------------------------------------------
-// ARDrone::getVersionInfo()
-// Obtaining version information.
-// Return value SUCCESS: 1  FAILED: 0
+// lockVersionCache()
+// Spin lock of the cache. It is held only for a few copies.
+// Return value NONE
 // --------------------------------------------------------------------------
-int ARDrone::getVersionInfo(void)
+static void lockVersionCache(void)
 {
-    const char *filename = "version.txt";
+    while (InterlockedExchange(&versionLock, 1)) Sleep(0);
+}
 
-    // Initialize WinINet
-    HINTERNET hInet = InternetOpen(NULL, INTERNET_OPEN_TYPE_DIRECT, NULL, NULL, 0 );
+// --------------------------------------------------------------------------
+// unlockVersionCache()
+// Release the spin lock.
+// Return value NONE
+// --------------------------------------------------------------------------
+static void unlockVersionCache(void)
+{
+    InterlockedExchange(&versionLock, 0);
+}
 
-    // Set timeout [ms]
-    DWORD ms = 500;
-    InternetSetOption(hInet, INTERNET_OPTION_CONNECT_TIMEOUT, &ms, sizeof(ms));
+// --------------------------------------------------------------------------
+// ftpReply(Control connection, Reply line, Size of the line)
+// Receive an FTP reply. Lines of a multi-line reply ("123-...") are skipped
+// up to the last one ("123 ...").
+// Return value SUCCESS: Reply code  FAILED: 0
+// --------------------------------------------------------------------------
+static int ftpReply(TCPSocket *sock, char *line, int size)
+{
+    while (1) {
+        // Receive a line
+        int n;
+        const char *data = sock->readUntil("\n", &n, ARDRONE_VERSION_TIMEOUT);
+        if (!data) return 0;
 
-    // Connect to FTP server
-    HINTERNET hConnection = InternetConnect(hInet, ip, ARDRONE_VERSION_PORT, "anonymous", "", INTERNET_SERVICE_FTP, INTERNET_FLAG_PASSIVE, 0);
-    if (hConnection == NULL) {
-        printf("ERROR: InternetConnect(port=%d) failed. (%s, %d)\n", ARDRONE_VERSION_PORT, __FILE__, __LINE__);
-        InternetCloseHandle(hInet);
-        return 0;
+        // Copy without "\r\n"
+        while (n > 0 && (data[n - 1] == '\n' || data[n - 1] == '\r')) n--;
+        if (n > size - 1) n = size - 1;
+        memcpy(line, data, n);
+        line[n] = '\0';
+
+        // The last line has a space after the code
+        if (n >= 4 && line[0] >= '1' && line[0] <= '5' && line[3] == ' ') return atoi(line);
     }
+}
+
+// --------------------------------------------------------------------------
+// ftpCommand(Control connection, Command, Reply line, Size of the line)
+// Send an FTP command and receive the reply.
+// Return value SUCCESS: Reply code  FAILED: 0
+// --------------------------------------------------------------------------
+static int ftpCommand(TCPSocket *sock, const char *command, char *line, int size)
+{
+    char buf[256];
+    const int n = _snprintf_s(buf, sizeof(buf), _TRUNCATE, "%s\r\n", command);
+    if (n < 1 || sock->send2(buf, n) != n) return 0;
+    return ftpReply(sock, line, size);
+}
+
+// --------------------------------------------------------------------------
+// ftpGetFile(IP address, Port number, File name, Buffer, Size of the buffer)
+// Download a file into memory with passive mode FTP.
+// Return value SUCCESS: Size of the file  FAILED: -1
+// --------------------------------------------------------------------------
+static int ftpGetFile(const char *ip, int port, const char *filename, char *data, int size)
+{
+    TCPSocket control(1024), transfer(1024);
+    char line[256], command[256];
+
+    // Connect to FTP server
+    if (!control.open(ip, port, ARDRONE_VERSION_TIMEOUT)) return -1;
+    if (ftpReply(&control, line, sizeof(line)) != 220) return -1;
+
+    // Log in as anonymous
+    int code = ftpCommand(&control, "USER anonymous", line, sizeof(line));
+    if (code == 331) code = ftpCommand(&control, "PASS ", line, sizeof(line));
+    if (code != 230) return -1;
+
+    // Binary mode
+    if (ftpCommand(&control, "TYPE I", line, sizeof(line)) != 200) return -1;
+
+    // Passive mode "227 Entering Passive Mode (h1,h2,h3,h4,p1,p2)"
+    if (ftpCommand(&control, "PASV", line, sizeof(line)) != 227) return -1;
+    const char *p = strchr(line, '(');
+    int h[4], pp[2];
+    if (!p || sscanf(p + 1, "%d,%d,%d,%d,%d,%d", &h[0], &h[1], &h[2], &h[3], &pp[0], &pp[1]) != 6) return -1;
+
+    // Open the data connection (The AR.Drone is at the same address)
+    if (!transfer.open(ip, pp[0] * 256 + pp[1], ARDRONE_VERSION_TIMEOUT)) return -1;
 
     // Get the file
-    if (!FtpGetFile(hConnection, filename, filename, FALSE, FILE_ATTRIBUTE_NORMAL, INTERNET_FLAG_TRANSFER_BINARY, 0)) {
-        printf("ERROR: FtpGetFile() failed. (%s, %d)\n", __FILE__, __LINE__);
-        InternetCloseHandle(hConnection);
-        InternetCloseHandle(hInet);
-        return 0;
+    _snprintf_s(command, sizeof(command), _TRUNCATE, "RETR %s", filename);
+    code = ftpCommand(&control, command, line, sizeof(line));
+    if (code != 150 && code != 125) return -1;
+
+    // Receive until the server closes the data connection
+    int length = 0;
+    while (length < size && transfer.wait(ARDRONE_VERSION_TIMEOUT)) {
+        int n = transfer.receive(data + length, size - length);
+        if (n < 1) break;
+        length += n;
     }
-    // 
-    else {
-        // Open the file
-        FILE *file = fopen(filename, "r");
+    transfer.close();
 
-        // Read FW version
-        fscanf(file, "%d.%d.%d\n", &version.major, &version.minor, &version.revision);
+    // Transfer complete
+    if (ftpReply(&control, line, sizeof(line)) != 226) return -1;
+    ftpCommand(&control, "QUIT", line, sizeof(line));
 
-        // Close the file
-        fclose(file);
+    return length;
+}
 
-        // Delete the file
-        remove(filename);
+// --------------------------------------------------------------------------
+// ARDrone::getVersionInfo()
+// Obtaining version information.
+// version.txt is read into memory, and the result is cached for each IP address and port.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::getVersionInfo(void)
+{
+    // Find the cache
+    const double now = ardGetTickCount();
+    lockVersionCache();
+    for (int i = 0; i < VERSION_CACHE_SIZE; i++) {
+        if (versionCache[i].tick > 0.0 && !strcmp(versionCache[i].ip, ip) && versionCache[i].port == ports.version && now - versionCache[i].tick < versionLifetime) {
+            version = versionCache[i].version;
+            unlockVersionCache();
+            return 1;
+        }
     }
+    unlockVersionCache();
 
-    // Finalize WinINet
-    InternetCloseHandle(hConnection);
-    InternetCloseHandle(hInet);
+    // Get the file
+    char data[64];
+    int size = ftpGetFile(ip, ports.version, "version.txt", data, sizeof(data) - 1);
+    if (size < 1) {
+        printf("ERROR: ftpGetFile(port=%d) failed. (%s, %d)\n", ports.version, __FILE__, __LINE__);
+        return 0;
+    }
+    data[size] = '\0';
+
+    // Read FW version
+    ZeroMemory(&version, sizeof(VERSION_INFO));
+    if (sscanf(data, "%d.%d.%d", &version.major, &version.minor, &version.revision) < 1) {
+        printf("ERROR: Invalid version.txt. (%s, %d)\n", __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Save to the cache (The same IP address and port or the oldest)
+    lockVersionCache();
+    int index = 0;
+    for (int i = 0; i < VERSION_CACHE_SIZE; i++) {
+        if (!strcmp(versionCache[i].ip, ip) && versionCache[i].port == ports.version) {
+            index = i;
+            break;
+        }
+        if (versionCache[i].tick < versionCache[index].tick) index = i;
+    }
+    strncpy(versionCache[index].ip, ip, sizeof(versionCache[index].ip));
+    versionCache[index].port    = ports.version;
+    versionCache[index].version = version;
+    versionCache[index].tick    = now;
+    unlockVersionCache();
 
     return 1;
 }
 
+// --------------------------------------------------------------------------
+// ARDrone::setVersionLifetime(Lifetime [ms])
+// Change the lifetime of the cached version information.
+// 0 disables the cache, so the version is probed on every connection.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::setVersionLifetime(double lifetime)
+{
+    lockVersionCache();
+    versionLifetime = (lifetime > 0.0) ? lifetime : 0.0;
+    unlockVersionCache();
+}
+
 // --------------------------------------------------------------------------
 // ARDrone::getVersion()
 // Getting AR.Drone's version.
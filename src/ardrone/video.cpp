@@ -7,6 +7,15 @@
 // - AR.Drone Development - 2.1.2 AR.Drone 2.0 Video Decording: FFMPEG + SDL2.0 -
 //   http://ardrone-ailab-u-tokyo.blogspot.jp/2012/07/212-ardrone-20-video-decording-ffmpeg.html
 
+// Maximum size of a datagram of AR.Drone 1.0
+#define VIDEO_DATAGRAM_SIZE (122880)
+
+// Size of the buffer of the stream given to FFmpeg (AR.Drone 2.0)
+#define VIDEO_PAYLOAD_BUFFER (32768)
+
+// Size of a PaVE header read by ARDrone::readPayload()
+#define VIDEO_PAVE_HEADER   (256)
+
 // --------------------------------------------------------------------------
 // ARDrone::initVideo()
 // Initialize video
@@ -18,7 +27,32 @@ int ARDrone::initVideo(void)
     if (version.major == ARDRONE_VERSION_2) {
         // Open the IP address and port
         char filename[256];
-        sprintf(filename, "http://%s:%d", ip, ARDRONE_VIDEO_PORT);
+        sprintf(filename, "http://%s:%d", ip, ports.video);
+        if (avio_open2(&pStream, filename, AVIO_FLAG_READ, NULL, NULL) < 0) {
+            printf("ERROR: avio_open2() failed. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
+
+        // FFmpeg reads the payloads, and the frame numbers of the PaVE headers are kept
+        posPayload  = 0;
+        sizePayload = 0;
+        indexPaVE   = 0;
+        for (int i = 0; i < ARDRONE_VIDEO_FRAMES; i++) {
+            framesPaVE[i].pos   = -1;
+            framesPaVE[i].frame = -1;
+        }
+        uint8_t *buffer = (uint8_t*)av_malloc(VIDEO_PAYLOAD_BUFFER);
+        if (buffer) pPayload = avio_alloc_context(buffer, VIDEO_PAYLOAD_BUFFER, 0, this, readPayload, NULL, NULL);
+        if (!pPayload) {
+            printf("ERROR: avio_alloc_context() failed. (%s, %d)\n", __FILE__, __LINE__);
+            av_free(buffer);
+            return 0;
+        }
+
+        // Open the stream
+        pFormatCtx = avformat_alloc_context();
+        if (!pFormatCtx) return 0;
+        pFormatCtx->pb = pPayload;
         if (avformat_open_input(&pFormatCtx, filename, NULL, NULL) < 0) {
             printf("ERROR: avformat_open_input() failed. (%s, %d)\n", __FILE__, __LINE__);
             return 0;
@@ -58,8 +92,8 @@ int ARDrone::initVideo(void)
     // AR.Drone 1.0
     else {
         // Open the socket
-        if (!sockVideo.open(ip, ARDRONE_VIDEO_PORT)) {
-            printf("ERROR: UDPSocket::open(port=%d) failed. (%s, %d)\n", ARDRONE_VIDEO_PORT, __FILE__, __LINE__);
+        if (!openSocket(&sockVideo, ports.video, local.video)) {
+            printf("ERROR: ARDrone::openSocket(port=%d) failed. (%s, %d)\n", ports.video, __FILE__, __LINE__);
             return 0;
         }
 
@@ -70,8 +104,23 @@ int ARDrone::initVideo(void)
 
         // Allocate a buffer
         bufferBGR = (uint8_t*)av_malloc(avpicture_get_size(PIX_FMT_BGR24, pCodecCtx->width, pCodecCtx->height));
+
+        // Allocate the buffers of datagrams
+        bufReceive = (uint8_t*)av_malloc(VIDEO_DATAGRAM_SIZE);
+        bufDecode  = (uint8_t*)av_malloc(VIDEO_DATAGRAM_SIZE);
+        if (!bufReceive || !bufDecode) return 0;
+        sizeDecode = 0;
+        busyVideo  = 0;
+
+        // Stamp the datagrams
+        sockVideo.setTimestamp(1);
     }
 
+    // Clear the timestamps
+    ZeroMemory(&timeDecode, sizeof(RECEIVE_TIMESTAMP));
+    ZeroMemory(&timeVideo, sizeof(RECEIVE_TIMESTAMP));
+    timeDecode.frame = timeVideo.frame = -1;
+
     // Allocate an IplImage
     img = cvCreateImage(cvSize(pCodecCtx->width, pCodecCtx->height), IPL_DEPTH_8U, 3);
     if (!img) return 0;
@@ -80,15 +129,30 @@ int ARDrone::initVideo(void)
     // Create a mutex
     mutexVideo = CreateMutex(NULL, FALSE, NULL);
 
-    // Enable thread loop
+    // Enable video
     flagVideo = 1;
 
-    // Create a thread
-    UINT id;
-    threadVideo = (HANDLE)_beginthreadex(NULL, 0, runVideo, this, 0, &id);
-    if (threadVideo == INVALID_HANDLE_VALUE) {
-        printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
-        return 0;
+    // AR.Drone 2.0
+    if (version.major == ARDRONE_VERSION_2) {
+        // Create a thread
+        UINT id;
+        threadVideo = (HANDLE)_beginthreadex(NULL, 0, runVideo, this, 0, &id);
+        if (threadVideo == INVALID_HANDLE_VALUE) {
+            printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
+            return 0;
+        }
+    }
+    // AR.Drone 1.0
+    else {
+        // Start video
+        sockVideo.sendf("\x01\x00\x00\x00");
+
+        // Register to the reactor (The timer repeats the request)
+        if (!Reactor::shared()->add(sockVideo.getSocket(), onVideo, this, ARDRONE_KEEPALIVE_INTERVAL)) {
+            printf("ERROR: Reactor::add() failed. (%s, %d)\n", __FILE__, __LINE__);
+            flagVideo = 0;
+            return 0;
+        }
     }
 
     return 1;
@@ -96,12 +160,18 @@ int ARDrone::initVideo(void)
 
 // --------------------------------------------------------------------------
 // ARDrone::loopVideo()
-// Thread function.
+// Thread function. Only for AR.Drone 2.0.
 // Return value 0
 // --------------------------------------------------------------------------
 UINT ARDrone::loopVideo(void)
 {
     while (flagVideo) {
+        // Read packets for the fleet (av_read_frame() waits for them)
+        if (fleet) {
+            if (!readVideo()) break;
+            continue;
+        }
+
         // Get video stream
         if (!getVideo()) break;
         Sleep(1);
@@ -115,51 +185,306 @@ UINT ARDrone::loopVideo(void)
 
 // --------------------------------------------------------------------------
 // ARDrone::getVideo()
-// Obtaining video stream.
+// Obtaining video stream of AR.Drone 2.0.
 // Return value SUCCESS: 1  FAILED: 0
 // --------------------------------------------------------------------------
 int ARDrone::getVideo(void)
 {
+    // Read a frame (FFmpeg reads the socket, so it arrived when this returned)
+    AVPacket packet;
+    if (av_read_frame(pFormatCtx, &packet) >= 0) {
+        decodePacket(&packet, ardGetTickCount(), findFrame(packet.pos));
+        av_free_packet(&packet);
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::decodePacket(H.264 packet, Time it was read, PaVE frame number)
+// Decode a packet of AR.Drone 2.0 and convert the frame to BGR. A YUV 4:2:0
+// frame is undistorted in the same pass when the undistortion is enabled.
+// Return value Finished a frame: 1  Not yet: 0
+// --------------------------------------------------------------------------
+int ARDrone::decodePacket(AVPacket *packet, double tick, int frame)
+{
+    // Decode the frame
+    int frameFinished = 0;
+    avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, packet);
+
+    // Convert to BGR
+    if (frameFinished) {
+        WaitForSingleObject(mutexVideo, INFINITE);
+        if (pCodecCtx->pix_fmt == PIX_FMT_YUV420P && prepareUndistortion(pCodecCtx->width, pCodecCtx->height)) {
+            convertUndistorted();
+            rectified = 1;
+        }
+        else {
+            sws_scale(pConvertCtx, (const uint8_t* const*)pFrame->data, pFrame->linesize, 0, pCodecCtx->height, pFrameBGR->data, pFrameBGR->linesize);
+            rectified = 0;
+        }
+        timeVideo.arrival = tick;
+        timeVideo.receive = tick;
+        timeVideo.ready   = ardGetTickCount();
+        timeVideo.frame   = frame;
+        ReleaseMutex(mutexVideo);
+    }
+
+    return frameFinished ? 1 : 0;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::readVideo()
+// Read a packet of AR.Drone 2.0 and queue it for the fleet. When the decode
+// threads fall behind, the queue is dropped and restarts at a key frame,
+// since H.264 frames depend on the previous ones.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::readVideo(void)
+{
+    // Read a packet
+    VIDEO_PACKET entry;
+    if (av_read_frame(pFormatCtx, &entry.packet) < 0) {
+        Sleep(1);
+        return 1;
+    }
+    entry.tick  = ardGetTickCount();
+    entry.frame = findFrame(entry.packet.pos);
+
+    // Own the data (The demuxer reuses its buffer)
+    if (av_dup_packet(&entry.packet) < 0) {
+        av_free_packet(&entry.packet);
+        return 1;
+    }
+
+    WaitForSingleObject(mutexPacket, INFINITE);
+
+    // The decode threads are behind
+    if ((int)packets.size() >= ARDRONE_FLEET_PACKETS) {
+        InterlockedExchangeAdd(&droppedVideo, (LONG)packets.size());
+        while (!packets.empty()) {
+            av_free_packet(&packets.front().packet);
+            packets.pop_front();
+        }
+        waitKey = 1;
+    }
+
+    // Wait for a key frame
+    if (waitKey && !(entry.packet.flags & AV_PKT_FLAG_KEY)) {
+        ReleaseMutex(mutexPacket);
+        av_free_packet(&entry.packet);
+        InterlockedIncrement(&droppedVideo);
+        return 1;
+    }
+    waitKey = 0;
+
+    // Queue it
+    packets.push_back(entry);
+    ReleaseMutex(mutexPacket);
+
+    // Wake a decode thread
+    fleet->schedule(fleetIndex);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::decodeQueued(Timestamps of the decoded frame, More work or not)
+// Called by the fleet on one of its threads, never twice at the same time.
+// Decode the datagram of AR.Drone 1.0, or the oldest packet of AR.Drone 2.0.
+// Return value Finished a frame: 1  Not yet: 0
+// --------------------------------------------------------------------------
+int ARDrone::decodeQueued(RECEIVE_TIMESTAMP *timestamp, int *more)
+{
+    *more = 0;
+
     // AR.Drone 2.0
     if (version.major == ARDRONE_VERSION_2) {
-        // Read a frame
-        AVPacket packet;
-        if (av_read_frame(pFormatCtx, &packet) >= 0) {
-            // Decode the frame
-            int frameFinished;
-            avcodec_decode_video2(pCodecCtx, pFrame, &frameFinished, &packet);
-
-            // Convert to BGR
-            if (frameFinished) {
-                WaitForSingleObject(mutexVideo, INFINITE);
-                sws_scale(pConvertCtx, (const uint8_t* const*)pFrame->data, pFrame->linesize, 0, pCodecCtx->height, pFrameBGR->data, pFrameBGR->linesize);
-                ReleaseMutex(mutexVideo);
-            }
+        // Take the oldest packet
+        WaitForSingleObject(mutexPacket, INFINITE);
+        if (packets.empty()) {
+            ReleaseMutex(mutexPacket);
+            return 0;
         }
+        VIDEO_PACKET entry = packets.front();
+        packets.pop_front();
+        *more = !packets.empty();
+        ReleaseMutex(mutexPacket);
+
+        // Decode it
+        const int finished = decodePacket(&entry.packet, entry.tick, entry.frame);
+        av_free_packet(&entry.packet);
+        if (!finished) return 0;
     }
     // AR.Drone 1.0
     else {
-        // Send request
-        sockVideo.sendf("\x01\x00\x00\x00");
+        // Nothing was handed
+        if (!busyVideo) return 0;
+        decodeVideo(this);
+    }
 
-        // Receive data
-        uint8_t buf[122880];
-        int size = sockVideo.receive((void*)&buf, sizeof(buf));
+    // Only this thread writes them
+    *timestamp = timeVideo;
 
-        // Decode video
-        if (size > 0) {
-            WaitForSingleObject(mutexVideo, INFINITE);
-            UVLC::DecodeVideo(buf, size, bufferBGR, &pCodecCtx->width, &pCodecCtx->height);
-            ReleaseMutex(mutexVideo);
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::readPayload(Pointer to ARDrone, Buffer, Size of the buffer)
+// Read callback of the stream given to FFmpeg. Reads the video port of
+// AR.Drone 2.0 and strips the PaVE headers, keeping the frame number with
+// the position of its payload. A payload is never mixed with the next one,
+// so every packet FFmpeg reads starts within one frame. A stream without
+// PaVE headers is given as is.
+// Return value Bytes read (AVERROR_EOF: End of the stream)
+// --------------------------------------------------------------------------
+int ARDrone::readPayload(void *opaque, uint8_t *buf, int size)
+{
+    ARDrone *ardrone = reinterpret_cast<ARDrone*>(opaque);
+
+    // A PaVE header comes
+    while (ardrone->sizePayload == 0) {
+        // Signature, version, codec, size of the header and size of the payload
+        uint8_t header[VIDEO_PAVE_HEADER];
+        if (avio_read(ardrone->pStream, header, 12) != 12) return AVERROR_EOF;
+
+        // Not PaVE
+        if (memcmp(header, "PaVE", 4)) {
+            // Only the beginning of the stream may lack it (The buffer is empty then)
+            if (ardrone->posPayload > 0 || size < 12) {
+                printf("ERROR: Broken PaVE header. (%s, %d)\n", __FILE__, __LINE__);
+                return AVERROR_INVALIDDATA;
+            }
+            ardrone->sizePayload = -1;
+            ardrone->posPayload  = 12;
+            memcpy(buf, header, 12);
+            return 12;
+        }
+
+        // Rest of the header
+        const int sizeHeader  = header[6] | (header[7] << 8);
+        const unsigned int sizeData = header[8] | (header[9] << 8) | (header[10] << 16) | ((unsigned int)header[11] << 24);
+        if (sizeHeader < 28 || sizeHeader > VIDEO_PAVE_HEADER || sizeData > 0x7FFFFFFF) {
+            printf("ERROR: Broken PaVE header. (%s, %d)\n", __FILE__, __LINE__);
+            return AVERROR_INVALIDDATA;
         }
+        if (avio_read(ardrone->pStream, header + 12, sizeHeader - 12) != sizeHeader - 12) return AVERROR_EOF;
+
+        // Keep the frame number (An empty payload is replaced by the next one)
+        const int last = (ardrone->indexPaVE + ARDRONE_VIDEO_FRAMES - 1) % ARDRONE_VIDEO_FRAMES;
+        if (ardrone->framesPaVE[last].pos != ardrone->posPayload) ardrone->indexPaVE = (ardrone->indexPaVE + 1) % ARDRONE_VIDEO_FRAMES;
+        VIDEO_FRAME *entry = &ardrone->framesPaVE[(ardrone->indexPaVE + ARDRONE_VIDEO_FRAMES - 1) % ARDRONE_VIDEO_FRAMES];
+        entry->pos   = ardrone->posPayload;
+        entry->frame = (int)(header[20] | (header[21] << 8) | (header[22] << 16) | ((unsigned int)header[23] << 24));
+        ardrone->sizePayload = (int)sizeData;
     }
 
-    return 1;
+    // Up to the end of the payload
+    if (ardrone->sizePayload > 0 && size > ardrone->sizePayload) size = ardrone->sizePayload;
+    const int n = avio_read(ardrone->pStream, buf, size);
+    if (n <= 0) return AVERROR_EOF;
+    if (ardrone->sizePayload > 0) ardrone->sizePayload -= n;
+    ardrone->posPayload += n;
+
+    return n;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::findFrame(Position of a packet)
+// Find the PaVE frame number of the payload which holds the position.
+// Only called on the thread reading the stream.
+// Return value Frame number (-1: Unknown)
+// --------------------------------------------------------------------------
+int ARDrone::findFrame(int64_t pos)
+{
+    int frame = -1;
+    int64_t found = -1;
+    for (int i = 0; i < ARDRONE_VIDEO_FRAMES; i++) {
+        if (framesPaVE[i].pos >= 0 && framesPaVE[i].pos <= pos && framesPaVE[i].pos > found) {
+            found = framesPaVE[i].pos;
+            frame = framesPaVE[i].frame;
+        }
+    }
+    return frame;
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::clearPackets()
+// Drop the packets waiting for the fleet.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::clearPackets(void)
+{
+    WaitForSingleObject(mutexPacket, INFINITE);
+    while (!packets.empty()) {
+        av_free_packet(&packets.front().packet);
+        packets.pop_front();
+    }
+    waitKey = 0;
+    ReleaseMutex(mutexPacket);
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::onVideo(Pointer to ARDrone, Readable or not)
+// Handler of the reactor for AR.Drone 1.0. Datagrams are decoded on the
+// decode pool (or the fleet), and the ones arriving while it is busy are dropped.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::onVideo(void *arg, int readable)
+{
+    ARDrone *ardrone = reinterpret_cast<ARDrone*>(arg);
+
+    // Request again
+    if (!readable) {
+        ardrone->sockVideo.sendf("\x01\x00\x00\x00");
+        return;
+    }
+
+    // Receive all the queued datagrams
+    int size;
+    while ((size = ardrone->sockVideo.receive(ardrone->bufReceive, VIDEO_DATAGRAM_SIZE)) > 0) {
+        // The decoder is busy
+        if (InterlockedCompareExchange(&ardrone->busyVideo, 1, 0) != 0) {
+            InterlockedIncrement(&ardrone->droppedVideo);
+            continue;
+        }
+
+        // Hand the datagram to the decoder
+        uint8_t *tmp = ardrone->bufDecode;
+        ardrone->bufDecode  = ardrone->bufReceive;
+        ardrone->bufReceive = tmp;
+        ardrone->sizeDecode = size;
+        ardrone->timeDecode.arrival = Reactor::shared()->getWakeTime();
+        ardrone->timeDecode.receive = ardrone->sockVideo.getTimestamp();
+        if (ardrone->fleet) ardrone->fleet->schedule(ardrone->fleetIndex);
+        else if (!WorkerPool::decoder()->submit(decodeVideo, ardrone)) InterlockedExchange(&ardrone->busyVideo, 0);
+    }
+}
+
+// --------------------------------------------------------------------------
+// ARDrone::decodeVideo(Pointer to ARDrone)
+// Task of the decode pool. Decode the datagram of AR.Drone 1.0.
+// Return value NONE
+// --------------------------------------------------------------------------
+void ARDrone::decodeVideo(void *arg)
+{
+    ARDrone *ardrone = reinterpret_cast<ARDrone*>(arg);
+
+    // Decode video
+    WaitForSingleObject(ardrone->mutexVideo, INFINITE);
+    UVLC::DecodeVideo(ardrone->bufDecode, ardrone->sizeDecode, ardrone->bufferBGR, &ardrone->pCodecCtx->width, &ardrone->pCodecCtx->height);
+    ardrone->timeVideo = ardrone->timeDecode;
+    ardrone->timeVideo.ready = ardGetTickCount();
+    ReleaseMutex(ardrone->mutexVideo);
+
+    // Ready for the next one
+    InterlockedExchange(&ardrone->busyVideo, 0);
 }
 
 // --------------------------------------------------------------------------
 // ARDrone::getImage()
-// Obtaining a frame from your AR.Drone.
+// Obtaining a frame from your AR.Drone. When the undistortion is enabled and
+// the frame is not undistorted yet, it is remapped instead of copied.
 // Return value IplImage
 // --------------------------------------------------------------------------
 IplImage* ARDrone::getImage(void)
@@ -171,7 +496,13 @@ IplImage* ARDrone::getImage(void)
     if (version.major == ARDRONE_VERSION_2) {
         // Copy the frame to the IplImage
         WaitForSingleObject(mutexVideo, INFINITE);
-        memcpy(img->imageData, pFrameBGR->data[0], pCodecCtx->width * pCodecCtx->height * sizeof(uint8_t) * 3);
+        if (!rectified && prepareUndistortion(pCodecCtx->width, pCodecCtx->height)) {
+            IplImage *frame = cvCreateImageHeader(cvSize(pCodecCtx->width, pCodecCtx->height), IPL_DEPTH_8U, 3);
+            frame->imageData = (char*)pFrameBGR->data[0];
+            cvRemap(frame, img, lutUndistort->map1, lutUndistort->map2, CV_INTER_LINEAR|CV_WARP_FILL_OUTLIERS);
+            cvReleaseImageHeader(&frame);
+        }
+        else memcpy(img->imageData, pFrameBGR->data[0], pCodecCtx->width * pCodecCtx->height * sizeof(uint8_t) * 3);
         ReleaseMutex(mutexVideo);
     }
     // AR.Drone 1.0
@@ -181,8 +512,15 @@ IplImage* ARDrone::getImage(void)
 
         // If the sizes of buffer and IplImage are the same
         if (pCodecCtx->width == img->width && pCodecCtx->height == img->height) {
+            // Undistort the buffer to the IplImage
+            if (prepareUndistortion(pCodecCtx->width, pCodecCtx->height)) {
+                IplImage *frame = cvCreateImageHeader(cvSize(pCodecCtx->width, pCodecCtx->height), IPL_DEPTH_8U, 3);
+                frame->imageData = (char*)bufferBGR;
+                cvRemap(frame, img, lutUndistort->map1, lutUndistort->map2, CV_INTER_LINEAR|CV_WARP_FILL_OUTLIERS);
+                cvReleaseImageHeader(&frame);
+            }
             // Copy the buffer to the IplImage
-            memcpy(img->imageData, bufferBGR, pCodecCtx->width * pCodecCtx->height * sizeof(uint8_t) * 3);
+            else memcpy(img->imageData, bufferBGR, pCodecCtx->width * pCodecCtx->height * sizeof(uint8_t) * 3);
         }
         // If the sizes are different
         else {
@@ -200,6 +538,22 @@ IplImage* ARDrone::getImage(void)
     return img;
 }
 
+// --------------------------------------------------------------------------
+// ARDrone::getImageTimestamp(Timestamps)
+// Obtaining when the latest image arrived, was read and was decoded.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int ARDrone::getImageTimestamp(RECEIVE_TIMESTAMP *timestamp)
+{
+    if (!timestamp || mutexVideo == INVALID_HANDLE_VALUE) return 0;
+
+    WaitForSingleObject(mutexVideo, INFINITE);
+    *timestamp = timeVideo;
+    ReleaseMutex(mutexVideo);
+
+    return (timestamp->receive > 0.0);
+}
+
 // --------------------------------------------------------------------------
 // ARDrone::finalizeVideo()
 // Finalize video.
@@ -217,6 +571,16 @@ void ARDrone::finalizeVideo(void)
         threadVideo = INVALID_HANDLE_VALUE;
     }
 
+    // Unregister from the reactor and wait for the decoder
+    if (version.major != ARDRONE_VERSION_2 && sockVideo.getSocket() != INVALID_SOCKET) {
+        Reactor::shared()->remove(sockVideo.getSocket());
+        while (busyVideo) Sleep(1);
+    }
+
+    // Drop the queued packets and wait for the fleet
+    clearPackets();
+    if (fleet) fleet->wait(fleetIndex);
+
     // Delete the mutex
     if (mutexVideo != INVALID_HANDLE_VALUE) {
         CloseHandle(mutexVideo);
@@ -266,6 +630,19 @@ void ARDrone::finalizeVideo(void)
             avformat_close_input(&pFormatCtx);
             pFormatCtx = NULL;
         }
+
+        // Deallocate the stream given to FFmpeg (FFmpeg may have replaced the buffer)
+        if (pPayload) {
+            av_free(pPayload->buffer);
+            av_free(pPayload);
+            pPayload = NULL;
+        }
+
+        // Close the video port
+        if (pStream) {
+            avio_close(pStream);
+            pStream = NULL;
+        }
     }
     // AR.Drone 1.0
     else {
@@ -275,6 +652,16 @@ void ARDrone::finalizeVideo(void)
             bufferBGR = NULL;
         }
 
+        // Deallocate the buffers of datagrams
+        if (bufReceive) {
+            av_free(bufReceive);
+            bufReceive = NULL;
+        }
+        if (bufDecode) {
+            av_free(bufDecode);
+            bufDecode = NULL;
+        }
+
         // Deallocate the codec
         if (pCodecCtx) {
             avcodec_close(pCodecCtx);
@@ -0,0 +1,305 @@
+#include "ardrone.h"
+
+// --------------------------------------------------------------------------
+// VideoRecorder::VideoRecorder()
+// Constructor of VideoRecorder class. This will be called when you create it.
+// --------------------------------------------------------------------------
+VideoRecorder::VideoRecorder()
+{
+    // Video writer
+    writer = NULL;
+
+    // Queue
+    slots    = NULL;
+    spare    = NULL;
+    current  = NULL;
+    numSlots = 0;
+    head     = 0;
+    count    = 0;
+    policy   = VIDEO_RECORDER_DROP_OLDEST;
+
+    // Counters
+    queued  = 0;
+    written = 0;
+    dropped = 0;
+
+    // Thread for writing
+    mutexQueue  = INVALID_HANDLE_VALUE;
+    eventFrame  = INVALID_HANDLE_VALUE;
+    eventSpace  = INVALID_HANDLE_VALUE;
+    flagWrite   = 0;
+    threadWrite = INVALID_HANDLE_VALUE;
+}
+
+// --------------------------------------------------------------------------
+// VideoRecorder::~VideoRecorder()
+// Destructor of VideoRecorder class. This will be called when you destroy it.
+// --------------------------------------------------------------------------
+VideoRecorder::~VideoRecorder()
+{
+    close();
+}
+
+// --------------------------------------------------------------------------
+// VideoRecorder::open(File name, FourCC, Frame rate, Frame size, Number of frames of the queue, Policy)
+// Create a video file and start the writing thread. All the frames of the queue
+// are allocated here.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int VideoRecorder::open(const char *filename, int fourcc, double fps, CvSize size, int queueSize, int policy)
+{
+    // Already opened
+    if (writer) close();
+
+    // Create a video writer
+    writer = cvCreateVideoWriter(filename, fourcc, fps, size);
+    if (!writer) {
+        printf("ERROR: cvCreateVideoWriter(%s) failed. (%s, %d)\n", filename, __FILE__, __LINE__);
+        return 0;
+    }
+
+    // Allocate the queue
+    numSlots = (queueSize > 0) ? queueSize : 1;
+    slots = new IplImage*[numSlots];
+    for (int i = 0; i < numSlots; i++) slots[i] = cvCreateImage(size, IPL_DEPTH_8U, 3);
+    spare   = cvCreateImage(size, IPL_DEPTH_8U, 3);
+    current = cvCreateImage(size, IPL_DEPTH_8U, 3);
+    int allocated = (spare && current);
+    for (int i = 0; i < numSlots; i++) if (!slots[i]) allocated = 0;
+    if (!allocated) {
+        printf("ERROR: cvCreateImage() failed. (%s, %d)\n", __FILE__, __LINE__);
+        close();
+        return 0;
+    }
+    head    = 0;
+    count   = 0;
+    this->policy = policy;
+
+    // Reset counters
+    queued  = 0;
+    written = 0;
+    dropped = 0;
+
+    // Create a mutex and events
+    mutexQueue = CreateMutex(NULL, FALSE, NULL);
+    eventFrame = CreateEvent(NULL, FALSE, FALSE, NULL);
+    eventSpace = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    // Enable thread loop
+    flagWrite = 1;
+
+    // Create a thread
+    UINT id;
+    threadWrite = (HANDLE)_beginthreadex(NULL, 0, runWrite, this, 0, &id);
+    if (threadWrite == INVALID_HANDLE_VALUE || threadWrite == 0) {
+        printf("ERROR: _beginthreadex() failed. (%s, %d)\n", __FILE__, __LINE__);
+        threadWrite = INVALID_HANDLE_VALUE;
+        close();
+        return 0;
+    }
+
+    // Encoding should not disturb the control loop
+    SetThreadPriority(threadWrite, THREAD_PRIORITY_BELOW_NORMAL);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// VideoRecorder::write(Image)
+// Copy a frame into the queue. Only one thread may call this. An image of
+// another size is resized.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+int VideoRecorder::write(const IplImage *image)
+{
+    // Not opened
+    if (!writer || !image) return 0;
+
+    // Copy the frame outside of the lock
+    if (image->width == spare->width && image->height == spare->height && image->nChannels == 3) cvCopy(image, spare);
+    else if (image->nChannels == 3) cvResize(image, spare);
+    else {
+        dropped++;
+        return 0;
+    }
+
+    // Enable mutex lock
+    WaitForSingleObject(mutexQueue, INFINITE);
+
+    // The queue is full
+    while (count == numSlots) {
+        // Drop the oldest one
+        if (policy == VIDEO_RECORDER_DROP_OLDEST) {
+            head = (head + 1) % numSlots;
+            count--;
+            dropped++;
+        }
+        // Wait for the thread
+        else {
+            ReleaseMutex(mutexQueue);
+            WaitForSingleObject(eventSpace, INFINITE);
+            WaitForSingleObject(mutexQueue, INFINITE);
+        }
+    }
+
+    // Put it at the tail
+    const int tail = (head + count) % numSlots;
+    IplImage *swap = slots[tail];
+    slots[tail] = spare;
+    spare = swap;
+    count++;
+    queued++;
+
+    // Disable mutex lock
+    ReleaseMutex(mutexQueue);
+
+    // Wake up the thread
+    SetEvent(eventFrame);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// VideoRecorder::loopWrite()
+// Thread function. Writes the queued frames until the queue is empty and the
+// loop is disabled.
+// Return value 0
+// --------------------------------------------------------------------------
+UINT VideoRecorder::loopWrite(void)
+{
+    while (1) {
+        // Enable mutex lock
+        WaitForSingleObject(mutexQueue, INFINITE);
+
+        // Nothing to write
+        if (count == 0) {
+            ReleaseMutex(mutexQueue);
+            if (!flagWrite) break;
+            WaitForSingleObject(eventFrame, INFINITE);
+            continue;
+        }
+
+        // Take the oldest one
+        IplImage *swap = slots[head];
+        slots[head] = current;
+        current = swap;
+        head = (head + 1) % numSlots;
+        count--;
+
+        // Disable mutex lock
+        ReleaseMutex(mutexQueue);
+
+        // write() may be waiting for a free slot
+        SetEvent(eventSpace);
+
+        // Encode and write it
+        cvWriteFrame(writer, current);
+        InterlockedIncrement(&written);
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// VideoRecorder::close()
+// Write the queued frames and finalize the file.
+// Return value NONE
+// --------------------------------------------------------------------------
+void VideoRecorder::close(void)
+{
+    // Disable the loop
+    flagWrite = 0;
+
+    // Destroy the thread (after it writes the rest)
+    if (threadWrite != INVALID_HANDLE_VALUE) {
+        SetEvent(eventFrame);
+        WaitForSingleObject(threadWrite, INFINITE);
+        CloseHandle(threadWrite);
+        threadWrite = INVALID_HANDLE_VALUE;
+    }
+
+    // Delete the mutex and events
+    if (mutexQueue != INVALID_HANDLE_VALUE) {
+        CloseHandle(mutexQueue);
+        mutexQueue = INVALID_HANDLE_VALUE;
+    }
+    if (eventFrame != INVALID_HANDLE_VALUE) {
+        CloseHandle(eventFrame);
+        eventFrame = INVALID_HANDLE_VALUE;
+    }
+    if (eventSpace != INVALID_HANDLE_VALUE) {
+        CloseHandle(eventSpace);
+        eventSpace = INVALID_HANDLE_VALUE;
+    }
+
+    // Finalize the file
+    if (writer) cvReleaseVideoWriter(&writer);
+
+    // Release the queue
+    if (slots) {
+        for (int i = 0; i < numSlots; i++) cvReleaseImage(&slots[i]);
+        delete [] slots;
+        slots = NULL;
+    }
+    if (spare)   cvReleaseImage(&spare);
+    if (current) cvReleaseImage(&current);
+    numSlots = 0;
+    head     = 0;
+    count    = 0;
+}
+
+// --------------------------------------------------------------------------
+// VideoRecorder::isOpen()
+// Check recording or not.
+// Return value YES:1 NO:0
+// --------------------------------------------------------------------------
+int VideoRecorder::isOpen(void)
+{
+    return (writer != NULL);
+}
+
+// --------------------------------------------------------------------------
+// VideoRecorder::getQueued()
+// Obtaining the number of frames accepted by write().
+// Return value Number of frames
+// --------------------------------------------------------------------------
+unsigned int VideoRecorder::getQueued(void)
+{
+    return (unsigned int)queued;
+}
+
+// --------------------------------------------------------------------------
+// VideoRecorder::getWritten()
+// Obtaining the number of frames written to the file.
+// Return value Number of frames
+// --------------------------------------------------------------------------
+unsigned int VideoRecorder::getWritten(void)
+{
+    return (unsigned int)written;
+}
+
+// --------------------------------------------------------------------------
+// VideoRecorder::getDropped()
+// Obtaining the number of dropped frames.
+// Return value Number of frames
+// --------------------------------------------------------------------------
+unsigned int VideoRecorder::getDropped(void)
+{
+    return (unsigned int)dropped;
+}
+
+// --------------------------------------------------------------------------
+// VideoRecorder::getPending()
+// Obtaining the number of frames waiting in the queue.
+// Return value Number of frames
+// --------------------------------------------------------------------------
+int VideoRecorder::getPending(void)
+{
+    if (mutexQueue == INVALID_HANDLE_VALUE) return 0;
+
+    WaitForSingleObject(mutexQueue, INFINITE);
+    const int n = count;
+    ReleaseMutex(mutexQueue);
+
+    return n;
+}
\ No newline at end of file
@@ -5,9 +5,9 @@
 
 
 
-// AR.Drone class
-ARDrone ardrone1("192.168.1.112");
-ARDrone ardrone2("192.168.1.122");
+// AR.Drone class (Opened in main())
+ARDrone ardrone1;
+ARDrone ardrone2;
 
 XboxController* player1;
 
@@ -191,45 +191,54 @@ int main(int argc, char **argv)
 {
 	player1 = new XboxController(1);
 
-    // Initialize
-    /*if (!ardrone1.open()) 
+	// The second drone uses free local ports,
+	// so that both of them can receive Navdata and video
+	ARDRONE_PORTS local = {0, 0, 0, 0, 0};
+	ardrone2.setLocalPorts(&local);
+
+	// Initialize both at the same time
+	if (!ardrone1.openAsync("192.168.1.112") || !ardrone2.openAsync("192.168.1.122"))
 	{
-        printf("Failed to find AR.Drone 1. Please ensure that the drone is connected via WiFi.\n");
+		printf("Failed to start the initialization.\n");
 		system("Pause");
-        return -1;
-    }*/
-	
-    /*if (!ardrone2.open()) 
+		return -1;
+	}
+	if (ardrone1.waitOpen() != 1)
 	{
-        printf("Failed to find AR.Drone 2. Please ensure that the drone is connected via WiFi.\n");
+		printf("Failed to find AR.Drone 1. Please ensure that the drone is connected via WiFi.\n");
+		ardrone2.close();
 		system("Pause");
-        return -1;
-    }*/
-    // Update your AR.Drone
-    if (!ardrone1.update())
+		return -1;
+	}
+	if (ardrone2.waitOpen() != 1)
 	{
-		printf("This AR.Drone is not up to date, please update the AR.Drone before use.\n");
+		printf("Failed to find AR.Drone 2. Please ensure that the drone is connected via WiFi.\n");
+		ardrone1.close();
 		system("Pause");
-        return -1;
+		return -1;
 	}
-    // Main loop
-    while (!GetAsyncKeyState(VK_ESCAPE)) 
+
+	// Main loop
+	while (!GetAsyncKeyState(VK_ESCAPE))
 	{
-        // Get an image
-        IplImage *image1 = ardrone1.getImage();
-        IplImage *image2 = ardrone2.getImage();
+		// Update your AR.Drones
+		if (!ardrone1.update() || !ardrone2.update()) break;
+
+		// Get images
+		IplImage *image1 = ardrone1.getImage();
+		IplImage *image2 = ardrone2.getImage();
 
 		controls();
 		display();
 
-        // Display the image
-        cvShowImage("camera", image1);
-        cvShowImage("camera", image2);
-        cvWaitKey(1);
-    }
-	
-    ardrone1.close();
-    ardrone2.close();
-	
-    return 0;
+		// Display the images
+		cvShowImage("camera1", image1);
+		cvShowImage("camera2", image2);
+		cvWaitKey(1);
+	}
+
+	ardrone1.close();
+	ardrone2.close();
+
+	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "ardrone/ardrone.h"
+#include <intrin.h>
+
+// Benchmark settings
+#define NUM_COMMANDS    (1000000)       // Number of AT*PCMD to encode
+#define NUM_VALUES      (1024)          // Number of random set points
+
+// --------------------------------------------------------------------------
+// encodeWithPrintf(Output buffer, Size of the buffer, Sequence number, Mode, Set point)
+// AT*PCMD with vsprintf_s() and strlen() like UDPSocket::sendf().
+// Return value Size of the command
+// --------------------------------------------------------------------------
+static int encodeWithPrintf(char *buf, int size, int seq, int mode, const float *v)
+{
+    int bits[4];
+    memcpy(bits, v, sizeof(bits));
+    sprintf_s(buf, size, "AT*PCMD=%d,%d,%d,%d,%d,%d\r", seq, mode, bits[0], bits[1], bits[2], bits[3]);
+    return (int)strlen(buf);
+}
+
+// --------------------------------------------------------------------------
+// encodeWithEncoder(Output buffer, Size of the buffer, Sequence number, Mode, Set point)
+// AT*PCMD with ATEncoder as the command thread does.
+// Return value Size of the command
+// --------------------------------------------------------------------------
+static int encodeWithEncoder(char *buf, int size, int seq, int mode, const float *v)
+{
+    char tmp[ATCMD_ENTRY_SIZE];
+    ATEncoder encoder(tmp, sizeof(tmp));
+    encoder.command(ATCMD_PCMD).arg(mode).arg(v[0]).arg(v[1]).arg(v[2]).arg(v[3]).end();
+    return ATEncoder::expand(buf, size, encoder.data(), encoder.size(), &seq);
+}
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Value of arguments)
+// This is the main function.
+// Compares the cost of AT*PCMD formatting and checks the outputs are identical.
+// Return value Success:0 Error:-1
+// --------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    // Run on one core
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+
+    // Random set points like move3D() makes
+    static float values[NUM_VALUES][4];
+    static int   modes[NUM_VALUES];
+    srand(0);
+    for (int i = 0; i < NUM_VALUES; i++) {
+        for (int j = 0; j < 4; j++) values[i][j] = (float)((rand() % 2001) - 1000) * 0.0004f;
+        modes[i] = rand() % 2;
+    }
+
+    // Check the outputs are bit-exact
+    char buf1[ATCMD_DATAGRAM_SIZE], buf2[ATCMD_DATAGRAM_SIZE];
+    for (int i = 0; i < NUM_VALUES * 16; i++) {
+        const int k = i % NUM_VALUES;
+        const int seq = (i & 1) ? i : -i;
+        const int n1 = encodeWithPrintf(buf1, sizeof(buf1), seq, modes[k], values[k]);
+        const int n2 = encodeWithEncoder(buf2, sizeof(buf2), seq, modes[k], values[k]);
+        if (n1 != n2 || memcmp(buf1, buf2, n1)) {
+            buf1[n1] = buf2[n2] = '\0';
+            printf("ERROR: Outputs differ.\n  printf : %s\n  encoder: %s\n", buf1, buf2);
+            return -1;
+        }
+    }
+    printf("Outputs are identical.\n");
+
+    // vsprintf_s
+    int total = 0;
+    double start = ardGetTickCount();
+    unsigned __int64 cycles = __rdtsc();
+    for (int i = 0; i < NUM_COMMANDS; i++) {
+        const int k = i & (NUM_VALUES - 1);
+        total += encodeWithPrintf(buf1, sizeof(buf1), i + 1, modes[k], values[k]);
+    }
+    const double cycles1 = (double)(__rdtsc() - cycles) / NUM_COMMANDS;
+    const double time1 = (ardGetTickCount() - start) * 1000000.0 / NUM_COMMANDS;
+
+    // ATEncoder
+    start = ardGetTickCount();
+    cycles = __rdtsc();
+    for (int i = 0; i < NUM_COMMANDS; i++) {
+        const int k = i & (NUM_VALUES - 1);
+        total += encodeWithEncoder(buf2, sizeof(buf2), i + 1, modes[k], values[k]);
+    }
+    const double cycles2 = (double)(__rdtsc() - cycles) / NUM_COMMANDS;
+    const double time2 = (ardGetTickCount() - start) * 1000000.0 / NUM_COMMANDS;
+
+    // Result
+    printf("Commands   = %d (%d bytes)\n", NUM_COMMANDS, total / 2);
+    printf("vsprintf_s = %.1f [cycles/PCMD] (%.1f [ns])\n", cycles1, time1);
+    printf("ATEncoder  = %.1f [cycles/PCMD] (%.1f [ns])\n", cycles2, time2);
+    printf("Speed up   = %.1f x\n", cycles1 / cycles2);
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "ardrone/ardrone.h"
+
+#define KEY_DOWN(key) (GetAsyncKeyState(key) & 0x8000)
+#define KEY_PUSH(key) (GetAsyncKeyState(key) & 0x0001)
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Value of arguments)
+// This is the main function.
+// Return value Success:0 Error:-1
+// --------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    // AR.Drone class
+    ARDrone ardrone;
+
+    // Initialize
+    if (!ardrone.open()) {
+        printf("Failed to initialize.\n");
+        return -1;
+    }
+
+    // Color blob tracker (Red, allocates the buffers on the first frame)
+    ColorBlobTracker tracker;
+    tracker.setRange(cvScalar(170, 120, 60), cvScalar(10, 255, 255));
+    double total = 0.0;
+    int frames = 0;
+
+    // Main loop
+    while (!GetAsyncKeyState(VK_ESCAPE)) {
+        // Update your AR.Drone
+        if (!ardrone.update()) break;
+
+        // Getting an image
+        IplImage *image = ardrone.getImage();
+
+        // Take off / Landing
+        if (KEY_PUSH(VK_SPACE)) {
+            if (ardrone.onGround()) ardrone.takeoff();
+            else                    ardrone.landing();
+        }
+
+        // Track the blob
+        const double start = ardGetTickCount();
+        COLOR_BLOB blob;
+        tracker.update(image);
+        tracker.getBlob(&blob);
+        total += ardGetTickCount() - start;
+        tracker.draw(image);
+
+        // AR.Drone is flying
+        if (!ardrone.onGround()) {
+            // Turn to the blob
+            double vx = 0.0, vy = 0.0, vz = 0.0, vr = 0.0;
+            if (blob.found) vr = -0.5 * (blob.center.x - image->width / 2) / (image->width / 2);
+
+            // Move
+            if (KEY_DOWN(VK_UP))    vx =  0.5;
+            if (KEY_DOWN(VK_DOWN))  vx = -0.5;
+            if (KEY_DOWN(VK_LEFT))  vr =  0.5;
+            if (KEY_DOWN(VK_RIGHT)) vr = -0.5;
+            if (KEY_DOWN('Q'))      vz =  0.5;
+            if (KEY_DOWN('A'))      vz = -0.5;
+            ardrone.move3D(vx, vy, vz, vr);
+        }
+
+        // Tracking time
+        if (++frames == 100) {
+            const CvRect area = tracker.getSearchArea();
+            printf("Area %.0f [px] at (%.1f, %.1f), search %dx%d, %.3f [ms/frame]\n", blob.area, blob.center.x, blob.center.y, area.width, area.height, total / frames);
+            total = 0.0;
+            frames = 0;
+        }
+
+        // Display the image
+        cvShowImage("camera", image);
+        cvShowImage("mask", tracker.getMask());
+        cvWaitKey(1);
+    }
+
+    // See you
+    ardrone.close();
+
+    return 0;
+}
\ No newline at end of file
@@ -12,7 +12,71 @@
 #define PAT_SIZE   (PAT_ROW*PAT_COL)
 #define CHESS_SIZE (24.0)               // Size of a pattern [mm]
 
+// Undistortion
+#define CAMERA_FILE "camera.xml"        // Camera parameters
+#define MAP_FILE    "camera.map"        // Cache of the fixed-point remap tables
+#define MAP_MAGIC   (0x3150414D)        // "MAP1"
+#define MAX_BANDS   (16)                // Maximum number of bands of the undistortion
+
+// Tasks on the shared worker pool and their join
+struct JOIN {
+    volatile LONG pending;              // Running tasks
+    HANDLE        done;                 // Set when all of them finished
+};
+
+// --------------------------------------------------------------------------
+// joinStart(Join, Number of tasks)
+// Prepare to wait for the tasks. The event is created by the first call.
+// Return value NONE
+// --------------------------------------------------------------------------
+static void joinStart(JOIN *join, int num)
+{
+    join->pending = num;
+    if (!join->done) join->done = CreateEvent(NULL, TRUE, FALSE, NULL);
+    ResetEvent(join->done);
+}
+
+// --------------------------------------------------------------------------
+// joinFinish(Join)
+// Called by each task when it finished.
+// Return value NONE
+// --------------------------------------------------------------------------
+static void joinFinish(JOIN *join)
+{
+    if (InterlockedDecrement(&join->pending) == 0) SetEvent(join->done);
+}
+
+// --------------------------------------------------------------------------
+// joinWait(Join)
+// Wait for all the tasks.
+// Return value NONE
+// --------------------------------------------------------------------------
+static void joinWait(JOIN *join)
+{
+    WaitForSingleObject(join->done, INFINITE);
+}
+
+
 #if CALIB_MODE
+// A captured image of the pattern
+struct SAMPLE {
+    IplImage     *gray;                 // Grayscale image
+    CvPoint2D32f corners[PAT_SIZE];     // Corners found while capturing
+    JOIN         *join;                 // Join of the refinement
+};
+
+// --------------------------------------------------------------------------
+// refineCorners(Sample)
+// Task of the worker pool. Convert the corners of a sample to sub-pixel.
+// Return value NONE
+// --------------------------------------------------------------------------
+static void refineCorners(void *arg)
+{
+    SAMPLE *sample = (SAMPLE*)arg;
+    cvFindCornerSubPix(sample->gray, sample->corners, PAT_SIZE, cvSize(3, 3), cvSize(-1, -1), cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 20, 0.03));
+    joinFinish(sample->join);
+}
+
 // --------------------------------------------------------------------------
 // main(Number of arguments, Value of arguments)
 // This is the main function.
@@ -29,8 +93,8 @@ int main(int argc, char **argv)
         return -1;
     }
 
-    // Images
-    std::vector<IplImage*> images;
+    // Samples
+    std::vector<SAMPLE*> samples;
     printf("Press space key to take a sample picture !\n");
 
     // Main loop
@@ -44,34 +108,35 @@ int main(int argc, char **argv)
         // If you push Space key,
         if (KEY_PUSH(VK_SPACE)) {
             // Convert the camera image to grayscale
-            IplImage *gray = cvCreateImage(cvGetSize(image), IPL_DEPTH_8U, 1);
-            cvCvtColor(image, gray, CV_BGR2GRAY);
+            SAMPLE *sample = new SAMPLE;
+            sample->gray = cvCreateImage(cvGetSize(image), IPL_DEPTH_8U, 1);
+            cvCvtColor(image, sample->gray, CV_BGR2GRAY);
 
             // Detect the chessboard
             int corner_count = 0;
             CvSize size = cvSize(PAT_COL, PAT_ROW);
-            CvPoint2D32f corners[PAT_SIZE];
-            int found = cvFindChessboardCorners(gray, size, corners, &corner_count);
+            int found = cvFindChessboardCorners(sample->gray, size, sample->corners, &corner_count);
 
-            // Success
-            if (found) {
+            // Success (Keep the corners, they are refined when saved)
+            if (found && corner_count == PAT_SIZE) {
                 // Draw corners.
-                cvDrawChessboardCorners(image, size, corners, corner_count, found);
+                cvDrawChessboardCorners(image, size, sample->corners, corner_count, found);
 
                 // Add to buffer.
-                images.push_back(gray);
+                samples.push_back(sample);
                 //Beep(3000, 100);
             }
             // Failed to detect
             else {
                 // Release the image.
-                cvReleaseImage(&gray);
+                cvReleaseImage(&sample->gray);
+                delete sample;
                 //Beep(100, 100);
             }
         }
 
         // Display the image
-        cvDrawText(image, cvPoint(15, 20), "NUM = %d", (int)images.size());
+        cvDrawText(image, cvPoint(15, 20), "NUM = %d", (int)samples.size());
         cvShowImage("camera", image);
         cvWaitKey(1);
     }
@@ -80,33 +145,28 @@ int main(int argc, char **argv)
     cvDestroyWindow("camera");
 
     // At least one image was taken
-    if (!images.empty()) {
+    if (!samples.empty()) {
         // Total number of images.
-        const int num = (int)images.size();
-
-        //// For debug
-        //for (int i = 0; i < num; i++) {
-        //    char name[256];
-        //    sprintf(name, "images[%d/%d]", i+1, num);
-        //    cvShowImage(name, images[i]);
-        //    cvWaitKey(0);
-        //    cvDestroyWindow(name);
-        //}
+        const int num = (int)samples.size();
 
         // Ask save parameters or not
         if (ardAsk("Do you save the camera parameters ?\n")) {
-            // Detect coners
+            // Convert the corners to sub-pixel (All the images at the same time)
+            JOIN join = {0, NULL};
+            joinStart(&join, num);
+            for (int i = 0; i < num; i++) {
+                samples[i]->join = &join;
+                if (!WorkerPool::shared()->submit(refineCorners, samples[i])) refineCorners(samples[i]);
+            }
+            joinWait(&join);
+            CloseHandle(join.done);
+
+            // Gather the corners
             int *p_count = (int*)malloc(sizeof(int) * num);
             CvPoint2D32f *corners = (CvPoint2D32f*)cvAlloc(sizeof(CvPoint2D32f) * num * PAT_SIZE);
             for (int i = 0; i < num; i++) {
-                // Detect chessboard
-                int corner_count = 0;
-                CvSize size = cvSize(PAT_COL, PAT_ROW);
-                int found = cvFindChessboardCorners(images[i], size, &corners[i * PAT_SIZE], &corner_count);
-
-                // Convert the corners to sub-pixel
-                cvFindCornerSubPix(images[i], &corners[i * PAT_SIZE], corner_count, cvSize(3, 3), cvSize(-1, -1), cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 20, 0.03));
-                p_count[i] = corner_count;
+                memcpy(&corners[i * PAT_SIZE], samples[i]->corners, sizeof(CvPoint2D32f) * PAT_SIZE);
+                p_count[i] = PAT_SIZE;
             }
 
             // Set the 3D position of patterns
@@ -131,12 +191,12 @@ int main(int argc, char **argv)
             printf("Calicurating parameters...");
             CvMat *intrinsic   = cvCreateMat(3, 3, CV_32FC1);
             CvMat *distortion  = cvCreateMat(1, 4, CV_32FC1);
-            cvCalibrateCamera2(&object_points, &image_points, &point_counts, cvGetSize(images[0]), intrinsic, distortion);
+            cvCalibrateCamera2(&object_points, &image_points, &point_counts, cvGetSize(samples[0]->gray), intrinsic, distortion);
             printf("Finished !\n");
 
-            // Output a file
+            // Output a file (The remap tables are made again from it)
             printf("Generating a XML file...");
-            CvFileStorage *fs = cvOpenFileStorage("camera.xml", 0, CV_STORAGE_WRITE);
+            CvFileStorage *fs = cvOpenFileStorage(CAMERA_FILE, 0, CV_STORAGE_WRITE);
             cvWrite(fs, "intrinsic", intrinsic);
             cvWrite(fs, "distortion", distortion);
             cvReleaseFileStorage(&fs);    
@@ -151,7 +211,10 @@ int main(int argc, char **argv)
         }
 
         // Release the images
-        for (int i = 0; i < num; i++) cvReleaseImage(&images[i]);
+        for (int i = 0; i < num; i++) {
+            cvReleaseImage(&samples[i]->gray);
+            delete samples[i];
+        }
     }
 
     // See you
@@ -160,6 +223,86 @@ int main(int argc, char **argv)
     return 0;
 }
 #else
+// Header of the cache of the remap tables
+struct MAP_HEADER {
+    int   magic;                        // MAP_MAGIC
+    int   width, height;                // Image size
+    float intrinsic[9];                 // Camera parameters the tables were made from
+    float distortion[4];
+};
+
+// A band of the undistortion
+struct REMAP_TASK {
+    const IplImage *src;                // Camera image
+    IplImage       *dst;                // Undistorted image
+    const CvMat    *map1, *map2;        // Fixed-point remap tables
+    CvRect         rect;                // Rows of the band
+    JOIN           *join;               // Join of the bands
+};
+
+// --------------------------------------------------------------------------
+// loadMaps(Header, Remap table (CV_16SC2), Remap table (CV_16UC1))
+// Read the cached tables when they were made from the same parameters.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+static int loadMaps(const MAP_HEADER *header, CvMat *map1, CvMat *map2)
+{
+    FILE *fp = fopen(MAP_FILE, "rb");
+    if (!fp) return 0;
+
+    // Compare the headers
+    MAP_HEADER cached;
+    int ok = (fread(&cached, sizeof(MAP_HEADER), 1, fp) == 1) && !memcmp(&cached, header, sizeof(MAP_HEADER));
+
+    // Read the tables row by row (The rows may be padded)
+    for (int y = 0; ok && y < map1->rows; y++) {
+        ok = (fread(map1->data.ptr + y * map1->step, sizeof(short) * 2, map1->cols, fp) == (size_t)map1->cols) &&
+             (fread(map2->data.ptr + y * map2->step, sizeof(unsigned short), map2->cols, fp) == (size_t)map2->cols);
+    }
+
+    fclose(fp);
+    return ok;
+}
+
+// --------------------------------------------------------------------------
+// saveMaps(Header, Remap table (CV_16SC2), Remap table (CV_16UC1))
+// Write the tables to the cache.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+static int saveMaps(const MAP_HEADER *header, const CvMat *map1, const CvMat *map2)
+{
+    FILE *fp = fopen(MAP_FILE, "wb");
+    if (!fp) return 0;
+
+    int ok = (fwrite(header, sizeof(MAP_HEADER), 1, fp) == 1);
+    for (int y = 0; ok && y < map1->rows; y++) {
+        ok = (fwrite(map1->data.ptr + y * map1->step, sizeof(short) * 2, map1->cols, fp) == (size_t)map1->cols) &&
+             (fwrite(map2->data.ptr + y * map2->step, sizeof(unsigned short), map2->cols, fp) == (size_t)map2->cols);
+    }
+
+    fclose(fp);
+    return ok;
+}
+
+// --------------------------------------------------------------------------
+// remapBand(Band)
+// Task of the worker pool. Undistort the rows of a band.
+// Return value NONE
+// --------------------------------------------------------------------------
+static void remapBand(void *arg)
+{
+    REMAP_TASK *task = (REMAP_TASK*)arg;
+
+    // The band of the output and the tables (The input is the whole image)
+    CvMat dst, map1, map2;
+    cvGetSubRect(task->dst,  &dst,  task->rect);
+    cvGetSubRect(task->map1, &map1, task->rect);
+    cvGetSubRect(task->map2, &map2, task->rect);
+    cvRemap(task->src, &dst, &map1, &map2, CV_INTER_LINEAR|CV_WARP_FILL_OUTLIERS, cvScalarAll(0));
+
+    joinFinish(task->join);
+}
+
 // --------------------------------------------------------------------------
 // main(Number of arguments, Value of arguments)
 // This is the main function.
@@ -180,14 +323,57 @@ int main(int argc, char **argv)
     IplImage *image = ardrone.getImage();
 
     // Read intrincis camera parameters
-    CvFileStorage *fs = cvOpenFileStorage("camera.xml", 0, CV_STORAGE_READ);
+    CvFileStorage *fs = cvOpenFileStorage(CAMERA_FILE, 0, CV_STORAGE_READ);
+    if (!fs) {
+        printf("Failed to read %s. Run the calibration first.\n", CAMERA_FILE);
+        return -1;
+    }
     CvMat *intrinsic = (CvMat*)cvRead(fs, cvGetFileNodeByName(fs, NULL, "intrinsic"));
     CvMat *distortion = (CvMat*)cvRead(fs, cvGetFileNodeByName(fs, NULL, "distortion"));
 
-    // Initialize undistortion maps
-    CvMat *mapx = cvCreateMat(image->height, image->width, CV_32FC1);
-    CvMat *mapy = cvCreateMat(image->height, image->width, CV_32FC1);
-    cvInitUndistortMap(intrinsic, distortion, mapx, mapy);
+    // Parameters the tables are made from
+    MAP_HEADER header;
+    memset(&header, 0, sizeof(MAP_HEADER));
+    header.magic  = MAP_MAGIC;
+    header.width  = image->width;
+    header.height = image->height;
+    for (int i = 0; i < 9; i++) header.intrinsic[i]  = (float)cvGetReal1D(intrinsic, i);
+    for (int i = 0; i < 4; i++) header.distortion[i] = (float)cvGetReal1D(distortion, i);
+
+    // Fixed-point remap tables (Made once and cached)
+    CvMat *map1 = cvCreateMat(image->height, image->width, CV_16SC2);
+    CvMat *map2 = cvCreateMat(image->height, image->width, CV_16UC1);
+    if (!loadMaps(&header, map1, map2)) {
+        printf("Making the remap tables...");
+        CvMat *mapx = cvCreateMat(image->height, image->width, CV_32FC1);
+        CvMat *mapy = cvCreateMat(image->height, image->width, CV_32FC1);
+        cvInitUndistortMap(intrinsic, distortion, mapx, mapy);
+        cvConvertMaps(mapx, mapy, map1, map2);
+        cvReleaseMat(&mapx);
+        cvReleaseMat(&mapy);
+        if (!saveMaps(&header, map1, map2)) printf("Failed to write %s.\n", MAP_FILE);
+        printf("Finished !\n");
+    }
+
+    // Undistorted image (cvRemap() can not work in place)
+    IplImage *undistorted = cvCreateImage(cvGetSize(image), image->depth, image->nChannels);
+
+    // Bands for each processor
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int bands = (int)info.dwNumberOfProcessors;
+    if (bands < 1) bands = 1;
+    if (bands > MAX_BANDS) bands = MAX_BANDS;
+    REMAP_TASK tasks[MAX_BANDS];
+    JOIN join = {0, NULL};
+    for (int i = 0; i < bands; i++) {
+        const int y0 = image->height * i / bands;
+        const int y1 = image->height * (i + 1) / bands;
+        tasks[i].dst  = undistorted;
+        tasks[i].map1 = map1;
+        tasks[i].map2 = map2;
+        tasks[i].rect = cvRect(0, y0, image->width, y1 - y0);
+    }
 
     // Main loop
     while (!GetAsyncKeyState(VK_ESCAPE)) {
@@ -197,17 +383,27 @@ int main(int argc, char **argv)
         // Getting an image
         image = ardrone.getImage();
 
-        // Remap the image
-        cvRemap(image, image, mapx, mapy);
+        // Remap the image band by band
+        joinStart(&join, bands);
+        for (int i = 0; i < bands; i++) {
+            tasks[i].src  = image;
+            tasks[i].join = &join;
+            if (!WorkerPool::shared()->submit(remapBand, &tasks[i])) remapBand(&tasks[i]);
+        }
+        joinWait(&join);
 
         // Display the image
-        cvShowImage("camera", image);
+        cvShowImage("camera", undistorted);
         cvWaitKey(1);
     }
 
     // Release the matrices
-    cvReleaseMat(&mapx);
-    cvReleaseMat(&mapy);
+    if (join.done) CloseHandle(join.done);
+    cvReleaseImage(&undistorted);
+    cvReleaseMat(&map1);
+    cvReleaseMat(&map2);
+    cvReleaseMat(&intrinsic);
+    cvReleaseMat(&distortion);
     cvReleaseFileStorage(&fs);
 
     // See you
@@ -0,0 +1,362 @@
+#include "ardrone/ardrone.h"
+#include <vector>
+#include <algorithm>
+
+// Benchmark settings
+#define OPEN_TIMEOUT    (10000)         // Timeout of open() and the first frame [ms]
+#define NUM_MOVES       (10)            // Number of move3D() steps
+#define MOVE_THRESHOLD  (1000.0f)       // Pitch which counts as the effect [mdeg]
+#define MOVE_TIMEOUT    (2000)          // Timeout of a move3D() step [ms]
+#define TOLERANCE       (0.10)          // Allowed regression against the baseline
+
+// Results ("scenario.metric" and value, in the order of measurement)
+typedef std::vector<std::pair<std::string, double> > RESULTS;
+
+// Navdata counter of the callback
+static volatile LONG navdataCount = 0;
+
+// --------------------------------------------------------------------------
+// onNavdata(AR.Drone, Navdata, User argument)
+// Count the received Navdata.
+// Return value NONE
+// --------------------------------------------------------------------------
+static void onNavdata(ARDrone *ardrone, const NAVDATA *navdata, void *arg)
+{
+    InterlockedIncrement(&navdataCount);
+}
+
+// --------------------------------------------------------------------------
+// cpuTime()
+// Obtaining the CPU time used by this process (User and kernel).
+// Return value CPU time [ms]
+// --------------------------------------------------------------------------
+static double cpuTime(void)
+{
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0.0;
+    ULARGE_INTEGER k, u;
+    k.u.LowPart = kernel.dwLowDateTime;
+    k.u.HighPart = kernel.dwHighDateTime;
+    u.u.LowPart = user.dwLowDateTime;
+    u.u.HighPart = user.dwHighDateTime;
+    return (double)(k.QuadPart + u.QuadPart) * 0.0001;
+}
+
+// --------------------------------------------------------------------------
+// percentile(Samples, Percentage)
+// Obtaining the percentile. The samples are sorted.
+// Return value Percentile (0 when there is no sample)
+// --------------------------------------------------------------------------
+static double percentile(std::vector<double> &samples, double p)
+{
+    if (samples.empty()) return 0.0;
+    std::sort(samples.begin(), samples.end());
+    int index = (int)(p * 0.01 * (samples.size() - 1) + 0.5);
+    return samples[index];
+}
+
+// --------------------------------------------------------------------------
+// addResult(Results, Scenario, Metric, Value)
+// Save a measurement.
+// Return value NONE
+// --------------------------------------------------------------------------
+static void addResult(RESULTS *results, const char *scenario, const char *metric, double value)
+{
+    results->push_back(std::make_pair(std::string(scenario) + "." + metric, value));
+    printf("  %-24s = %10.2f\n", metric, value);
+}
+
+// --------------------------------------------------------------------------
+// addPercentiles(Results, Scenario, Metric, Samples)
+// Save p50, p90, p99 and the maximum.
+// Return value NONE
+// --------------------------------------------------------------------------
+static void addPercentiles(RESULTS *results, const char *scenario, const char *metric, std::vector<double> &samples)
+{
+    const char *suffix[] = {"_p50_ms", "_p90_ms", "_p99_ms", "_max_ms"};
+    const double p[] = {50.0, 90.0, 99.0, 100.0};
+    for (int i = 0; i < 4; i++) {
+        std::string name = std::string(metric) + suffix[i];
+        addResult(results, scenario, name.c_str(), percentile(samples, p[i]));
+    }
+}
+
+// --------------------------------------------------------------------------
+// sentFrame(Simulator, Timestamps of the image)
+// Find when the simulator sent the frame, by the frame number of the PaVE
+// header it stamped. AR.Drone 1.0 has no PaVE, so the frame is unknown.
+// Return value Send time of the frame [ms] (0: Unknown)
+// --------------------------------------------------------------------------
+static double sentFrame(ARDroneSimulator *simulator, const RECEIVE_TIMESTAMP &timestamp)
+{
+    if (timestamp.frame < 0) return 0.0;
+    return simulator->getFrameTime((unsigned int)timestamp.frame);
+}
+
+// --------------------------------------------------------------------------
+// measureMove(AR.Drone, Simulator, Direction, Latency on the drone, Latency on Navdata)
+// Step the set point of move3D() and measure when the pitch follows.
+// Return value SUCCESS: 1  FAILED: 0 (Timeout)
+// --------------------------------------------------------------------------
+static int measureMove(ARDrone *ardrone, ARDroneSimulator *simulator, double direction, double *drone, double *navdata)
+{
+    *drone = *navdata = -1.0;
+
+    // Step the set point (Forward makes the pitch negative)
+    const double start = ardGetTickCount();
+    ardrone->move3D(direction, 0.0, 0.0, 0.0);
+    while (ardGetTickCount() - start < MOVE_TIMEOUT && (*drone < 0.0 || *navdata < 0.0)) {
+        // Keep the set point alive like a control loop
+        ardrone->move3D(direction, 0.0, 0.0, 0.0);
+
+        NAVDATA state;
+        simulator->getNavdata(&state);
+        if (*drone < 0.0 && -state.theta * direction > MOVE_THRESHOLD) *drone = ardGetTickCount() - start;
+        if (*navdata < 0.0 && -ardrone->getPitch() * RAD_TO_DEG * 1000.0 * direction > MOVE_THRESHOLD) *navdata = ardGetTickCount() - start;
+        Sleep(1);
+    }
+
+    // Hover again
+    ardrone->move3D(0.0, 0.0, 0.0, 0.0);
+    const double hover = ardGetTickCount();
+    while (ardGetTickCount() - hover < MOVE_TIMEOUT && fabs(ardrone->getPitch() * RAD_TO_DEG * 1000.0) > MOVE_THRESHOLD * 0.2) Sleep(1);
+
+    return (*drone >= 0.0 && *navdata >= 0.0);
+}
+
+// --------------------------------------------------------------------------
+// runScenario(Name, Version, Video fixture, Duration [s], Results)
+// Open an ARDrone against the simulator and measure it.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+static int runScenario(const char *name, int version, const char *fixture, double seconds, RESULTS *results)
+{
+    printf("%s (AR.Drone %d.0, %s)\n", name, version, fixture ? fixture : "No video");
+
+    // Start the simulator
+    ARDroneSimulator simulator;
+    if (!simulator.open(version, fixture)) {
+        printf("ERROR: ARDroneSimulator::open() failed.\n");
+        return 0;
+    }
+    ARDRONE_PORTS ports;
+    simulator.getPorts(&ports);
+
+    // Open the AR.Drone (Probe the version every time)
+    ARDrone ardrone;
+    ardrone.setPorts(&ports);
+    ardrone.setVersionLifetime(0.0);
+    const double start = ardGetTickCount();
+    if (!ardrone.openAsync("127.0.0.1")) return 0;
+
+    // Time to the first Navdata and frame
+    double ttfNavdata = -1.0, ttfFrame = -1.0;
+    int opened = -1;
+    while (ardGetTickCount() - start < OPEN_TIMEOUT) {
+        RECEIVE_TIMESTAMP ts;
+        if (ttfNavdata < 0.0 && ardrone.getNavdataTimestamp(&ts)) ttfNavdata = ts.ready - start;
+        if (ttfFrame < 0.0 && ardrone.getImageTimestamp(&ts)) ttfFrame = ts.ready - start;
+        if (opened < 0) opened = ardrone.waitOpen(0);
+        if (opened == 0 || (opened > 0 && (ttfFrame >= 0.0 || !fixture))) break;
+        Sleep(1);
+    }
+    if (opened != 1) {
+        printf("ERROR: ARDrone::open() failed.\n");
+        return 0;
+    }
+    addResult(results, name, "open_ms", ardGetTickCount() - start);
+    addResult(results, name, "ttf_navdata_ms", ttfNavdata);
+    if (fixture) addResult(results, name, "ttf_frame_ms", ttfFrame);
+
+    // Sustained rates, latency and CPU
+    int id = ardrone.addNavdataCallback(onNavdata);
+    InterlockedExchange(&navdataCount, 0);
+    std::vector<double> latency, decode;
+    int frames = 0;
+    double last = 0.0;
+    const double cpu = cpuTime(), begin = ardGetTickCount();
+    while (ardGetTickCount() - begin < seconds * 1000.0) {
+        // A new frame
+        RECEIVE_TIMESTAMP ts;
+        if (fixture && ardrone.getImageTimestamp(&ts) && ts.ready != last) {
+            last = ts.ready;
+            frames++;
+
+            // From the simulator's send to getImage()
+            ardrone.getImage();
+            const double visible = ardGetTickCount();
+            const double sent = sentFrame(&simulator, ts);
+            if (sent > 0.0) latency.push_back(visible - sent);
+            decode.push_back(ts.ready - ts.receive);
+        }
+        Sleep(1);
+    }
+    const double elapsed = (ardGetTickCount() - begin) * 0.001;
+    const double used = cpuTime() - cpu;
+    ardrone.removeCallback(id);
+    addResult(results, name, "navdata_hz", navdataCount / elapsed);
+    if (fixture) {
+        addResult(results, name, "fps", frames / elapsed);
+        if (!latency.empty()) addPercentiles(results, name, "latency", latency);
+        else printf("  %-24s = %10s\n", "latency", "Unknown (No frame numbers)");
+        addPercentiles(results, name, "decode", decode);
+    }
+    addResult(results, name, "cpu_ms_per_s", used / elapsed);
+
+    // Command to effect
+    ardrone.takeoff();
+    const double takeoff = ardGetTickCount();
+    while (ardGetTickCount() - takeoff < OPEN_TIMEOUT && (ardrone.onGround() || ardrone.getAltitude() < 0.75)) Sleep(10);
+    if (!ardrone.onGround()) {
+        std::vector<double> drone, navdata;
+        for (int i = 0; i < NUM_MOVES; i++) {
+            double d, n;
+            if (measureMove(&ardrone, &simulator, (i % 2) ? -1.0 : 1.0, &d, &n)) {
+                drone.push_back(d);
+                navdata.push_back(n);
+            }
+        }
+        addPercentiles(results, name, "move_to_drone", drone);
+        addPercentiles(results, name, "move_to_navdata", navdata);
+        ardrone.landing();
+    }
+    else printf("ERROR: ARDrone::takeoff() failed.\n");
+
+    // See you
+    ardrone.close();
+    simulator.close();
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// saveJSON(File name, Results)
+// Write the results as a flat JSON object.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+static int saveJSON(const char *filename, const RESULTS &results)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp) return 0;
+    fprintf(fp, "{\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        fprintf(fp, "  \"%s\": %.3f%s\n", results[i].first.c_str(), results[i].second, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(fp, "}\n");
+    fclose(fp);
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// saveCSV(File name, Results)
+// Write the results as "metric,value" lines.
+// Return value SUCCESS: 1  FAILED: 0
+// --------------------------------------------------------------------------
+static int saveCSV(const char *filename, const RESULTS &results)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp) return 0;
+    fprintf(fp, "metric,value\n");
+    for (size_t i = 0; i < results.size(); i++) fprintf(fp, "%s,%.3f\n", results[i].first.c_str(), results[i].second);
+    fclose(fp);
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// compareBaseline(File name, Results, Tolerance)
+// Compare the results with a JSON saved by saveJSON(). Rates should not
+// drop and the others should not rise by more than the tolerance.
+// Return value Number of regressions (-1: No baseline)
+// --------------------------------------------------------------------------
+static int compareBaseline(const char *filename, const RESULTS &results, double tolerance)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return -1;
+
+    int regressions = 0;
+    char line[256], key[128];
+    double base;
+    printf("Baseline %s (Tolerance %.0f%%)\n", filename, tolerance * 100.0);
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, " \"%127[^\"]\": %lf", key, &base) != 2) continue;
+
+        // Find the metric
+        size_t i;
+        for (i = 0; i < results.size(); i++) {
+            if (results[i].first == key) break;
+        }
+        if (i == results.size() || base <= 0.0) continue;
+        const double value = results[i].second;
+
+        // Higher is better for the rates
+        const int higher = (strstr(key, "fps") || strstr(key, "_hz"));
+        const double change = (value - base) / base;
+        const int worse = higher ? (change < -tolerance) : (change > tolerance);
+        if (worse) {
+            printf("  REGRESSION %-32s %10.2f -> %10.2f (%+.0f%%)\n", key, base, value, change * 100.0);
+            regressions++;
+        }
+    }
+    fclose(fp);
+
+    if (!regressions) printf("  No regression.\n");
+
+    return regressions;
+}
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Value of arguments)
+// This is the main function.
+// Measures ARDrone end to end against ARDroneSimulator on this machine.
+//   main_e2e_benchmark [-uvlc fixture] [-h264 fixture] [-seconds 10]
+//                      [-json out.json] [-csv out.csv] [-baseline base.json] [-tolerance 0.1]
+// Video fixtures are recorded by "main_simulator capture".
+// Return value Success:0 Error:-1 (Including regressions)
+// --------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    // Arguments
+    const char *uvlc = NULL, *h264 = NULL, *json = NULL, *csv = NULL, *baseline = NULL;
+    double seconds = 10.0, tolerance = TOLERANCE;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if      (!strcmp(argv[i], "-uvlc"))      uvlc      = argv[i + 1];
+        else if (!strcmp(argv[i], "-h264"))      h264      = argv[i + 1];
+        else if (!strcmp(argv[i], "-seconds"))   seconds   = atof(argv[i + 1]);
+        else if (!strcmp(argv[i], "-json"))      json      = argv[i + 1];
+        else if (!strcmp(argv[i], "-csv"))       csv       = argv[i + 1];
+        else if (!strcmp(argv[i], "-baseline"))  baseline  = argv[i + 1];
+        else if (!strcmp(argv[i], "-tolerance")) tolerance = atof(argv[i + 1]);
+    }
+
+    // Scenarios (Navdata only, UVLC and H.264)
+    RESULTS results;
+    int ok = runScenario("navdata", ARDRONE_VERSION_1, NULL, seconds, &results);
+    if (uvlc) ok &= runScenario("uvlc", ARDRONE_VERSION_1, uvlc, seconds, &results);
+    if (h264) ok &= runScenario("h264", ARDRONE_VERSION_2, h264, seconds, &results);
+
+    // CPU of the video streams (Minus Navdata and AT commands)
+    double base = 0.0;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].first == "navdata.cpu_ms_per_s") base = results[i].second;
+    }
+    for (size_t i = 0, n = results.size(); i < n; i++) {
+        if (results[i].first == "uvlc.cpu_ms_per_s" || results[i].first == "h264.cpu_ms_per_s") {
+            std::string name = results[i].first.substr(0, 4);
+            printf("%s\n", name.c_str());
+            addResult(&results, name.c_str(), "video_cpu_ms_per_s", results[i].second - base);
+        }
+    }
+
+    // Save
+    if (json && !saveJSON(json, results)) printf("ERROR: Failed to write %s.\n", json);
+    if (csv  && !saveCSV(csv, results))   printf("ERROR: Failed to write %s.\n", csv);
+
+    // Compare
+    if (baseline) {
+        int regressions = compareBaseline(baseline, results, tolerance);
+        if (regressions < 0) printf("ERROR: Failed to read %s.\n", baseline);
+        if (regressions != 0) return -1;
+    }
+
+    return ok ? 0 : -1;
+}
\ No newline at end of file
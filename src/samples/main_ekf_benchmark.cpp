@@ -0,0 +1,75 @@
+#include "ardrone/ardrone.h"
+
+// Benchmark settings
+#define NUM_DRONES  (16)                // Number of filters
+#define RATE        (200)               // Navdata rate [Hz]
+#define DURATION    (60)                // Simulated flight time [s]
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Value of arguments)
+// This is the main function.
+// Feeds synthetic full-rate Navdata to NUM_DRONES filters on one core.
+// Return value Success:0 Error:-1
+// --------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    // Run on one core
+    SetThreadAffinityMask(GetCurrentThread(), 1);
+
+    // Filters and synthetic Navdata
+    static NavdataEKF ekf[NUM_DRONES];
+    static NAVDATA navdata[NUM_DRONES];
+    ZeroMemory(navdata, sizeof(navdata));
+
+    // Precompute noisy measurements so the benchmark measures the filter only
+    const int steps = RATE * DURATION;
+    const double dt = 1000.0 / RATE;
+    float *noise = (float*)malloc(sizeof(float) * 1024);
+    srand(0);
+    for (int i = 0; i < 1024; i++) noise[i] = (float)((rand() % 2001) - 1000) * 0.001f;
+
+    // Run
+    double worst = 0.0;
+    const double start = ardGetTickCount();
+    for (int k = 0; k < steps; k++) {
+        const double t = k * dt;
+        const double begin = ardGetTickCount();
+
+        // One Navdata packet for each drone
+        for (int i = 0; i < NUM_DRONES; i++) {
+            const float n = noise[(k * NUM_DRONES + i) & 1023];
+            navdata[i].phi      = 2000.0f * sin(t * 0.001) + 100.0f * n;
+            navdata[i].theta    = 1500.0f * cos(t * 0.001) + 100.0f * n;
+            navdata[i].psi      = (float)(i * 10000) + 500.0f * n;
+            navdata[i].altitude = 1000 + (int)(20.0f * n);
+            navdata[i].vx       = 500.0f + 50.0f * n;
+            navdata[i].vy       = 200.0f - 50.0f * n;
+            ekf[i].update(&navdata[i], t);
+        }
+
+        // Worst time for one packet of all drones
+        const double elapsed = ardGetTickCount() - begin;
+        if (elapsed > worst) worst = elapsed;
+    }
+    const double total = ardGetTickCount() - start;
+
+    // Result
+    const double per_update = total * 1000.0 / ((double)steps * NUM_DRONES);
+    const double load = total / (DURATION * 1000.0) * 100.0;
+    printf("Drones        = %d\n", NUM_DRONES);
+    printf("Navdata rate  = %d [Hz]\n", RATE);
+    printf("Updates       = %d\n", steps * NUM_DRONES);
+    printf("Time / update = %.3f [us]\n", per_update);
+    printf("Worst period  = %.3f [ms] (budget %.3f [ms])\n", worst, dt);
+    printf("CPU load      = %.3f [%%] of one core\n", load);
+    printf("Result        = %s\n", (load < 100.0 && worst < dt) ? "KEEPS UP" : "TOO SLOW");
+
+    // Estimate of the first drone
+    STATE_ESTIMATE estimate;
+    ekf[0].getEstimate(&estimate);
+    printf("ekf[0]        = (%.2f, %.2f, %.2f) [m]\n", estimate.x, estimate.y, estimate.z);
+
+    free(noise);
+
+    return 0;
+}
\ No newline at end of file
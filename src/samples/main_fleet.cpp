@@ -0,0 +1,82 @@
+#include "ardrone/ardrone.h"
+
+// Maximum number of drones of this sample
+#define MAX_DRONES (8)
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Value of arguments)
+// Fly several AR.Drones from one process. Their video is decoded by one
+// ARDroneFleet, and its statistics are shown every second.
+//   main_fleet [IP address 1] [IP address 2] ...
+// Return value Success:0 Error:-1
+// --------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    // IP addresses
+    const int num = (argc > 1) ? ((argc - 1 < MAX_DRONES) ? argc - 1 : MAX_DRONES) : 1;
+    const char *addr[MAX_DRONES];
+    for (int i = 0; i < num; i++) addr[i] = (argc > 1) ? argv[i + 1] : ARDRONE_DEFAULT_ADDR;
+
+    // AR.Drones decoded by the fleet (The first one goes first)
+    ARDroneFleet fleet;
+    ARDrone ardrone[MAX_DRONES];
+    ARDRONE_PORTS local = {0, 0, 0, 0, 0};
+    for (int i = 0; i < num; i++) {
+        ardrone[i].setLocalPorts(&local);
+        fleet.add(&ardrone[i], (i == 0) ? 1 : 0);
+    }
+    printf("%d drones, %d decode threads\n", num, fleet.getThreads());
+
+    // Initialize all of them at the same time
+    for (int i = 0; i < num; i++) ardrone[i].openAsync(addr[i]);
+    for (int i = 0; i < num; i++) {
+        if (ardrone[i].waitOpen() != 1) {
+            printf("Failed to initialize %s.\n", addr[i]);
+            for (int j = 0; j < num; j++) ardrone[j].close();
+            return -1;
+        }
+    }
+
+    // Main loop
+    double last = ardGetTickCount();
+    fleet.resetStats();
+    while (1) {
+        // Key input
+        int key = cvWaitKey(33);
+        if (key == 0x1b) break;
+
+        // Update and show the images
+        int lost = 0;
+        for (int i = 0; i < num; i++) {
+            if (!ardrone[i].update()) {
+                printf("Lost %s.\n", addr[i]);
+                lost = 1;
+                break;
+            }
+            char name[32];
+            sprintf(name, "camera%d", i);
+            cvShowImage(name, ardrone[i].getImage());
+        }
+        if (lost) break;
+
+        // Statistics
+        if (ardGetTickCount() - last > 1000.0) {
+            for (int i = 0; i < num; i++) {
+                FLEET_STATS stats;
+                fleet.getStats(&ardrone[i], &stats);
+                printf("%-15s %5.1f fps, latency %5.1f (max %5.1f) [ms], wait %5.1f [ms], decode %5.1f [ms], dropped %u\n",
+                       addr[i], stats.fps, stats.latency, stats.maxLatency, stats.wait, stats.decode, stats.dropped);
+            }
+            FLEET_STATS total;
+            fleet.getTotalStats(&total);
+            printf("%-15s %5.1f fps, latency %5.1f (max %5.1f) [ms]\n", "Total", total.fps, total.latency, total.maxLatency);
+            fleet.resetStats();
+            last = ardGetTickCount();
+        }
+    }
+
+    // See you
+    for (int i = 0; i < num; i++) ardrone[i].close();
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#include "ardrone/ardrone.h"
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Value of arguments)
+// This is the main function.
+// Converts a flight record to CSV. Usage: test.exe flight.bin > flight.csv
+// Return value Success:0 Error:-1
+// --------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    // File name
+    const char *filename = (argc > 1) ? argv[1] : "flight.bin";
+
+    // Open the record
+    FlightRecorderReader reader;
+    if (!reader.open(filename)) {
+        printf("Failed to open %s.\n", filename);
+        return -1;
+    }
+
+    // Header
+    printf("time[ms],state,sequence,battery[%%],roll[deg],pitch[deg],yaw[deg],altitude[m],vx[m/s],vy[m/s],vz[m/s]\n");
+
+    // Records
+    const double start = reader.getHeader()->start_tick;
+    const void *data;
+    double tick;
+    int size;
+    while ((size = reader.read(&data, &tick)) > 0) {
+        // Too short
+        if (size < (int)sizeof(NAVDATA)) continue;
+
+        // Print Navdata demo
+        const NAVDATA *nav = (const NAVDATA*)data;
+        printf("%.3f,0x%08x,%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", tick - start, nav->ardrone_state, nav->sequence, nav->vbat_flying_percentage,
+               nav->phi * 0.001, nav->theta * 0.001, nav->psi * 0.001, nav->altitude * 0.001, nav->vx * 0.001, nav->vy * 0.001, nav->vz * 0.001);
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include "ardrone/ardrone.h"
+
+#define KEY_DOWN(key) (GetAsyncKeyState(key) & 0x8000)
+#define KEY_PUSH(key) (GetAsyncKeyState(key) & 0x0001)
+
+// --------------------------------------------------------------------------
+// decode(AR.Drone, Frame)
+// Source of the pipeline. Copies a new image of the AR.Drone.
+// Return value Made: 1  Not yet: 0  End: -1
+// --------------------------------------------------------------------------
+int decode(void *arg, PIPELINE_FRAME *frame)
+{
+    ARDrone *ardrone = (ARDrone*)arg;
+    if (!ardrone->update()) return -1;
+
+    // Same image as the last one
+    static double last = 0.0;
+    RECEIVE_TIMESTAMP timestamp;
+    if (!ardrone->getImageTimestamp(&timestamp) || timestamp.ready == last) {
+        Sleep(1);
+        return 0;
+    }
+    last = timestamp.ready;
+
+    IplImage *image = ardrone->getImage();
+    cvCopy(image, FramePipeline::prepare(&frame->image, cvGetSize(image), 3));
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// convert(Not used, Frame)
+// Smooth the image and make the grayscale one.
+// Return value Pass: 1
+// --------------------------------------------------------------------------
+int convert(void *arg, PIPELINE_FRAME *frame)
+{
+    cvSmooth(frame->image, frame->image, CV_GAUSSIAN, 3, 3);
+    cvCvtColor(frame->image, FramePipeline::prepare(&frame->gray, cvGetSize(frame->image), 1), CV_BGR2GRAY);
+    return 1;
+}
+
+// Results of the stages for each frame (Frames in between the stages are fewer than PIPELINE_FRAMES)
+struct RESULTS {
+    CvPoint2D32f     points[PIPELINE_FRAMES][FLOW_MAX_POINTS];  // Feature points
+    int              count[PIPELINE_FRAMES];                    // Number of them
+    COLOR_BLOB       blob[PIPELINE_FRAMES];                     // Red blob
+    IplImage         *eig, *tmp;                                // Buffers of the detector
+    ColorBlobTracker *tracker;                                  // Tracker of the blob
+};
+
+// --------------------------------------------------------------------------
+// detect(Results, Frame)
+// Detect the corners on the grayscale image.
+// Return value Pass: 1
+// --------------------------------------------------------------------------
+int detect(void *arg, PIPELINE_FRAME *frame)
+{
+    RESULTS *results = (RESULTS*)arg;
+    const int index = frame->number % PIPELINE_FRAMES;
+
+    // Buffers of the detector
+    if (!results->eig || results->eig->width != frame->gray->width || results->eig->height != frame->gray->height) {
+        if (results->eig) cvReleaseImage(&results->eig);
+        if (results->tmp) cvReleaseImage(&results->tmp);
+        results->eig = cvCreateImage(cvGetSize(frame->gray), IPL_DEPTH_32F, 1);
+        results->tmp = cvCreateImage(cvGetSize(frame->gray), IPL_DEPTH_32F, 1);
+    }
+
+    results->count[index] = FLOW_MAX_POINTS;
+    cvGoodFeaturesToTrack(frame->gray, results->eig, results->tmp, results->points[index], &results->count[index], 0.1, 5.0);
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// track(Results, Frame)
+// Track the red blob. This stage has one thread, so the frames come in order.
+// Return value Pass: 1
+// --------------------------------------------------------------------------
+int track(void *arg, PIPELINE_FRAME *frame)
+{
+    RESULTS *results = (RESULTS*)arg;
+    results->tracker->update(frame->image);
+    results->tracker->getBlob(&results->blob[frame->number % PIPELINE_FRAMES]);
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// annotate(Results, Frame)
+// Draw the results on the image.
+// Return value Pass: 1
+// --------------------------------------------------------------------------
+int annotate(void *arg, PIPELINE_FRAME *frame)
+{
+    RESULTS *results = (RESULTS*)arg;
+    const int index = frame->number % PIPELINE_FRAMES;
+
+    // Feature points
+    for (int i = 0; i < results->count[index]; i++) {
+        cvCircle(frame->image, cvPointFrom32f(results->points[index][i]), 2, CV_RGB(0, 255, 0));
+    }
+
+    // Red blob
+    const COLOR_BLOB *blob = &results->blob[index];
+    if (blob->found) {
+        cvRectangle(frame->image, cvPoint(blob->rect.x, blob->rect.y), cvPoint(blob->rect.x + blob->rect.width - 1, blob->rect.y + blob->rect.height - 1), CV_RGB(255, 0, 0), 2);
+    }
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Value of arguments)
+// Process the camera images on a pipeline of decode, convert, detect, track and
+// annotate. Each stage runs on its own thread, so the next frame is converted
+// while this one is annotated, and the statistics are shown every second.
+// Return value Success:0 Error:-1
+// --------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    // AR.Drone class
+    ARDrone ardrone;
+
+    // Initialize
+    if (!ardrone.open()) {
+        printf("Failed to initialize.\n");
+        return -1;
+    }
+
+    // Results of the stages and color blob tracker
+    static RESULTS results;
+    ColorBlobTracker tracker;
+    tracker.setRange(cvScalar(170, 120, 60), cvScalar(10, 255, 255));
+    results.tracker = &tracker;
+
+    // Pipeline
+    FramePipeline pipeline;
+    pipeline.setSource(decode, &ardrone);
+    pipeline.addStage(convert,  NULL,     1, "convert");
+    pipeline.addStage(detect,   &results, 1, "detect");
+    pipeline.addStage(track,    &results, 1, "track");
+    pipeline.addStage(annotate, &results, 1, "annotate");
+    if (!pipeline.start()) {
+        ardrone.close();
+        return -1;
+    }
+
+    // Main loop
+    double last = ardGetTickCount();
+    while (!GetAsyncKeyState(VK_ESCAPE)) {
+        // Take off / Landing
+        if (KEY_PUSH(VK_SPACE)) {
+            if (ardrone.onGround()) ardrone.takeoff();
+            else                    ardrone.landing();
+        }
+
+        // AR.Drone is flying
+        if (!ardrone.onGround()) {
+            // Move
+            double vx = 0.0, vy = 0.0, vz = 0.0, vr = 0.0;
+            if (KEY_DOWN(VK_UP))    vx =  0.5;
+            if (KEY_DOWN(VK_DOWN))  vx = -0.5;
+            if (KEY_DOWN(VK_LEFT))  vr =  0.5;
+            if (KEY_DOWN(VK_RIGHT)) vr = -0.5;
+            if (KEY_DOWN('Q'))      vz =  0.5;
+            if (KEY_DOWN('A'))      vz = -0.5;
+            ardrone.move3D(vx, vy, vz, vr);
+        }
+
+        // Display the latest frame
+        PIPELINE_FRAME *frame = pipeline.pop(100);
+        if (frame) {
+            cvShowImage("camera", frame->image);
+            pipeline.release(frame);
+        }
+        cvWaitKey(1);
+
+        // Statistics
+        if (ardGetTickCount() - last > 1000.0) {
+            for (int i = -1; i < pipeline.getStages(); i++) {
+                PIPELINE_STATS stats;
+                pipeline.getStats(i, &stats);
+                printf("%-8s %5.1f fps, busy %5.1f [ms], latency %5.1f [ms], queue %d (max %d), dropped %u\n",
+                       pipeline.getName(i), stats.fps, stats.busy, stats.latency, stats.depth, stats.maxDepth, stats.dropped);
+            }
+            pipeline.resetStats();
+            last = ardGetTickCount();
+        }
+    }
+
+    // Stop the pipeline
+    pipeline.stop();
+    if (results.eig) cvReleaseImage(&results.eig);
+    if (results.tmp) cvReleaseImage(&results.tmp);
+
+    // See you
+    ardrone.close();
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include "ardrone/ardrone.h"
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Value of arguments)
+// Run the simulator, or record a fixture from a real AR.Drone.
+//   main_simulator [1|2] [Video fixture]
+//   main_simulator capture [IP address] [1|2] [Video fixture] [Seconds]
+// A client on this machine connects with ARDrone::setPorts() like this.
+//   ARDRONE_PORTS ports;
+//   simulator.getPorts(&ports);
+//   ardrone.setPorts(&ports);
+//   ardrone.open("127.0.0.1");
+// Return value Success:0 Error:-1
+// --------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    // Record a fixture
+    if (argc > 1 && !strcmp(argv[1], "capture")) {
+        const char *addr     = (argc > 2) ? argv[2] : ARDRONE_DEFAULT_ADDR;
+        const int   version  = (argc > 3) ? atoi(argv[3]) : ARDRONE_VERSION_2;
+        const char *filename = (argc > 4) ? argv[4] : "fixture.bin";
+        const double seconds = (argc > 5) ? atof(argv[5]) : 10.0;
+        printf("Recording the video of %s for %.0f seconds...\n", addr, seconds);
+        if (!ARDroneSimulator::capture(addr, version, filename, seconds * 1000.0)) return -1;
+        printf("Saved to %s.\n", filename);
+        return 0;
+    }
+
+    // Simulator
+    ARDroneSimulator simulator;
+    const int version = (argc > 1) ? atoi(argv[1]) : ARDRONE_VERSION_2;
+    const char *fixture = (argc > 2) ? argv[2] : NULL;
+    if (!simulator.open(version, fixture)) {
+        printf("Failed to start the simulator.\n");
+        return -1;
+    }
+
+    // Ports
+    ARDRONE_PORTS ports;
+    simulator.getPorts(&ports);
+    printf("AR.Drone %d.0 simulator (FTP %d, Navdata %d, Video %d, AT %d, Config %d)\n", version, ports.version, ports.navdata, ports.video, ports.command, ports.config);
+    printf("Press ESC to stop.\n");
+
+    // Main loop
+    while (!GetAsyncKeyState(VK_ESCAPE)) {
+        NAVDATA navdata;
+        simulator.getNavdata(&navdata);
+
+        // State of the simulated drone
+        printf("state = 0x%08X, altitude = %.2f [m], pitch = %.1f, roll = %.1f, yaw = %.1f [deg], commands = %u, frames = %u\n",
+               navdata.ardrone_state, navdata.altitude * 0.001, navdata.theta * 0.001, navdata.phi * 0.001, navdata.psi * 0.001,
+               simulator.getCommandCount(), simulator.getFrameCount());
+
+        Sleep(500);
+    }
+
+    // See you
+    simulator.close();
+
+    return 0;
+}
\ No newline at end of file
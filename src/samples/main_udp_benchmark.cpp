@@ -0,0 +1,165 @@
+#include "ardrone/ardrone.h"
+
+// Benchmark settings
+#define PORT            (15554)         // Loopback port (The socket sends to itself)
+#define NUM_ROUNDS      (20000)         // Number of bursts
+#define BURST           (ARDRONE_UDP_BATCH) // Datagrams queued at once
+#define DATAGRAM_SIZE   (500)           // Size of a full Navdata packet [bytes]
+
+// Counters of the calls which enter the kernel
+static int socketCalls = 0;
+static int syncCalls   = 0;
+
+// --------------------------------------------------------------------------
+// fill(Datagram, Sequence number)
+// Make a Navdata-like packet.
+// Return value NONE
+// --------------------------------------------------------------------------
+static void fill(char *buf, int seq)
+{
+    memset(buf, 0, DATAGRAM_SIZE);
+    ((unsigned int*)buf)[0] = ARDRONE_NAVDATA_HEADER;
+    ((unsigned int*)buf)[2] = seq;
+}
+
+// --------------------------------------------------------------------------
+// runSingle(Socket, Mutex, Event)
+// One datagram per call, one lock and one event per datagram
+// like ARDrone::getNavdata() did.
+// Return value Number of received datagrams
+// --------------------------------------------------------------------------
+static int runSingle(UDPSocket *sock, HANDLE mutex, HANDLE event)
+{
+    char buf[ARDRONE_UDP_SLOT_SIZE];
+    int received = 0;
+
+    for (int r = 0; r < NUM_ROUNDS; r++) {
+        // Send a burst
+        for (int i = 0; i < BURST; i++) {
+            fill(buf, r * BURST + i);
+            sock->send2(buf, DATAGRAM_SIZE);
+            socketCalls++;
+        }
+
+        // Receive all of them
+        int n = 0;
+        const double deadline = ardGetTickCount() + 100.0;
+        while (n < BURST && ardGetTickCount() < deadline) {
+            int size;
+            while ((socketCalls++, size = sock->receive(buf, sizeof(buf))) > 0) {
+                WaitForSingleObject(mutex, INFINITE);
+                ReleaseMutex(mutex);
+                SetEvent(event);
+                syncCalls += 3;
+                n++;
+            }
+        }
+        received += n;
+    }
+
+    return received;
+}
+
+// --------------------------------------------------------------------------
+// runBatch(Socket, Mutex, Event)
+// sendBatch()/receiveBatch(), one lock and one event per batch.
+// Return value Number of received datagrams
+// --------------------------------------------------------------------------
+static int runBatch(UDPSocket *sock, HANDLE mutex, HANDLE event)
+{
+    UDPBatch out, in;
+    char buf[DATAGRAM_SIZE];
+    int received = 0;
+
+    for (int r = 0; r < NUM_ROUNDS; r++) {
+        // Send a burst
+        out.clear();
+        for (int i = 0; i < BURST; i++) {
+            fill(buf, r * BURST + i);
+            out.add(buf, DATAGRAM_SIZE);
+        }
+        sock->sendBatch(&out);
+        socketCalls += out.count();
+
+        // Receive all of them
+        int n = 0;
+        const double deadline = ardGetTickCount() + 100.0;
+        while (n < BURST && ardGetTickCount() < deadline) {
+            int num;
+            do {
+                num = sock->receiveBatch(&in);
+                socketCalls += (num < in.capacity()) ? num + 1 : num;
+                if (num < 1) break;
+                WaitForSingleObject(mutex, INFINITE);
+                ReleaseMutex(mutex);
+                SetEvent(event);
+                syncCalls += 3;
+                n += num;
+            } while (num == in.capacity());
+        }
+        received += n;
+    }
+
+    return received;
+}
+
+// --------------------------------------------------------------------------
+// main(Number of arguments, Value of arguments)
+// This is the main function.
+// Compares one-by-one and batched UDP I/O against a loopback stand-in.
+// WinSock sends and receives each datagram with its own call either way,
+// so the batch saves the locks and events around them.
+// Return value Success:0 Error:-1
+// --------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    // Initialize WSA
+    WSAData wsaData;
+    WSAStartup(MAKEWORD(1, 1), &wsaData);
+
+    // Loopback socket
+    UDPSocket sock;
+    if (!sock.open("127.0.0.1", PORT)) {
+        printf("ERROR: UDPSocket::open() failed.\n");
+        WSACleanup();
+        return -1;
+    }
+
+    // Enough buffer for a burst
+    int rcvbuf = 256 * 1024;
+    setsockopt(sock.getSocket(), SOL_SOCKET, SO_RCVBUF, (const char*)&rcvbuf, sizeof(rcvbuf));
+
+    // Stand-ins of mutexNavdata and eventNavdata
+    HANDLE mutex = CreateMutex(NULL, FALSE, NULL);
+    HANDLE event = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    // One by one
+    socketCalls = syncCalls = 0;
+    double start = ardGetTickCount();
+    const int n1 = runSingle(&sock, mutex, event);
+    const double time1 = ardGetTickCount() - start;
+    const int socket1 = socketCalls, sync1 = syncCalls;
+
+    // Batch
+    socketCalls = syncCalls = 0;
+    start = ardGetTickCount();
+    const int n2 = runBatch(&sock, mutex, event);
+    const double time2 = ardGetTickCount() - start;
+    const int socket2 = socketCalls, sync2 = syncCalls;
+
+    // Result
+    printf("Datagrams     = %d x %d [bytes]\n", NUM_ROUNDS * BURST, DATAGRAM_SIZE);
+    printf("              %12s %12s\n", "one-by-one", "batch");
+    printf("Received      %12d %12d\n", n1, n2);
+    printf("Socket calls  %12.2f %12.2f [/datagram]\n", (double)socket1 / n1, (double)socket2 / n2);
+    printf("Sync calls    %12.2f %12.2f [/datagram]\n", (double)sync1 / n1, (double)sync2 / n2);
+    printf("Time          %12.3f %12.3f [us/datagram]\n", time1 * 1000.0 / n1, time2 * 1000.0 / n2);
+
+    // Finalize
+    CloseHandle(event);
+    CloseHandle(mutex);
+    sock.close();
+    WSACleanup();
+
+    return 0;
+}
\ No newline at end of file
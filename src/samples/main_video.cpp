@@ -22,12 +22,17 @@ int main(int argc, char **argv)
     // Image of AR.Drone's camera
     IplImage *image = ardrone.getImage();
 
-    // Create a video writer
+    // Create a video recorder (Frames are written on its own thread)
     char filename[256];
     SYSTEMTIME st;
     GetLocalTime(&st);
     sprintf(filename, "cam%d%02d%02d%02d%02d%02d.avi", st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
-    CvVideoWriter *video = cvCreateVideoWriter(filename, CV_FOURCC('D','I','B',' '), 30, cvGetSize(image));
+    VideoRecorder video;
+    if (!video.open(filename, CV_FOURCC('D','I','B',' '), 30, cvGetSize(image))) {
+        printf("Failed to create %s.\n", filename);
+        ardrone.close();
+        return -1;
+    }
 
     // Main loop
     while (!GetAsyncKeyState(VK_ESCAPE)) {
@@ -37,8 +42,8 @@ int main(int argc, char **argv)
         // Getting an image
         image = ardrone.getImage();
 
-        // Write a frame
-        cvWriteFrame(video, image);
+        // Queue a frame
+        video.write(image);
 
         // Display the image
         cvShowImage("camera", image);
@@ -46,7 +51,8 @@ int main(int argc, char **argv)
     }
 
     // Save video
-    cvReleaseVideoWriter(&video);
+    video.close();
+    printf("%u frames written, %u dropped\n", video.getWritten(), video.getDropped());
 
     // See you
     ardrone.close();